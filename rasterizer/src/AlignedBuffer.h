@@ -0,0 +1,53 @@
+#pragma once
+#ifndef _ALIGNEDBUFFER_H_
+#define _ALIGNEDBUFFER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// A value of type T for every pixel in one allocation, row by row like
+// Image, with the origin at the lower left. Every row starts on a cache
+// line, so a span of a row can be loaded and stored whole.
+template<typename T>
+class AlignedBuffer
+{
+public:
+	static const size_t CACHE_LINE = 64;
+
+	AlignedBuffer(int w, int h, T clear) :
+		width(w),
+		height(h),
+		stride((int)((w*sizeof(T) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE / sizeof(T)))
+	{
+		size_t count = (size_t)stride*height;
+		data = static_cast<T *>(operator new[](std::max<size_t>(count, 1)*sizeof(T), std::align_val_t(CACHE_LINE)));
+		std::fill(data, data + count, clear);
+	}
+	virtual ~AlignedBuffer()
+	{
+		operator delete[](data, std::align_val_t(CACHE_LINE));
+	}
+	T *getRow(int y) { return data + (size_t)y*stride; }
+	const T *getRow(int y) const { return data + (size_t)y*stride; }
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+private:
+	AlignedBuffer(const AlignedBuffer &) = delete;
+	AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+	int width;
+	int height;
+	int stride; // values from one row to the next
+	T *data;
+};
+
+// depth of every pixel, nearer is larger
+typedef AlignedBuffer<float> DepthBuffer;
+// the number of the triangle seen at every pixel, NO_TRIANGLE where none is
+typedef AlignedBuffer<uint32_t> VisibilityBuffer;
+const uint32_t NO_TRIANGLE = 0xffffffff;
+
+#endif
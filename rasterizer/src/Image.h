@@ -11,6 +11,9 @@ public:
 	Image(int width, int height);
 	virtual ~Image();
 	void setPixel(int x, int y, unsigned char r, unsigned char g, unsigned char b);
+	// The r, g, b bytes of row y, with the origin at the lower left like
+	// setPixel, for writing spans of a row without any checks
+	unsigned char *getRow(int y) { return &pixels[(size_t)(height - y - 1)*width*comp]; }
 	void writeToFile(const std::string &filename);
 	int getWidth() const { return width; }
 	int getHeight() const { return height; }
@@ -0,0 +1,77 @@
+#include "Matrix.h"
+
+#include <cmath>
+
+Matrix4::Matrix4()
+{
+	for(int i = 0; i < 4; i++) {
+		for(int j = 0; j < 4; j++) {
+			m[i][j] = i == j ? 1.0 : 0.0;
+		}
+	}
+}
+
+Vector4 Matrix4::operator*(const Vector4 &v) const
+{
+	Vector4 r;
+	r.x = m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z + m[0][3]*v.w;
+	r.y = m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z + m[1][3]*v.w;
+	r.z = m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z + m[2][3]*v.w;
+	r.w = m[3][0]*v.x + m[3][1]*v.y + m[3][2]*v.z + m[3][3]*v.w;
+	return r;
+}
+
+Matrix4 Matrix4::operator*(const Matrix4 &b) const
+{
+	Matrix4 r;
+	for(int i = 0; i < 4; i++) {
+		for(int j = 0; j < 4; j++) {
+			r.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j] + m[i][3]*b.m[3][j];
+		}
+	}
+	return r;
+}
+
+Matrix4 Matrix4::translate(double x, double y, double z)
+{
+	Matrix4 r;
+	r.m[0][3] = x;
+	r.m[1][3] = y;
+	r.m[2][3] = z;
+	return r;
+}
+
+Matrix4 Matrix4::rotateY(double angle)
+{
+	Matrix4 r;
+	r.m[0][0] = cos(angle);
+	r.m[0][2] = sin(angle);
+	r.m[2][0] = -sin(angle);
+	r.m[2][2] = cos(angle);
+	return r;
+}
+
+Matrix4 Matrix4::orthographic(double left, double right, double bottom, double top, double zNear, double zFar)
+{
+	Matrix4 r;
+	r.m[0][0] = 2.0 / (right - left);
+	r.m[1][1] = 2.0 / (top - bottom);
+	r.m[2][2] = -2.0 / (zFar - zNear);
+	r.m[0][3] = -(right + left) / (right - left);
+	r.m[1][3] = -(top + bottom) / (top - bottom);
+	r.m[2][3] = -(zFar + zNear) / (zFar - zNear);
+	return r;
+}
+
+Matrix4 Matrix4::perspective(double fovy, double aspect, double zNear, double zFar)
+{
+	double f = 1.0 / tan(fovy / 2.0);
+	Matrix4 r;
+	r.m[0][0] = f / aspect;
+	r.m[1][1] = f;
+	r.m[2][2] = (zFar + zNear) / (zNear - zFar);
+	r.m[2][3] = 2.0 * zFar * zNear / (zNear - zFar);
+	r.m[3][2] = -1.0;
+	r.m[3][3] = 0.0;
+	return r;
+}
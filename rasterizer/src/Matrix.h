@@ -0,0 +1,35 @@
+#pragma once
+#ifndef _MATRIX_H_
+#define _MATRIX_H_
+
+// A position (w = 1) or direction (w = 0) in homogeneous coordinates
+struct Vector4
+{
+	double x;
+	double y;
+	double z;
+	double w;
+};
+
+// A 4x4 transform applied to column vectors, so a * b applies b first
+class Matrix4
+{
+public:
+	// The identity
+	Matrix4();
+	Vector4 operator*(const Vector4 &v) const;
+	Matrix4 operator*(const Matrix4 &b) const;
+
+	static Matrix4 translate(double x, double y, double z);
+	// Turns x toward -z, like glRotate about the y axis
+	static Matrix4 rotateY(double angle);
+	// Like glOrtho and gluPerspective: the eye looks down -z, and the view
+	// volume maps to -1..1 in x, y and z with the near plane at z = -1.
+	// fovy is in radians.
+	static Matrix4 orthographic(double left, double right, double bottom, double top, double zNear, double zFar);
+	static Matrix4 perspective(double fovy, double aspect, double zNear, double zFar);
+
+	double m[4][4]; // m[row][column]
+};
+
+#endif
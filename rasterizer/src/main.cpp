@@ -4,8 +4,24 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include "AlignedBuffer.h"
 #include "Image.h"
+#include "Matrix.h"
+#include <atomic>
+#include <climits>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+
+// The AVX2 pixel kernel is compiled for x86 with GCC and Clang only, and
+// then only used if the CPU has AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
 
 // This allows you to skip the `std::` in front of C++ standard library
 // functions. You can also say `using std::cout` to be more selective.
@@ -36,41 +52,318 @@ double zmax = 0;
 
 Image* output;
 
+//vertex pipeline
+// Every vertex of posBuf goes through model, view and projection into clip
+// space once, however many triangles of indBuf share it, and lands on
+// screen if it is inside the clip planes. Only triangles with a vertex
+// outside are clipped, against the near and far planes and against a guard
+// band GUARD_BAND times the size of the screen, which keeps the fixed point
+// edge functions in range. Whatever is left outside the screen is left to
+// the bounding box in setupTriangle, so few triangles are ever cut. The
+// viewport then maps x and y to pixels and depth to 1 at the near plane and
+// 0 at the far plane, so nearer is larger like zbuff.
+enum CullMode { CULL_NONE, CULL_BACK, CULL_FRONT };
+struct Pipeline{
+    Matrix4 model;
+    Matrix4 view;
+    Matrix4 projection;
+    CullMode cull;  // front faces wind counterclockwise on screen
+};
+Pipeline pipeline;
+const double GUARD_BAND = 4;
+// A camera looking down -z at the mesh bounds (xmin..zmax). fovy <= 0 gives
+// the orthographic view that fits the bounds to the image. Otherwise fovy
+// is in degrees and the eye is distance times as far from the center as it
+// needs to be to see all of the bounds.
+void setupCamera(double fovy, double distance);
+// A vertex after the vertex stage: its clip space position, the clip planes
+// it is outside of, and where it is on screen if it is inside all of them
+struct ShadedVertex{
+    Vector4 position;
+    int outside;        // bit p set if planeDistance(position, p) < 0
+    double window[3];   // x, y and depth, if outside is 0
+};
+// transform * every vertex of posBuf
+vector<ShadedVertex> transformVertices(vector<float>& posBuf, const Matrix4& transform);
+// norBuf turned by the rotation of model, which must not scale
+vector<float> transformNormals(vector<float>& norBuf, const Matrix4& model);
+// A corner of a clipped triangle and its weights of the corners of the
+// triangle it was cut from
+struct ClipVertex{
+    Vector4 position;
+    double weight[3];
+};
+// Distance of a clip space position inside clip plane 0 to 5: the guard
+// band at left, right, bottom and top, then near and far. Negative is
+// outside.
+double planeDistance(const Vector4& v, int plane);
+// Clips a triangle to the view volume widened to the guard band. Returns
+// how many corners of the convex polygon that is left are in out (0 if
+// nothing is left).
+int clipTriangle(const ShadedVertex* corners[3], ClipVertex out[9]);
+// pixel coordinates and depth of a clip space position
+void toWindow(const Vector4& clip, double& x, double& y, double& depth);
+// bounds of the window coordinates (x, y, depth) of the vertices in front
+// of the eye
+void windowBounds(vector<ShadedVertex>& vertBuf, double lo[3], double hi[3]);
+
 //task 1
-double calcCoord(bool x, bool z, double coord);
-void drawBoundingBoxes(vector<float>& posBuf);
+void drawBoundingBoxes(vector<ShadedVertex>& vertBuf, vector<int>& indBuf);
+
+//triangle setup
+// Vertices are snapped to fixed point with SUBPIXEL_BITS fractional bits and
+// each edge becomes an integer equation w = a*x + b*y + c. It is evaluated
+// once at the first pixel of the bounding box and then stepped with one add
+// per pixel (a) and per row (b). Pixels are sampled at integer coordinates.
+// A pixel exactly on an edge is only inside if the edge is a top or left
+// edge, so triangles that share an edge never both draw it.
+// w[k] is twice the area of the triangle made by the pixel and the edge
+// across from vertex k, so the barycentrics are w[k] / area.
+// Most triangles of a dense mesh are a few pixels across. If the bounding
+// box is at most MICRO_SIZE pixels each way, setup already tests its few
+// pixels, drops the triangle if none is inside, and keeps the ones that are
+// in micro so they can be drawn one by one without walking spans.
+const int SUBPIXEL_BITS = 8;
+const int MICRO_SIZE = 4;
+struct TriangleSetup{
+    int xmin, xmax, ymin, ymax; // pixels to walk, inclusive and on screen
+    int64_t a[3];               // change of each edge function per pixel in x
+    int64_t b[3];               // change per pixel in y
+    int64_t w[3];               // edge functions at (xmin, ymin), biased by the fill rule
+    int64_t bias[3];            // -1 for edges that aren't top or left edges
+    double invArea;             // 1 / twice the area, in fixed point
+    int micro;                  // bit dy*MICRO_SIZE+dx set if pixel (xmin+dx, ymin+dy) is inside, 0 if not a micro triangle
+    
+    // inside if every biased edge function is >= 0
+    static bool inside(int64_t w0, int64_t w1, int64_t w2){ return (w0 | w1 | w2) >= 0; }
+    void barycentrics(int64_t w0, int64_t w1, int64_t w2, double& a, double& b, double& c) const{
+        a = (w0 - bias[0]) * invArea;
+        b = (w1 - bias[1]) * invArea;
+        c = (w2 - bias[2]) * invArea;
+    }
+};
+// false if the triangle is degenerate, culled or covers no pixel
+bool setupTriangle(double px0, double py0, double px1, double py1, double px2, double py2, CullMode cull, TriangleSetup& tri);
+
+//pixel blocks
+// Triangles are walked row by row, 8 pixels of a row at a time, like the
+// depth buffer and the image are stored. Bit k of mask is set if pixel x+k
+// is inside the triangle and nearer than depth[k] (any depth passes
+// without depth), and a/b/c/z[k] are its barycentrics and interpolated
+// depth. Pixels past count are never set. w holds the edge functions at x.
+struct PixelBlock{
+    int mask;
+    double a[8];
+    double b[8];
+    double c[8];
+    double z[8];
+};
+typedef void (*BlockFunction)(const TriangleSetup& tri, const int64_t w[3], int count, const double pz[3], const float* depth, PixelBlock& block);
+void rasterBlockScalar(const TriangleSetup& tri, const int64_t w[3], int count, const double pz[3], const float* depth, PixelBlock& block);
+#ifdef HAVE_AVX2_KERNEL
+void rasterBlockAVX2(const TriangleSetup& tri, const int64_t w[3], int count, const double pz[3], const float* depth, PixelBlock& block);
+#endif
+// AVX2 when the CPU has it and the image is small enough for it to be
+// exact, unless A1_NO_SIMD is set in the environment. Both give the same
+// image.
+BlockFunction chooseBlockFunction();
+BlockFunction rasterBlock = rasterBlockScalar;
+
+//tiled rasterization
+// Triangles are clipped, set up and binned into TILE_SIZE x TILE_SIZE tiles
+// on every thread, and then each tile is drawn by one thread so its part of
+// zbuff and the image stays in cache. A tile draws its triangles in the
+// order they come in indBuf, so the image is the same on any number of
+// threads.
+// Each tile keeps depth bounds of its parts as it fills, so triangles and
+// spans that are behind everything already drawn there are skipped before
+// any pixel is tested.
+const int TILE_SIZE = 64;
+struct BinnedTriangle{
+    TriangleSetup tri;
+    double pz[3];
+    int source;             // the triangle of indBuf it was cut from
+    bool perspective;       // the corners have different w
+    double invW[3];
+    bool cut;
+    double weight[3][3];    // weights of the source corners at each corner
+    
+    // Turns barycentrics on screen into barycentrics of the source
+    // triangle: perspective correct, and back from the clipped corners
+    void sourceBarycentrics(double& a, double& b, double& c) const{
+        if(perspective){
+            a *= invW[0];
+            b *= invW[1];
+            c *= invW[2];
+            double sum = a + b + c;
+            a /= sum;
+            b /= sum;
+            c /= sum;
+        }
+        if(cut){
+            double sa = a*weight[0][0] + b*weight[1][0] + c*weight[2][0];
+            double sb = a*weight[0][1] + b*weight[1][1] + c*weight[2][1];
+            double sc = a*weight[0][2] + b*weight[1][2] + c*weight[2][2];
+            a = sa;
+            b = sb;
+            c = sc;
+        }
+    }
+};
+// Worker threads: A1_THREADS from the environment, or one per hardware thread
+int rasterThreads();
+// Runs fn(thread, begin, end) on rasterThreads() contiguous ranges of [0, count)
+void parallelRanges(int count, const function<void(int, int, int)>& fn);
+// Draws every triangle of indBuf, whose corners are indices of vertBuf.
+// shade is a shader, any type with
+//     void operator()(int t, int x, int y, double a, double b, double c, unsigned char* pixel) const
+// It is called for each pixel that is inside triangle t (its corners are
+// indBuf[3*t] to indBuf[3*t+2]) with the perspective correct barycentrics
+// of the pixel and its r, g, b bytes in the output, after the pixel has
+// passed the depth test and its depth has been stored. Without a zbuff
+// every pixel passes. The driver is compiled once per shader type, so the
+// shader is inlined into the pixel loop.
+template<typename Shade>
+void rasterizeTiled(vector<ShadedVertex>& vertBuf, vector<int>& indBuf, DepthBuffer* zbuff, const Shade& shade);
+// Stores a color like Image::setPixel does, without the checks
+inline void setColor(unsigned char* pixel, unsigned char r, unsigned char g, unsigned char b){
+    pixel[0] = r;
+    pixel[1] = g;
+    pixel[2] = b;
+}
+
+//visibility buffer
+// With -v the triangles are drawn into zbuff and a VisibilityBuffer of
+// triangle numbers only, and then the shader runs once for every covered
+// pixel, so its cost depends on the image size and not on how many
+// triangles were drawn over each pixel. The barycentrics are worked out
+// again from the snapped corners like rasterizeTiled does, so the image is
+// the same as the direct one, except on triangles that were clipped. Those
+// were drawn in pieces, so they use the unsnapped clip space corners,
+// clamped to the triangle; on thin clipped triangles a color can be off by
+// up to the difference between the corner colors.
+bool visibilityShading = false;
+// stores the triangle in the visibility buffer
+struct VisibilityShader{
+    VisibilityBuffer& ids;
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+        ids.getRow(y)[x] = t;
+    }
+};
+// Calls shade for every pixel of ids that holds a triangle, with the
+// perspective correct barycentrics of the pixel in that triangle
+template<typename Shade>
+void shadeVisible(vector<ShadedVertex>& vertBuf, vector<int>& indBuf, VisibilityBuffer& ids, const Shade& shade);
+// rasterizeTiled(vertBuf, indBuf, zbuff, shade), through a visibility
+// buffer with -v
+template<typename Shade>
+void drawMesh(vector<ShadedVertex>& vertBuf, vector<int>& indBuf, DepthBuffer* zbuff, const Shade& shade);
 
 //task 2
-bool inTriangle(int x, int y, double px0, double py0, double px1, double py1,  double px2, double py2);
-double calcInnerArea(double x, double y, double px0, double py0, double px1, double py1);
-void drawTriangles(vector<float>& posBuf, vector<std::vector<double>>& zbuff);
+// each triangle in one color
+struct TriangleColorShader{
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+        double r = RANDOM_COLORS[t%7][0] * 256;
+        double g = RANDOM_COLORS[t%7][1] * 256;
+        double b = RANDOM_COLORS[t%7][2] * 256;
+        setColor(pixel, r, g, b);
+    }
+};
 
 //task 3
-void calcABC(int x, int y, double px0, double py0, double px1, double py1,  double px2, double py2, double& a, double& b, double& c);
-void interpolateTriangle(vector<float>& posBuf, vector<std::vector<double>>& zbuff);
+// colors of the corners interpolated across each triangle
+struct CornerColorShader{
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+        double r0 = RANDOM_COLORS[(t+0)%7][0] * 256;
+        double r1 = RANDOM_COLORS[(t+1)%7][0] * 256;
+        double r2 = RANDOM_COLORS[(t+2)%7][0] * 256;
+        
+        double g0 = RANDOM_COLORS[(t+0)%7][1] * 256;
+        double g1 = RANDOM_COLORS[(t+1)%7][1] * 256;
+        double g2 = RANDOM_COLORS[(t+2)%7][1] * 256;
+        
+        double b0 = RANDOM_COLORS[(t+0)%7][2] * 256;
+        double b1 = RANDOM_COLORS[(t+1)%7][2] * 256;
+        double b2 = RANDOM_COLORS[(t+2)%7][2] * 256;
+        
+        setColor(pixel, r0*aVal+r1*bVal+r2*cVal, g0*aVal+g1*bVal+g2*cVal, b0*aVal+b1*bVal+b2*cVal);
+    }
+};
 
 //task 4
 double calcPercentHeight(double ymax, double ymin, int coord);
-void interpolateVertical(vector<float>& posBuf);
+// blue at screenYmin to red at screenYmax, drawn without a zbuff
+struct HeightShader{
+    double screenYmin;
+    double screenYmax;
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+        double red = calcPercentHeight(screenYmax, screenYmin, y);
+        setColor(pixel, 255*red, 0, 255*(1-red));
+    }
+};
 
 //task 5
-void interpolateDepth(vector<float>& posBuf, vector<std::vector<double>>& zbuff);
+// fills zbuff only, for colorDepth
+struct DepthOnlyShader{
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+    }
+};
+// colors every pixel of zbuff by its depth between the nearest and farthest
+// vertex
+void colorDepth(vector<ShadedVertex>& vertBuf, DepthBuffer& zbuff);
 
 //task 6
-void colorNormal(vector<float>& posBuf, vector<float>& norBuf, vector<std::vector<double>>& zbuff);
+// normals interpolated across each triangle, mapped from [-1, 1] to colors
+struct NormalShader{
+    const vector<int>& indBuf;
+    const vector<float>& norBuf;
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+        int n0 = 3 * indBuf[3*t];
+        int n1 = 3 * indBuf[3*t+1];
+        int n2 = 3 * indBuf[3*t+2];
+        double r0 = 255 * (0.5 * norBuf[n0] + 0.5);
+        double r1 = 255 * (0.5 * norBuf[n1] + 0.5);
+        double r2 = 255 * (0.5 * norBuf[n2] + 0.5);
+        
+        double g0 = 255 * (0.5 * norBuf[n0+1] + 0.5);
+        double g1 = 255 * (0.5 * norBuf[n1+1] + 0.5);
+        double g2 = 255 * (0.5 * norBuf[n2+1] + 0.5);
+        
+        double b0 = 255 * (0.5 * norBuf[n0+2] + 0.5);
+        double b1 = 255 * (0.5 * norBuf[n1+2] + 0.5);
+        double b2 = 255 * (0.5 * norBuf[n2+2] + 0.5);
+        
+        setColor(pixel, r0*aVal+r1*bVal+r2*cVal, g0*aVal+g1*bVal+g2*cVal, b0*aVal+b1*bVal+b2*cVal);
+    }
+};
 
 //task 7
-void basicLighting(vector<float>& posBuf, vector<float>& norBuf, vector<std::vector<double>>& zbuff);
+// diffuse light from (1, 1, 1), lit at the corners and interpolated
+struct LightingShader{
+    const vector<int>& indBuf;
+    const vector<float>& norBuf;
+    void operator()(int t, int x, int y, double aVal, double bVal, double cVal, unsigned char* pixel) const{
+        int n0 = 3 * indBuf[3*t];
+        int n1 = 3 * indBuf[3*t+1];
+        int n2 = 3 * indBuf[3*t+2];
+        double c0 = (1/sqrt(3))*norBuf[n0] + (1/sqrt(3))*norBuf[n0+1] + (1/sqrt(3))*norBuf[n0+2];
+        double c1 = (1/sqrt(3))*norBuf[n1] + (1/sqrt(3))*norBuf[n1+1] + (1/sqrt(3))*norBuf[n1+2];
+        double c2 = (1/sqrt(3))*norBuf[n2] + (1/sqrt(3))*norBuf[n2+1] + (1/sqrt(3))*norBuf[n2+2];
+        double interpolatedLight = max(c0*aVal+c1*bVal+c2*cVal,0.0);
+        setColor(pixel, 255 * interpolatedLight, 255 * interpolatedLight, 255 * interpolatedLight);
+    }
+};
 
 //task 8
-void rotateYAxis(double angle, double& x, double& y, double& z);
+// task 7 with pipeline.model turning the mesh 45 degrees about y
 
 
 
 int main(int argc, char **argv)
 {
-    if (argc != 6) {
-        cout << "Usage: A1 meshFile outputImageFile width height taskNumber" << endl;
+    const char* usage = "Usage: A1 meshFile outputImageFile width height taskNumber [-p fovy] [-d distance] [-c none|back|front] [-v]";
+    if (argc < 6) {
+        cout << usage << endl;
         return 1;
     }
     
@@ -80,17 +373,41 @@ int main(int argc, char **argv)
     height = stoi(argv[4]);
     int taskNumber = stoi(argv[5]);
     
-    
-    output = new Image(width, height);
-    vector<vector<double>> zbuff;// current z at set pixel
-    for(int x = 0; x < width; x++){
-        zbuff.push_back(vector<double>());
-        for(int y = 0; y < height; y++){
-            zbuff[x].push_back(-1); // indicates value is unitialized
+    // camera: orthographic unless a field of view is given
+    double fovy = 0;
+    double distance = 1;
+    pipeline.cull = CULL_NONE;
+    for(int a = 6; a < argc; a++){
+        string option(argv[a]);
+        if(a + 1 < argc && option == "-p"){
+            fovy = stod(argv[++a]);
+        }else if(a + 1 < argc && option == "-d"){
+            distance = stod(argv[++a]);
+        }else if(option == "-v"){
+            visibilityShading = true;
+        }else if(a + 1 < argc && option == "-c"){
+            string cull(argv[++a]);
+            if(cull == "back"){
+                pipeline.cull = CULL_BACK;
+            }else if(cull == "front"){
+                pipeline.cull = CULL_FRONT;
+            }else if(cull != "none"){
+                cout << usage << endl;
+                return 1;
+            }
+        }else{
+            cout << usage << endl;
+            return 1;
         }
     }
     
+    
+    output = new Image(width, height);
+    rasterBlock = chooseBlockFunction();
+    DepthBuffer zbuff(width, height, -1);// current z at set pixel, -1 indicates value is unitialized
+    
     // Load geometry
+    vector<int> indBuf; // list of triangle corners, three per triangle
     vector<float> posBuf; // list of vertex positions
     vector<float> norBuf; // list of vertex normals
     vector<float> texBuf; // list of vertex texture coords
@@ -105,7 +422,14 @@ int main(int argc, char **argv)
         // Some OBJ files have different indices for vertex positions, normals,
         // and texture coordinates. For example, a cube corner vertex may have
         // three different normals. Here, we are going to duplicate all such
-        // vertices.
+        // vertices, and corners with the same three indices share a vertex.
+        auto hashIndex = [](const tinyobj::index_t& i){
+            return hash<int>()(i.vertex_index) ^ (hash<int>()(i.normal_index) * 31) ^ (hash<int>()(i.texcoord_index) * 961);
+        };
+        auto sameIndex = [](const tinyobj::index_t& a, const tinyobj::index_t& b){
+            return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+        };
+        unordered_map<tinyobj::index_t, int, decltype(hashIndex), decltype(sameIndex)> vertexOf(0, hashIndex, sameIndex);
         // Loop over shapes
         for(size_t s = 0; s < shapes.size(); s++) {
             // Loop over faces (polygons)
@@ -116,63 +440,21 @@ int main(int argc, char **argv)
                 for(size_t v = 0; v < fv; v++) {
                     // access to vertex
                     tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-                    
-                    double angle = M_PI/4;
-                    
-                    if(taskNumber == 8){
-                        double x = attrib.vertices[3*idx.vertex_index+0];
-                        double y = attrib.vertices[3*idx.vertex_index+1];
-                        double z = attrib.vertices[3*idx.vertex_index+2];
-                        
-                        rotateYAxis(angle, x, y, z);
-                        
-                        posBuf.push_back(x);
-                        posBuf.push_back(y);
-                        posBuf.push_back(z);
-                        
-                        // find the max and min vertices of the x and y coordinate
-                        // this will help when trying to fit the image
-                        xmin = min(xmin, x);
-                        xmax = max(xmax, x);
-                        
-                        ymin = min(ymin, y);
-                        ymax = max(ymax, y);
-                        
-                        zmin = min(zmin, z);
-                        zmax = max(zmax, z);
-                    }else{
-                        posBuf.push_back(attrib.vertices[3*idx.vertex_index+0]);
-                        posBuf.push_back(attrib.vertices[3*idx.vertex_index+1]);
-                        posBuf.push_back(attrib.vertices[3*idx.vertex_index+2]);
-                        
-                        // find the max and min vertices of the x and y coordinate
-                        // this will help when trying to fit the image
-                        xmin = min(xmin, (double) attrib.vertices[3*idx.vertex_index+0]);
-                        xmax = max(xmax, (double) attrib.vertices[3*idx.vertex_index+0]);
-                        
-                        ymin = min(ymin, (double) attrib.vertices[3*idx.vertex_index+1]);
-                        ymax = max(ymax, (double) attrib.vertices[3*idx.vertex_index+1]);
-                        
-                        zmin = min(zmin, (double) attrib.vertices[3*idx.vertex_index+2]);
-                        zmax = max(zmax, (double) attrib.vertices[3*idx.vertex_index+2]);
+                    auto found = vertexOf.find(idx);
+                    if(found != vertexOf.end()){
+                        indBuf.push_back(found->second);
+                        continue;
                     }
+                    vertexOf[idx] = posBuf.size()/3;
+                    indBuf.push_back(posBuf.size()/3);
                     
+                    posBuf.push_back(attrib.vertices[3*idx.vertex_index+0]);
+                    posBuf.push_back(attrib.vertices[3*idx.vertex_index+1]);
+                    posBuf.push_back(attrib.vertices[3*idx.vertex_index+2]);
                     if(!attrib.normals.empty()) {
-                        if(taskNumber == 8){
-                            double x = attrib.normals[3*idx.normal_index+0];
-                            double y = attrib.normals[3*idx.normal_index+1];
-                            double z = attrib.normals[3*idx.normal_index+2];
-                            
-                            rotateYAxis(angle, x, y, z);
-                            
-                            norBuf.push_back(x);
-                            norBuf.push_back(y);
-                            norBuf.push_back(z);
-                        }else{
-                            norBuf.push_back(attrib.normals[3*idx.normal_index+0]);
-                            norBuf.push_back(attrib.normals[3*idx.normal_index+1]);
-                            norBuf.push_back(attrib.normals[3*idx.normal_index+2]);
-                        }
+                        norBuf.push_back(attrib.normals[3*idx.normal_index+0]);
+                        norBuf.push_back(attrib.normals[3*idx.normal_index+1]);
+                        norBuf.push_back(attrib.normals[3*idx.normal_index+2]);
                     }
                     if(!attrib.texcoords.empty()) {
                         texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+0]);
@@ -186,103 +468,216 @@ int main(int argc, char **argv)
         }
     }
     cout << "Number of vertices: " << posBuf.size()/3 << endl;
+    cout << "Number of triangles: " << indBuf.size()/3 << endl;
     
+    if(taskNumber == 8){
+        pipeline.model = Matrix4::rotateY(M_PI/4);
+    }
+    
+    // find the max and min vertices in the world
+    // this will help when trying to fit the image
+    for(size_t i = 0; i + 2 < posBuf.size(); i += 3){
+        Vector4 p = pipeline.model * Vector4{posBuf[i], posBuf[i+1], posBuf[i+2], 1};
+        xmin = min(xmin, p.x);
+        xmax = max(xmax, p.x);
+        
+        ymin = min(ymin, p.y);
+        ymax = max(ymax, p.y);
+        
+        zmin = min(zmin, p.z);
+        zmax = max(zmax, p.z);
+    }
+    setupCamera(fovy, distance);
+    
+    vector<ShadedVertex> vertBuf = transformVertices(posBuf, pipeline.projection * pipeline.view * pipeline.model);
+    norBuf = transformNormals(norBuf, pipeline.model);
     
     if(taskNumber == 1){
-        drawBoundingBoxes(posBuf);
+        drawBoundingBoxes(vertBuf, indBuf);
     }else if(taskNumber == 2){
-        drawTriangles(posBuf, zbuff);
+        drawMesh(vertBuf, indBuf, &zbuff, TriangleColorShader{});
     }else if(taskNumber == 3){
-        interpolateTriangle(posBuf, zbuff);
+        drawMesh(vertBuf, indBuf, &zbuff, CornerColorShader{});
     }else if(taskNumber == 4){
-        interpolateVertical(posBuf);
+        double lo[3];
+        double hi[3];
+        windowBounds(vertBuf, lo, hi);
+        drawMesh(vertBuf, indBuf, nullptr, HeightShader{lo[1], hi[1]});
     }else if(taskNumber == 5){
-        interpolateDepth(posBuf, zbuff);
+        drawMesh(vertBuf, indBuf, &zbuff, DepthOnlyShader{});
+        colorDepth(vertBuf, zbuff);
     }else if(taskNumber == 6){
-        colorNormal(posBuf, norBuf, zbuff);
+        drawMesh(vertBuf, indBuf, &zbuff, NormalShader{indBuf, norBuf});
     }else if(taskNumber == 7 || taskNumber == 8){
-        basicLighting(posBuf, norBuf, zbuff);
+        drawMesh(vertBuf, indBuf, &zbuff, LightingShader{indBuf, norBuf});
     }
     
     output->writeToFile("./" + outputImage);
     return 0;
 }
 
-//have to think about if the x1-x0 is bigger than width
-double calcCoord(bool x, bool z, double coord){
+void setupCamera(double fovy, double distance){
+    double aspect = width / height;
+    double cx = (xmin + xmax) / 2;
+    double cy = (ymin + ymax) / 2;
+    double cz = (zmin + zmax) / 2;
     
-    //ensure that any vertices are not negative
-    double pxmax = xmax;
-    double pxmin = xmin;
-    
-    double pymax = ymax;
-    double pymin = ymin;
-    
-    if(xmin < 0){
-        pxmax = xmax - xmin;
-        if(x){
-            coord -= xmin;
-        }
-        pxmin = 0;
+    if(fovy <= 0){
+        // the bounds fill the image in x or y and are centered in the other
+        double scale = min(width / (xmax - xmin), height / (ymax - ymin));
+        double halfWidth = width / scale / 2;
+        double halfHeight = height / scale / 2;
+        // a little room in front and behind, so corners on the bounds
+        // aren't clipped
+        double pad = 0.01 * max(zmax - zmin, max(xmax - xmin, ymax - ymin));
+        pipeline.view = Matrix4();
+        pipeline.projection = Matrix4::orthographic(cx - halfWidth, cx + halfWidth, cy - halfHeight, cy + halfHeight, -zmax - pad, -zmin + pad);
+        return;
     }
     
-    if(ymin < 0){
-        pymax = ymax - ymin;
-        if(!x){
-            coord -= ymin;
+    // back far enough for the bounding sphere to fit the narrower field of
+    // view
+    fovy *= M_PI / 180;
+    double fovx = 2 * atan(tan(fovy / 2) * aspect);
+    double radius = sqrt((xmax - xmin)*(xmax - xmin) + (ymax - ymin)*(ymax - ymin) + (zmax - zmin)*(zmax - zmin)) / 2;
+    double eye = distance * radius / sin(min(fovx, fovy) / 2);
+    pipeline.view = Matrix4::translate(-cx, -cy, -(cz + eye));
+    pipeline.projection = Matrix4::perspective(fovy, aspect, max(eye - radius, 0.01 * radius), eye + radius);
+}
+
+vector<ShadedVertex> transformVertices(vector<float>& posBuf, const Matrix4& transform){
+    vector<ShadedVertex> vertBuf(posBuf.size() / 3);
+    for(size_t i = 0; i < vertBuf.size(); i++){
+        ShadedVertex& v = vertBuf[i];
+        v.position = transform * Vector4{posBuf[3*i], posBuf[3*i+1], posBuf[3*i+2], 1};
+        v.outside = 0;
+        for(int plane = 0; plane < 6; plane++){
+            if(planeDistance(v.position, plane) < 0){
+                v.outside |= 1 << plane;
+            }
+        }
+        if(v.outside == 0){
+            toWindow(v.position, v.window[0], v.window[1], v.window[2]);
         }
-        pymin = 0;
     }
-    
-    if(zmin < 0 && z){
-        coord -= zmin;
+    return vertBuf;
+}
+
+vector<float> transformNormals(vector<float>& norBuf, const Matrix4& model){
+    vector<float> turned(norBuf.size());
+    for(size_t i = 0; i + 2 < norBuf.size(); i += 3){
+        Vector4 n = model * Vector4{norBuf[i], norBuf[i+1], norBuf[i+2], 0};
+        turned[i] = n.x;
+        turned[i+1] = n.y;
+        turned[i+2] = n.z;
+    }
+    return turned;
+}
+
+double planeDistance(const Vector4& v, int plane){
+    switch(plane){
+        case 0: return GUARD_BAND * v.w + v.x;
+        case 1: return GUARD_BAND * v.w - v.x;
+        case 2: return GUARD_BAND * v.w + v.y;
+        case 3: return GUARD_BAND * v.w - v.y;
+        case 4: return v.w + v.z; // near
+        default: return v.w - v.z; // far
+    }
+}
+
+int clipTriangle(const ShadedVertex* corners[3], ClipVertex out[9]){
+    // gone if all corners are outside one plane
+    int outside = corners[0]->outside | corners[1]->outside | corners[2]->outside;
+    if(corners[0]->outside & corners[1]->outside & corners[2]->outside){
+        return 0;
+    }
+    for(int k = 0; k < 3; k++){
+        out[k].position = corners[k]->position;
+        for(int e = 0; e < 3; e++){
+            out[k].weight[e] = k == e ? 1 : 0;
+        }
     }
     
-    double occupyx = (pxmax-pxmin)/ width;
-    double occupyy = (pymax-pymin)/ height;
-    if(occupyx >= occupyy){
-        double mid = (pymax-pymin)/2.0;
-        double convx = width / (pxmax - pxmin);
-        
-        if(z || x){
-            return (convx-pxmin) * coord;
-        }else{ // y
-            double offset = height/2 - convx * mid;
-            return convx * (coord - pymin) + offset; // must subtract min if y dimension potentially has a bigger max to start it at 0
+    // cut the polygon by each plane a corner is outside of
+    int count = 3;
+    ClipVertex kept[9];
+    for(int plane = 0; plane < 6 && count > 0; plane++){
+        if(!(outside & (1 << plane))){
+            continue;
         }
-        
-    }else{
-        double mid = (pxmax-pxmin)/2.0;
-        double convy = height / (pymax - pymin);
-        
-        if(z || !x){
-            return convy * (coord - pymin);
+        int keptCount = 0;
+        for(int k = 0; k < count; k++){
+            const ClipVertex& p = out[k];
+            const ClipVertex& q = out[(k + 1) % count];
+            double dp = planeDistance(p.position, plane);
+            double dq = planeDistance(q.position, plane);
+            if(dp >= 0){
+                kept[keptCount++] = p;
+            }
+            if((dp >= 0) != (dq >= 0)){
+                double t = dp / (dp - dq);
+                ClipVertex& v = kept[keptCount++];
+                v.position.x = p.position.x + t * (q.position.x - p.position.x);
+                v.position.y = p.position.y + t * (q.position.y - p.position.y);
+                v.position.z = p.position.z + t * (q.position.z - p.position.z);
+                v.position.w = p.position.w + t * (q.position.w - p.position.w);
+                for(int e = 0; e < 3; e++){
+                    v.weight[e] = p.weight[e] + t * (q.weight[e] - p.weight[e]);
+                }
+            }
         }
-        else{ // x
-            double offset = width/2 - convy * mid;
-            return convy * (coord-pxmin) + offset;
+        count = keptCount;
+        for(int k = 0; k < count; k++){
+            out[k] = kept[k];
         }
     }
+    return count;
 }
 
+void toWindow(const Vector4& clip, double& x, double& y, double& depth){
+    x = (clip.x / clip.w + 1) * width / 2;
+    y = (clip.y / clip.w + 1) * height / 2;
+    depth = (1 - clip.z / clip.w) / 2;
+}
 
+void windowBounds(vector<ShadedVertex>& vertBuf, double lo[3], double hi[3]){
+    for(int e = 0; e < 3; e++){
+        lo[e] = INFINITY;
+        hi[e] = -INFINITY;
+    }
+    for(const ShadedVertex& v : vertBuf){
+        if(v.position.w <= 0){
+            continue;
+        }
+        double window[3];
+        toWindow(v.position, window[0], window[1], window[2]);
+        for(int e = 0; e < 3; e++){
+            lo[e] = min(lo[e], window[e]);
+            hi[e] = max(hi[e], window[e]);
+        }
+    }
+}
 
-void drawBoundingBoxes(vector<float>& posBuf){
+void drawBoundingBoxes(vector<ShadedVertex>& vertBuf, vector<int>& indBuf){
     //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        double r = RANDOM_COLORS[(i/9)%7][0] * 256;
-        double g = RANDOM_COLORS[(i/9)%7][1] * 256;
-        double b = RANDOM_COLORS[(i/9)%7][2] * 256;
-        
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false, posBuf[i+1]);
+    for(int i = 0; i + 2 < (int)indBuf.size(); i+=3){
+        double r = RANDOM_COLORS[(i/3)%7][0] * 256;
+        double g = RANDOM_COLORS[(i/3)%7][1] * 256;
+        double b = RANDOM_COLORS[(i/3)%7][2] * 256;
         
-        double px1 = calcCoord(true, false, posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
+        const Vector4& p0 = vertBuf[indBuf[i]].position;
+        const Vector4& p1 = vertBuf[indBuf[i+1]].position;
+        const Vector4& p2 = vertBuf[indBuf[i+2]].position;
+        // boxes can't be drawn around corners behind the eye
+        if(p0.w <= 0 || p1.w <= 0 || p2.w <= 0){
+            continue;
+        }
         
-        double px2 = calcCoord(true, false, posBuf[i+6]);
-        double py2 = calcCoord(false, false, posBuf[i+7]);
+        // get all the triangle points
+        double px0, py0, px1, py1, px2, py2, depth;
+        toWindow(p0, px0, py0, depth);
+        toWindow(p1, px1, py1, depth);
+        toWindow(p2, px2, py2, depth);
         
         //draw a bounding box around triangle
         double xpoint0 = min(px0, min(px1, px2));
@@ -300,341 +695,542 @@ void drawBoundingBoxes(vector<float>& posBuf){
     }
 }
 
-bool inTriangle(int x, int y, double px0, double py0, double px1, double py1,  double px2, double py2){
-    double totalArea = (calcInnerArea(px0, py0, px1, py1, px2, py2));
-    double a = calcInnerArea(x, y, px1, py1, px2, py2)/totalArea;
-    double b = calcInnerArea(x, y, px2, py2, px0, py0)/totalArea;
-    double c = calcInnerArea(x, y, px0, py0, px1, py1)/totalArea;
+bool setupTriangle(double px0, double py0, double px1, double py1, double px2, double py2, CullMode cull, TriangleSetup& tri){
+    const double one = 1 << SUBPIXEL_BITS;
+    int64_t X[3] = {llround(px0 * one), llround(px1 * one), llround(px2 * one)};
+    int64_t Y[3] = {llround(py0 * one), llround(py1 * one), llround(py2 * one)};
     
-    if(a < 0 ){
+    // pixels whose sample point can be inside, clipped to the image
+    tri.xmin = max(0LL, (long long)((min(X[0], min(X[1], X[2])) + (1 << SUBPIXEL_BITS) - 1) >> SUBPIXEL_BITS));
+    tri.ymin = max(0LL, (long long)((min(Y[0], min(Y[1], Y[2])) + (1 << SUBPIXEL_BITS) - 1) >> SUBPIXEL_BITS));
+    tri.xmax = min((long long)width - 1, (long long)(max(X[0], max(X[1], X[2])) >> SUBPIXEL_BITS));
+    tri.ymax = min((long long)height - 1, (long long)(max(Y[0], max(Y[1], Y[2])) >> SUBPIXEL_BITS));
+    if(tri.xmin > tri.xmax || tri.ymin > tri.ymax){
         return false;
     }
     
-    if(b < 0){
-        return false;
+    // edge k runs between the two vertices other than k
+    int64_t c[3];
+    for(int k = 0; k < 3; k++){
+        int i = (k + 1) % 3;
+        int j = (k + 2) % 3;
+        tri.a[k] = Y[i] - Y[j];
+        tri.b[k] = X[j] - X[i];
+        c[k] = X[i] * Y[j] - X[j] * Y[i];
     }
-    
-    if(c < 0){
+    int64_t area = tri.a[0] * X[0] + tri.b[0] * Y[0] + c[0];
+    if(area == 0 || (cull == CULL_BACK && area < 0) || (cull == CULL_FRONT && area > 0)){
         return false;
     }
+    // flip clockwise triangles to make the inside positive
+    if(area < 0){
+        area = -area;
+        for(int k = 0; k < 3; k++){
+            tri.a[k] = -tri.a[k];
+            tri.b[k] = -tri.b[k];
+            c[k] = -c[k];
+        }
+    }
+    tri.invArea = 1.0 / area;
     
-    if(a+b+c > 1.001){
-        return false;
+    for(int k = 0; k < 3; k++){
+        // left edges have the inside to their right, top edges are
+        // horizontal with the inside below them
+        bool topLeft = tri.a[k] > 0 || (tri.a[k] == 0 && tri.b[k] < 0);
+        tri.bias[k] = topLeft ? 0 : -1;
+        tri.w[k] = tri.a[k] * ((int64_t)tri.xmin << SUBPIXEL_BITS) + tri.b[k] * ((int64_t)tri.ymin << SUBPIXEL_BITS) + c[k] + tri.bias[k];
+        // step one whole pixel
+        tri.a[k] <<= SUBPIXEL_BITS;
+        tri.b[k] <<= SUBPIXEL_BITS;
     }
     
+    tri.micro = 0;
+    if(tri.xmax - tri.xmin < MICRO_SIZE && tri.ymax - tri.ymin < MICRO_SIZE){
+        for(int dy = 0; dy <= tri.ymax - tri.ymin; dy++){
+            for(int dx = 0; dx <= tri.xmax - tri.xmin; dx++){
+                int64_t w0 = tri.w[0] + dx * tri.a[0] + dy * tri.b[0];
+                int64_t w1 = tri.w[1] + dx * tri.a[1] + dy * tri.b[1];
+                int64_t w2 = tri.w[2] + dx * tri.a[2] + dy * tri.b[2];
+                if(TriangleSetup::inside(w0, w1, w2)){
+                    tri.micro |= 1 << (dy * MICRO_SIZE + dx);
+                }
+            }
+        }
+        // falls between the pixels
+        if(tri.micro == 0){
+            return false;
+        }
+    }
     return true;
 }
 
-
-
-double calcInnerArea(double x, double y, double px0, double py0, double px1, double py1){
-    return 0.5 * ((px0-x)*(py1-y)-(px1-x)*(py0-y));
-}
-
-void drawTriangles(vector<float>& posBuf, vector<std::vector<double>>& zbuff){
-    //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        double r = RANDOM_COLORS[(i/9)%7][0] * 256;
-        double g = RANDOM_COLORS[(i/9)%7][1] * 256;
-        double b = RANDOM_COLORS[(i/9)%7][2] * 256;
-        
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false,posBuf[i+1]);
-        double pz0 = calcCoord(false, true, posBuf[i+2]);
-        
-        double px1 = calcCoord(true, false,posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
-        double pz1 = calcCoord(false, true, posBuf[i+5]);
-        
-        double px2 = calcCoord(true, false,posBuf[i+6]);
-        double py2 = calcCoord(false, false,posBuf[i+7]);
-        double pz2 = calcCoord(false, true, posBuf[i+8]);
-        
-        //draw a bounding box around triangle
-        double xpoint0 = min(px0, min(px1, px2));
-        double ypoint0 = min(py0, min(py1, py2));
-        
-        double xpoint1 = max(px0, max(px1, px2));
-        double ypoint1 = max(py0, max(py1, py2));
-        
-        for(int x = floor(xpoint0); x < ceil(xpoint1); x++){
-            for(int y = floor(ypoint0); y < ceil(ypoint1); y++){
-                if(inTriangle(x, y, px0, py0, px1, py1, px2, py2)){
-                    double aVal;
-                    double bVal;
-                    double cVal;
-                    
-                    calcABC(x, y, px0, py0, px1, py1, px2, py2, aVal, bVal, cVal);
-                    double zval = aVal*pz0 + bVal*pz1 + cVal*pz2;
-                    if(zval > zbuff[x][y]){
-                        zbuff[x][y] = zval;
-                        output->setPixel(x, y, r, g, b);
-                    }
-                }
+void rasterBlockScalar(const TriangleSetup& tri, const int64_t w[3], int count, const double pz[3], const float* depth, PixelBlock& block){
+    block.mask = 0;
+    int64_t w0 = w[0];
+    int64_t w1 = w[1];
+    int64_t w2 = w[2];
+    for(int k = 0; k < count; k++){
+        if(TriangleSetup::inside(w0, w1, w2)){
+            tri.barycentrics(w0, w1, w2, block.a[k], block.b[k], block.c[k]);
+            block.z[k] = block.a[k]*pz[0] + block.b[k]*pz[1] + block.c[k]*pz[2];
+            if(!depth || block.z[k] > depth[k]){
+                block.mask |= 1 << k;
             }
         }
+        w0 += tri.a[0];
+        w1 += tri.a[1];
+        w2 += tri.a[2];
     }
 }
 
-void calcABC(int x, int y, double px0, double py0, double px1, double py1,  double px2, double py2, double& a, double& b, double& c){
-    double totalArea = calcInnerArea(px0, py0, px1, py1, px2, py2);
-    a = calcInnerArea(x, y, px1, py1, px2, py2)/totalArea;
-    b = calcInnerArea(x, y, px2, py2, px0, py0)/totalArea;
-    c = calcInnerArea(x, y, px0, py0, px1, py1)/totalArea;
+#ifdef HAVE_AVX2_KERNEL
+// int64 to double, exact for |v| < 2^51: adding v to the bits of
+// 2^52 + 2^51 gives the double 2^52 + 2^51 + v
+__attribute__((target("avx2")))
+static inline __m256d toDouble(__m256i v){
+    const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+    return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_add_epi64(v, _mm256_castpd_si256(magic))), magic);
 }
 
-
-void interpolateTriangle(vector<float>& posBuf, vector<std::vector<double>>& zbuff){
-    //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        double r0 = RANDOM_COLORS[(i/9+0)%7][0] * 256;
-        double r1 = RANDOM_COLORS[(i/9+1)%7][0] * 256;
-        double r2 = RANDOM_COLORS[(i/9+2)%7][0] * 256;
-        
-        double g0 = RANDOM_COLORS[(i/9+0)%7][1] * 256;
-        double g1 = RANDOM_COLORS[(i/9+1)%7][1] * 256;
-        double g2 = RANDOM_COLORS[(i/9+2)%7][1] * 256;
-        
-        double b0 = RANDOM_COLORS[(i/9+0)%7][2] * 256;
-        double b1 = RANDOM_COLORS[(i/9+1)%7][2] * 256;
-        double b2 = RANDOM_COLORS[(i/9+2)%7][2] * 256;
-        
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false,posBuf[i+1]);
-        double pz0 = calcCoord(false, true, posBuf[i+2]);
-        
-        double px1 = calcCoord(true, false,posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
-        double pz1 = calcCoord(false, true, posBuf[i+5]);
-        
-        double px2 = calcCoord(true, false,posBuf[i+6]);
-        double py2 = calcCoord(false, false,posBuf[i+7]);
-        double pz2 = calcCoord(false, true, posBuf[i+8]);
-        
-        //draw a bounding box around triangle
-        double xpoint0 = min(px0, min(px1, px2));
-        double ypoint0 = min(py0, min(py1, py2));
-        
-        double xpoint1 = max(px0, max(px1, px2));
-        double ypoint1 = max(py0, max(py1, py2));
-        
-        for(int x = floor(xpoint0); x < ceil(xpoint1); x++){
-            for(int y = floor(ypoint0); y < ceil(ypoint1); y++){
-                
-                if(inTriangle(x, y, px0, py0, px1, py1, px2, py2)){
-                    double aVal;
-                    double bVal;
-                    double cVal;
-                    
-                    calcABC(x, y, px0, py0, px1, py1, px2, py2, aVal, bVal, cVal);
-                    double zval = aVal*pz0 + bVal*pz1 + cVal*pz2;
-                    if(zval > zbuff[x][y]){
-                        zbuff[x][y] = zval;
-                        output->setPixel(x, y, r0*aVal+r1*bVal+r2*cVal, g0*aVal+g1*bVal+g2*cVal, b0*aVal+b1*bVal+b2*cVal);
-                    }
-                }
-            }
+// Same math as rasterBlockScalar in the same order, 4 pixels per register,
+// so the results are identical as long as toDouble is exact. Vertices are
+// inside the guard band, -1.5 to 2.5 times the image size, so an edge
+// function at a pixel is at most 4*height * 2.5*width + 4*width * 2.5*height
+// = 20 * width * height in pixels, times 2^(2*SUBPIXEL_BITS). That is below
+// 2^51 up to MAX_AVX2_PIXELS pixels (32768 x 32768); chooseBlockFunction
+// uses rasterBlockScalar for larger images.
+const double MAX_AVX2_PIXELS = 1 << 30;
+__attribute__((target("avx2")))
+void rasterBlockAVX2(const TriangleSetup& tri, const int64_t w[3], int count, const double pz[3], const float* depth, PixelBlock& block){
+    // the rows of small triangles don't fill enough lanes to pay off
+    if(count < 4){
+        rasterBlockScalar(tri, w, count, pz, depth, block);
+        return;
+    }
+    
+    __m256i lo[3];
+    __m256i hi[3];
+    for(int e = 0; e < 3; e++){
+        int64_t step = tri.a[e];
+        lo[e] = _mm256_set_epi64x(w[e] + 3*step, w[e] + 2*step, w[e] + step, w[e]);
+        hi[e] = _mm256_add_epi64(lo[e], _mm256_set1_epi64x(4*step));
+    }
+    
+    // sign bits of w0 | w1 | w2 mark the pixels outside
+    __m256i outLo = _mm256_or_si256(_mm256_or_si256(lo[0], lo[1]), lo[2]);
+    __m256i outHi = _mm256_or_si256(_mm256_or_si256(hi[0], hi[1]), hi[2]);
+    int outside = _mm256_movemask_pd(_mm256_castsi256_pd(outLo)) | (_mm256_movemask_pd(_mm256_castsi256_pd(outHi)) << 4);
+    int mask = ~outside & ((1 << count) - 1);
+    if(mask == 0){
+        block.mask = 0;
+        return;
+    }
+    
+    // the block's depths, with nothing passing past count
+    float front[8];
+    if(depth){
+        for(int k = 0; k < 8; k++){
+            front[k] = k < count ? depth[k] : INFINITY;
+        }
+    }
+    
+    const __m256d invArea = _mm256_set1_pd(tri.invArea);
+    const __m256d z0 = _mm256_set1_pd(pz[0]);
+    const __m256d z1 = _mm256_set1_pd(pz[1]);
+    const __m256d z2 = _mm256_set1_pd(pz[2]);
+    __m256i* halves[2] = {lo, hi};
+    int nearer = 0;
+    for(int h = 0; h < 2; h++){
+        __m256i* e = halves[h];
+        __m256d a = _mm256_mul_pd(toDouble(_mm256_sub_epi64(e[0], _mm256_set1_epi64x(tri.bias[0]))), invArea);
+        __m256d b = _mm256_mul_pd(toDouble(_mm256_sub_epi64(e[1], _mm256_set1_epi64x(tri.bias[1]))), invArea);
+        __m256d c = _mm256_mul_pd(toDouble(_mm256_sub_epi64(e[2], _mm256_set1_epi64x(tri.bias[2]))), invArea);
+        __m256d z = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, z0), _mm256_mul_pd(b, z1)), _mm256_mul_pd(c, z2));
+        _mm256_storeu_pd(block.a + 4*h, a);
+        _mm256_storeu_pd(block.b + 4*h, b);
+        _mm256_storeu_pd(block.c + 4*h, c);
+        _mm256_storeu_pd(block.z + 4*h, z);
+        if(depth){
+            nearer |= _mm256_movemask_pd(_mm256_cmp_pd(z, _mm256_cvtps_pd(_mm_loadu_ps(front + 4*h)), _CMP_GT_OQ)) << (4*h);
         }
     }
+    block.mask = depth ? mask & nearer : mask;
 }
+#endif
 
-double calcPercentHeight(double ymax, double ymin, int coord){
-    return (coord-ymin)/(ymax - ymin);
+BlockFunction chooseBlockFunction(){
+#ifdef HAVE_AVX2_KERNEL
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && !getenv("A1_NO_SIMD") && width * height <= MAX_AVX2_PIXELS){
+        return rasterBlockAVX2;
+    }
+#endif
+    return rasterBlockScalar;
 }
 
-
-void interpolateVertical(vector<float>& posBuf){
-    //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false,posBuf[i+1]);
-        
-        double px1 = calcCoord(true, false,posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
-        
-        double px2 = calcCoord(true, false,posBuf[i+6]);
-        double py2 = calcCoord(false, false,posBuf[i+7]);
-        
-        //draw a bounding box around triangle
-        double xpoint0 = min(px0, min(px1, px2));
-        double ypoint0 = min(py0, min(py1, py2));
-        
-        double xpoint1 = max(px0, max(px1, px2));
-        double ypoint1 = max(py0, max(py1, py2));
-        
-        for(int x = floor(xpoint0); x < ceil(xpoint1); x++){
-            for(int y = floor(ypoint0); y < ceil(ypoint1); y++){
-                if(inTriangle(x, y, px0, py0, px1, py1, px2, py2)){
-                    double red = calcPercentHeight(calcCoord(false, false, ymax), calcCoord(false, false, ymin), y);
-                    output->setPixel(x, y, 255*red, 0, 255*(1-red));
-                }
-            }
-        }
+int rasterThreads(){
+    const char* threads = getenv("A1_THREADS");
+    if(threads && atoi(threads) > 0){
+        return atoi(threads);
     }
+    return max(1, (int)thread::hardware_concurrency());
 }
 
+void parallelRanges(int count, const function<void(int, int, int)>& fn){
+    int threads = rasterThreads();
+    int chunk = (count + threads - 1) / threads;
+    vector<thread> workers;
+    for(int t = 1; t < threads; t++){
+        workers.emplace_back(fn, t, min(count, t * chunk), min(count, (t + 1) * chunk));
+    }
+    fn(0, 0, min(count, chunk));
+    for(thread& worker : workers){
+        worker.join();
+    }
+}
 
-void interpolateDepth(vector<float>& posBuf, vector<std::vector<double>>& zbuff){
-    //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false,posBuf[i+1]);
-        double pz0 = calcCoord(false, true, posBuf[i+2]);
-        
-        double px1 = calcCoord(true, false,posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
-        double pz1 = calcCoord(false, true, posBuf[i+5]);
-        
-        double px2 = calcCoord(true, false,posBuf[i+6]);
-        double py2 = calcCoord(false, false,posBuf[i+7]);
-        double pz2 = calcCoord(false, true, posBuf[i+8]);
-        
-        //draw a bounding box around triangle
-        double xpoint0 = min(px0, min(px1, px2));
-        double ypoint0 = min(py0, min(py1, py2));
-        
-        double xpoint1 = max(px0, max(px1, px2));
-        double ypoint1 = max(py0, max(py1, py2));
-        
-        for(int x = floor(xpoint0); x < ceil(xpoint1); x++){
-            for(int y = floor(ypoint0); y < ceil(ypoint1); y++){
-                if(inTriangle(x, y, px0, py0, px1, py1, px2, py2)){
-                    double aVal;
-                    double bVal;
-                    double cVal;
-                    
-                    calcABC(x, y, px0, py0, px1, py1, px2, py2, aVal, bVal, cVal);
-                    double zval = aVal*pz0 + bVal*pz1 + cVal*pz2;
-                    if(zval > zbuff[x][y]){
-                        zbuff[x][y] = zval;
+template<typename Shade>
+void rasterizeTiled(vector<ShadedVertex>& vertBuf, vector<int>& indBuf, DepthBuffer* zbuff, const Shade& shade){
+    int numTriangles = indBuf.size() / 3;
+    int tilesX = ((int)width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = ((int)height + TILE_SIZE - 1) / TILE_SIZE;
+    int numTiles = tilesX * tilesY;
+    
+    // clip, set up and bin the triangles, each thread into its own list
+    // and bins so that joining them in thread order keeps the triangles in
+    // indBuf order
+    vector<vector<BinnedTriangle>> threadTriangles(rasterThreads());
+    vector<vector<vector<int>>> threadBins(rasterThreads(), vector<vector<int>>(numTiles));
+    parallelRanges(numTriangles, [&](int t, int begin, int end){
+        auto add = [&](BinnedTriangle& binned, const double px[3], const double py[3]){
+            if(!setupTriangle(px[0], py[0], px[1], py[1], px[2], py[2], pipeline.cull, binned.tri)){
+                return;
+            }
+            int index = threadTriangles[t].size();
+            threadTriangles[t].push_back(binned);
+            for(int ty = binned.tri.ymin / TILE_SIZE; ty <= binned.tri.ymax / TILE_SIZE; ty++){
+                for(int tx = binned.tri.xmin / TILE_SIZE; tx <= binned.tri.xmax / TILE_SIZE; tx++){
+                    threadBins[t][ty * tilesX + tx].push_back(index);
+                }
+            }
+        };
+        for(int j = begin; j < end; j++){
+            const ShadedVertex* v[3] = {&vertBuf[indBuf[3 * j]], &vertBuf[indBuf[3 * j + 1]], &vertBuf[indBuf[3 * j + 2]]};
+            BinnedTriangle binned;
+            binned.source = j;
+            
+            // most triangles are inside every plane and already on screen
+            if((v[0]->outside | v[1]->outside | v[2]->outside) == 0){
+                double px[3];
+                double py[3];
+                for(int e = 0; e < 3; e++){
+                    px[e] = v[e]->window[0];
+                    py[e] = v[e]->window[1];
+                    binned.pz[e] = v[e]->window[2];
+                    binned.invW[e] = 1 / v[e]->position.w;
+                }
+                binned.perspective = v[0]->position.w != v[1]->position.w || v[1]->position.w != v[2]->position.w;
+                binned.cut = false;
+                add(binned, px, py);
+                continue;
+            }
+            
+            // the rest are clipped and drawn as a fan
+            ClipVertex corners[9];
+            int count = clipTriangle(v, corners);
+            for(int k = 1; k + 1 < count; k++){
+                const ClipVertex* fan[3] = {&corners[0], &corners[k], &corners[k + 1]};
+                double px[3];
+                double py[3];
+                for(int e = 0; e < 3; e++){
+                    toWindow(fan[e]->position, px[e], py[e], binned.pz[e]);
+                    binned.invW[e] = 1 / fan[e]->position.w;
+                    for(int f = 0; f < 3; f++){
+                        binned.weight[e][f] = fan[e]->weight[f];
                     }
                 }
+                binned.perspective = fan[0]->position.w != fan[1]->position.w || fan[1]->position.w != fan[2]->position.w;
+                binned.cut = true;
+                add(binned, px, py);
             }
         }
-    }
+    });
     
-    //color based on depth now
-    double calczmin = calcCoord(false, true, zmin);
-    double calczmax = calcCoord(false, true, zmax);
-    for(int x = 0; x < width; x++){
-        for(int y = 0; y < height; y++){
-            if(zbuff[x][y] > -1){
-                double red = (zbuff[x][y] - calczmin)/(calczmax - calczmin);
-                output->setPixel(x, y, 255*red, 0, 0);
+    // threads take the tiles in turn
+    atomic<int> nextTile(0);
+    parallelRanges(rasterThreads(), [&](int, int, int){
+        PixelBlock block;
+        // Depth bounds of the tile, built up as it fills: the lowest and
+        // highest depth of every 8 pixel row span (the pixels one
+        // rasterBlock call covers), and the lowest depth of every 8x8
+        // block of spans. Depths only grow, so a stale block bound is
+        // still a safe one and blocks are only refreshed when a triangle
+        // asks for them.
+        const int spansPerRow = TILE_SIZE / 8;
+        double spanLo[TILE_SIZE * spansPerRow];
+        double spanHi[TILE_SIZE * spansPerRow];
+        double blockLo[(TILE_SIZE / 8) * spansPerRow];
+        bool blockStale[(TILE_SIZE / 8) * spansPerRow];
+        for(int tile = nextTile++; tile < numTiles; tile = nextTile++){
+            int tileX0 = (tile % tilesX) * TILE_SIZE;
+            int tileY0 = (tile / tilesX) * TILE_SIZE;
+            int tileX1 = min(tileX0 + TILE_SIZE, (int)width) - 1;
+            int tileY1 = min(tileY0 + TILE_SIZE, (int)height) - 1;
+            
+            // bounds of the span starting at (x0, y) from zbuff
+            auto updateSpan = [&](int x0, int y){
+                int s = (y - tileY0) * spansPerRow + (x0 - tileX0) / 8;
+                const float* depth = zbuff->getRow(y) + x0;
+                int count = min(8, tileX1 - x0 + 1);
+                spanLo[s] = spanHi[s] = depth[0];
+                for(int k = 1; k < count; k++){
+                    spanLo[s] = min(spanLo[s], (double)depth[k]);
+                    spanHi[s] = max(spanHi[s], (double)depth[k]);
+                }
+                blockStale[((y - tileY0) / 8) * spansPerRow + (x0 - tileX0) / 8] = true;
+            };
+            // nothing is known until a span is drawn into
+            for(int s = 0; s < TILE_SIZE * spansPerRow; s++){
+                spanLo[s] = -INFINITY;
+                spanHi[s] = INFINITY;
             }
-        }
-    }
-}
-
-void colorNormal(vector<float>& posBuf, vector<float>& norBuf, vector<std::vector<double>>& zbuff){
-    //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        double r0 = 255 * (0.5 * norBuf[i] + 0.5);
-        double r1 = 255 * (0.5 * norBuf[i+3] + 0.5);
-        double r2 = 255 * (0.5 * norBuf[i+6] + 0.5);
-        
-        double g0 = 255 * (0.5 * norBuf[i+1] + 0.5);
-        double g1 = 255 * (0.5 * norBuf[i+4] + 0.5);
-        double g2 = 255 * (0.5 * norBuf[i+7] + 0.5);
-        
-        double b0 = 255 * (0.5 * norBuf[i+2] + 0.5);
-        double b1 = 255 * (0.5 * norBuf[i+5] + 0.5);
-        double b2 = 255 * (0.5 * norBuf[i+8] + 0.5);
-        
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false,posBuf[i+1]);
-        double pz0 = calcCoord(false, true, posBuf[i+2]);
-        
-        double px1 = calcCoord(true, false,posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
-        double pz1 = calcCoord(false, true, posBuf[i+5]);
-        
-        double px2 = calcCoord(true, false,posBuf[i+6]);
-        double py2 = calcCoord(false, false,posBuf[i+7]);
-        double pz2 = calcCoord(false, true, posBuf[i+8]);
-        
-        //draw a bounding box around triangle
-        double xpoint0 = min(px0, min(px1, px2));
-        double ypoint0 = min(py0, min(py1, py2));
-        
-        double xpoint1 = max(px0, max(px1, px2));
-        double ypoint1 = max(py0, max(py1, py2));
-        
-        for(int x = floor(xpoint0); x < ceil(xpoint1); x++){
-            for(int y = floor(ypoint0); y < ceil(ypoint1); y++){
-                if(inTriangle(x, y, px0, py0, px1, py1, px2, py2)){
-                    double aVal;
-                    double bVal;
-                    double cVal;
+            for(int b = 0; b < (TILE_SIZE / 8) * spansPerRow; b++){
+                blockLo[b] = -INFINITY;
+                blockStale[b] = false;
+            }
+            
+            for(int t = 0; t < (int)threadBins.size(); t++){
+                for(int j : threadBins[t][tile]){
+                    const BinnedTriangle& binned = threadTriangles[t][j];
+                    const TriangleSetup& tri = binned.tri;
+                    const double* pz = binned.pz;
+                    
+                    // the part of the bounding box in this tile, starting
+                    // on a span
+                    int xbegin = tileX0 + (max(tri.xmin, tileX0) - tileX0) / 8 * 8;
+                    int xend = min(tri.xmax, tileX1);
+                    int ybegin = max(tri.ymin, tileY0);
+                    int yend = min(tri.ymax, tileY1);
+                    
+                    // Every depth of the triangle lies between its lowest
+                    // and highest corner, give or take rounding in the
+                    // barycentrics
+                    double slack = 1e-9 * (fabs(pz[0]) + fabs(pz[1]) + fabs(pz[2]) + 1);
+                    double triLo = min(pz[0], min(pz[1], pz[2])) - slack;
+                    double triHi = max(pz[0], max(pz[1], pz[2])) + slack;
+                    if(zbuff){
+                        // skip the triangle if it is behind everything
+                        // drawn in the blocks it covers
+                        double coveredLo = INFINITY;
+                        for(int by = (ybegin - tileY0) / 8; by <= (yend - tileY0) / 8; by++){
+                            for(int bx = (xbegin - tileX0) / 8; bx <= (xend - tileX0) / 8; bx++){
+                                int b = by * spansPerRow + bx;
+                                if(blockStale[b]){
+                                    blockLo[b] = INFINITY;
+                                    for(int ly = by * 8; ly < min(by * 8 + 8, tileY1 - tileY0 + 1); ly++){
+                                        blockLo[b] = min(blockLo[b], spanLo[ly * spansPerRow + bx]);
+                                    }
+                                    blockStale[b] = false;
+                                }
+                                coveredLo = min(coveredLo, blockLo[b]);
+                            }
+                        }
+                        if(triHi <= coveredLo){
+                            continue;
+                        }
+                    }
+                    
+                    // micro triangles only test the pixels setup found
+                    // inside, the same way rasterBlock does
+                    if(tri.micro){
+                        for(int k = 0; k < MICRO_SIZE * MICRO_SIZE; k++){
+                            int dx = k % MICRO_SIZE;
+                            int dy = k / MICRO_SIZE;
+                            int x = tri.xmin + dx;
+                            int y = tri.ymin + dy;
+                            if(!(tri.micro & (1 << k)) || x < tileX0 || x > tileX1 || y < tileY0 || y > tileY1){
+                                continue;
+                            }
+                            double a, b, c;
+                            tri.barycentrics(tri.w[0] + dx * tri.a[0] + dy * tri.b[0], tri.w[1] + dx * tri.a[1] + dy * tri.b[1], tri.w[2] + dx * tri.a[2] + dy * tri.b[2], a, b, c);
+                            if(zbuff){
+                                double z = a*pz[0] + b*pz[1] + c*pz[2];
+                                float* depth = zbuff->getRow(y) + x;
+                                if(!(z > *depth)){
+                                    continue;
+                                }
+                                *depth = z;
+                                updateSpan(tileX0 + (x - tileX0) / 8 * 8, y);
+                            }
+                            binned.sourceBarycentrics(a, b, c);
+                            shade(binned.source, x, y, a, b, c, output->getRow(y) + 3 * x);
+                        }
+                        continue;
+                    }
                     
-                    calcABC(x, y, px0, py0, px1, py1, px2, py2, aVal, bVal, cVal);
-                    double zval = aVal*pz0 + bVal*pz1 + cVal*pz2;
-                    if(zval > zbuff[x][y]){
-                        zbuff[x][y] = zval;
-                        output->setPixel(x, y, r0*aVal+r1*bVal+r2*cVal, g0*aVal+g1*bVal+g2*cVal, b0*aVal+b1*bVal+b2*cVal);
+                    int64_t row[3];
+                    for(int e = 0; e < 3; e++){
+                        row[e] = tri.w[e] + (xbegin - tri.xmin) * tri.a[e] + (ybegin - tri.ymin) * tri.b[e];
+                    }
+                    for(int y = ybegin; y <= yend; y++){
+                        int64_t w[3] = {row[0], row[1], row[2]};
+                        float* depthRow = zbuff ? zbuff->getRow(y) : nullptr;
+                        unsigned char* pixelRow = output->getRow(y);
+                        for(int x0 = xbegin; x0 <= xend; x0 += 8){
+                            if(zbuff){
+                                int s = (y - tileY0) * spansPerRow + (x0 - tileX0) / 8;
+                                // behind the whole span, or in front of
+                                // all of it so there is no need to test
+                                if(triHi <= spanLo[s]){
+                                    block.mask = 0;
+                                }else{
+                                    rasterBlock(tri, w, min(8, xend - x0 + 1), pz, triLo > spanHi[s] ? nullptr : depthRow + x0, block);
+                                }
+                            }else{
+                                rasterBlock(tri, w, min(8, xend - x0 + 1), pz, nullptr, block);
+                            }
+                            for(int k = 0; k < 8; k++){
+                                if(block.mask & (1 << k)){
+                                    int x = x0 + k;
+                                    if(zbuff){
+                                        depthRow[x] = block.z[k];
+                                    }
+                                    double a = block.a[k];
+                                    double b = block.b[k];
+                                    double c = block.c[k];
+                                    binned.sourceBarycentrics(a, b, c);
+                                    shade(binned.source, x, y, a, b, c, pixelRow + 3 * x);
+                                }
+                            }
+                            if(zbuff && block.mask){
+                                updateSpan(x0, y);
+                            }
+                            w[0] += 8 * tri.a[0];
+                            w[1] += 8 * tri.a[1];
+                            w[2] += 8 * tri.a[2];
+                        }
+                        row[0] += tri.b[0];
+                        row[1] += tri.b[1];
+                        row[2] += tri.b[2];
                     }
                 }
             }
         }
-    }
+    });
 }
 
-void basicLighting(vector<float>& posBuf, vector<float>& norBuf, vector<std::vector<double>>& zbuff){
-    //each iteration represents one triangle
-    for(int i = 0; i <= posBuf.size() - 9; i+=9){
-        double c0 = (1/sqrt(3))*norBuf[i] + (1/sqrt(3))*norBuf[i+1] + (1/sqrt(3))*norBuf[i+2];
-        double c1 = (1/sqrt(3))*norBuf[i+3] + (1/sqrt(3))*norBuf[i+4] + (1/sqrt(3))*norBuf[i+5];
-        double c2 = (1/sqrt(3))*norBuf[i+6] + (1/sqrt(3))*norBuf[i+7] + (1/sqrt(3))*norBuf[i+8];
-        // get all the triangle points
-        double px0 = calcCoord(true, false, posBuf[i]);
-        double py0 = calcCoord(false, false,posBuf[i+1]);
-        double pz0 = calcCoord(false, true, posBuf[i+2]);
-        
-        double px1 = calcCoord(true, false,posBuf[i+3]);
-        double py1 = calcCoord(false, false, posBuf[i+4]);
-        double pz1 = calcCoord(false, true, posBuf[i+5]);
-        
-        double px2 = calcCoord(true, false,posBuf[i+6]);
-        double py2 = calcCoord(false, false,posBuf[i+7]);
-        double pz2 = calcCoord(false, true, posBuf[i+8]);
-        
-        //draw a bounding box around triangle
-        double xpoint0 = min(px0, min(px1, px2));
-        double ypoint0 = min(py0, min(py1, py2));
-        
-        double xpoint1 = max(px0, max(px1, px2));
-        double ypoint1 = max(py0, max(py1, py2));
-        
-        for(int x = floor(xpoint0); x < ceil(xpoint1); x++){
-            for(int y = floor(ypoint0); y < ceil(ypoint1); y++){
-                if(inTriangle(x, y, px0, py0, px1, py1, px2, py2)){
-                    double aVal;
-                    double bVal;
-                    double cVal;
-                    
-                    calcABC(x, y, px0, py0, px1, py1, px2, py2, aVal, bVal, cVal);
-                    double zval = aVal*pz0 + bVal*pz1 + cVal*pz2;
-                    if(zval > zbuff[x][y]){
-                        zbuff[x][y] = zval;
-                        double interpolatedLight = max(c0*aVal+c1*bVal+c2*cVal,0.0);
-                        output->setPixel(x, y, 255 * interpolatedLight, 255 * interpolatedLight, 255 * interpolatedLight);
+template<typename Shade>
+void shadeVisible(vector<ShadedVertex>& vertBuf, vector<int>& indBuf, VisibilityBuffer& ids, const Shade& shade){
+    parallelRanges(height, [&](int thread, int begin, int end){
+        for(int y = begin; y < end; y++){
+            const uint32_t* idRow = ids.getRow(y);
+            unsigned char* pixelRow = output->getRow(y);
+            // The setup of the triangle, the same for the row as long as
+            // the triangle is. A triangle inside every plane is set up just
+            // like rasterizeTiled does, so its barycentrics are the same.
+            uint32_t last = NO_TRIANGLE;
+            BinnedTriangle binned;
+            bool snapped = false;
+            // Clipped triangles were drawn in pieces. For those, corner k in
+            // pixel coordinates times w is e[k] = (x w, y w, w), and the
+            // barycentrics of pixel p are p . (e[1] x e[2]) and so on,
+            // scaled to sum to 1.
+            double edge[3][3] = {};
+            for(int x = 0; x < width; x++){
+                uint32_t t = idRow[x];
+                if(t == NO_TRIANGLE){
+                    continue;
+                }
+                if(t != last){
+                    const ShadedVertex* v[3] = {&vertBuf[indBuf[3 * t]], &vertBuf[indBuf[3 * t + 1]], &vertBuf[indBuf[3 * t + 2]]};
+                    snapped = (v[0]->outside | v[1]->outside | v[2]->outside) == 0 &&
+                              setupTriangle(v[0]->window[0], v[0]->window[1], v[1]->window[0], v[1]->window[1], v[2]->window[0], v[2]->window[1], pipeline.cull, binned.tri);
+                    if(snapped){
+                        for(int k = 0; k < 3; k++){
+                            binned.invW[k] = 1 / v[k]->position.w;
+                        }
+                        binned.perspective = v[0]->position.w != v[1]->position.w || v[1]->position.w != v[2]->position.w;
+                        binned.cut = false;
+                    }else{
+                        double e[3][3];
+                        for(int k = 0; k < 3; k++){
+                            const Vector4& clip = v[k]->position;
+                            e[k][0] = (clip.x + clip.w) * width / 2;
+                            e[k][1] = (clip.y + clip.w) * height / 2;
+                            e[k][2] = clip.w;
+                        }
+                        for(int k = 0; k < 3; k++){
+                            const double* u = e[(k + 1) % 3];
+                            const double* v = e[(k + 2) % 3];
+                            edge[k][0] = u[1] * v[2] - u[2] * v[1];
+                            edge[k][1] = u[2] * v[0] - u[0] * v[2];
+                            edge[k][2] = u[0] * v[1] - u[1] * v[0];
+                        }
+                    }
+                    last = t;
+                }
+                double bary[3];
+                if(snapped){
+                    const TriangleSetup& tri = binned.tri;
+                    int64_t w[3];
+                    for(int k = 0; k < 3; k++){
+                        w[k] = tri.w[k] + (x - tri.xmin) * tri.a[k] + (y - tri.ymin) * tri.b[k];
+                    }
+                    tri.barycentrics(w[0], w[1], w[2], bary[0], bary[1], bary[2]);
+                    binned.sourceBarycentrics(bary[0], bary[1], bary[2]);
+                }else{
+                    // A pixel on a border can be just outside the unsnapped
+                    // triangle, so clamp to it to keep the shaders between
+                    // the values at the corners
+                    double sum = 0;
+                    for(int k = 0; k < 3; k++){
+                        bary[k] = edge[k][0] * x + edge[k][1] * y + edge[k][2];
+                        sum += bary[k];
+                    }
+                    double clamped = 0;
+                    for(int k = 0; k < 3; k++){
+                        bary[k] = min(max(bary[k] / sum, 0.0), 1.0);
+                        clamped += bary[k];
+                    }
+                    for(int k = 0; k < 3; k++){
+                        bary[k] /= clamped;
                     }
                 }
+                shade(t, x, y, bary[0], bary[1], bary[2], pixelRow + 3 * x);
             }
         }
+    });
+}
+
+template<typename Shade>
+void drawMesh(vector<ShadedVertex>& vertBuf, vector<int>& indBuf, DepthBuffer* zbuff, const Shade& shade){
+    if(!visibilityShading){
+        rasterizeTiled(vertBuf, indBuf, zbuff, shade);
+        return;
     }
+    VisibilityBuffer ids(width, height, NO_TRIANGLE);
+    rasterizeTiled(vertBuf, indBuf, zbuff, VisibilityShader{ids});
+    shadeVisible(vertBuf, indBuf, ids, shade);
+}
+
+double calcPercentHeight(double ymax, double ymin, int coord){
+    return (coord-ymin)/(ymax - ymin);
 }
 
-void rotateYAxis(double angle, double& x, double& y, double& z){
-    double newX;
-    double newZ;
-    newX = cos(angle)*x + sin(angle)*z;
-    newZ = -1*sin(angle)*x + cos(angle)*z;
-    x = newX;
-    z = newZ;
+void colorDepth(vector<ShadedVertex>& vertBuf, DepthBuffer& zbuff){
+    double lo[3];
+    double hi[3];
+    windowBounds(vertBuf, lo, hi);
+    double calczmin = lo[2];
+    double calczmax = hi[2];
+    for(int y = 0; y < height; y++){
+        const float* depthRow = zbuff.getRow(y);
+        unsigned char* pixelRow = output->getRow(y);
+        for(int x = 0; x < width; x++){
+            if(depthRow[x] > -1){
+                double red = (depthRow[x] - calczmin)/(calczmax - calczmin);
+                setColor(pixelRow + 3 * x, 255*red, 0, 0);
+            }
+        }
+    }
 }
@@ -0,0 +1,64 @@
+#include "AliasTable.h"
+
+#include <algorithm>
+
+using namespace std;
+
+bool AliasTable::build(const vector<float> &weights)
+{
+	bins.clear();
+	pmfs.clear();
+	double sum = 0.0;
+	for(float w : weights) {
+		sum += max(w, 0.0f);
+	}
+	if(!(sum > 0.0)) {
+		return false;
+	}
+
+	// Vose's construction: scale the probabilities so that the average bin
+	// is 1, then let each bin under 1 borrow the rest from one over 1
+	int n = (int)weights.size();
+	bins.resize(n);
+	pmfs.resize(n);
+	vector<double> scaled(n);
+	vector<int> small, large;
+	for(int i = 0; i < n; i++) {
+		pmfs[i] = (float)(max(weights[i], 0.0f) / sum);
+		scaled[i] = max(weights[i], 0.0f) / sum * n;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+	while(!small.empty() && !large.empty()) {
+		int s = small.back();
+		int l = large.back();
+		small.pop_back();
+		large.pop_back();
+		bins[s].keep = (float)scaled[s];
+		bins[s].alias = l;
+		scaled[l] -= 1.0 - scaled[s];
+		(scaled[l] < 1.0 ? small : large).push_back(l);
+	}
+	// Whatever is left is 1 up to rounding
+	for(int i : large) {
+		bins[i].keep = 1.0f;
+		bins[i].alias = i;
+	}
+	for(int i : small) {
+		bins[i].keep = 1.0f;
+		bins[i].alias = i;
+	}
+	return true;
+}
+
+int AliasTable::sample(float u, float v, float &remapped) const
+{
+	int n = (int)bins.size();
+	int i = min((int)(u * n), n - 1);
+	const Bin &bin = bins[i];
+	if(v < bin.keep) {
+		remapped = v / bin.keep;
+		return i;
+	}
+	remapped = min((v - bin.keep) / (1.0f - bin.keep), 0.99999994f);
+	return bin.alias;
+}
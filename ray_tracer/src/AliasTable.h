@@ -0,0 +1,40 @@
+#pragma once
+#ifndef ALIASTABLE_H
+#define ALIASTABLE_H
+
+#include <vector>
+
+// Walker's alias method: after an O(n) build, picks index i with
+// probability weights[i] / sum(weights) in constant time. Each bin holds
+// the probability of keeping its own index and the index it hands the rest
+// of its share to.
+class AliasTable
+{
+public:
+	// Returns false (and leaves the table empty) if no weight is positive
+	bool build(const std::vector<float> &weights);
+
+	// u and v are uniform in [0, 1). u picks the bin and v chooses between
+	// the bin and its alias. Taking the choice from its own number keeps
+	// stratified u and v stratified across bins; the fraction of u would
+	// be the same for every stratum of a regular pattern. The unused part
+	// of v is returned in remapped, again uniform in [0, 1), so callers
+	// can use it to place the sample within the picked bin.
+	int sample(float u, float v, float &remapped) const;
+
+	// Probability of picking index i
+	float pmf(int i) const { return pmfs[i]; }
+	bool empty() const { return bins.empty(); }
+	int size() const { return (int)bins.size(); }
+
+private:
+	struct Bin
+	{
+		float keep;
+		int alias;
+	};
+	std::vector<Bin> bins;
+	std::vector<float> pmfs;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+static const int NUM_BINS = 16;
+static const int MAX_LEAF_SIZE = 4;
+
+AABB AABB::transform(const glm::mat4 &M) const
+{
+	AABB box;
+	for(int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+		box.grow(glm::vec3(M * glm::vec4(corner, 1.0f)));
+	}
+	return box;
+}
+
+void BVH::build(const vector<AABB> &boxes)
+{
+	nodes.clear();
+	indices.resize(boxes.size());
+	iota(indices.begin(), indices.end(), 0);
+	if(boxes.empty()) {
+		return;
+	}
+
+	vector<glm::vec3> centroids(boxes.size());
+	for(size_t i = 0; i < boxes.size(); i++) {
+		centroids[i] = boxes[i].centroid();
+	}
+
+	nodes.reserve(2 * boxes.size());
+	nodes.push_back(Node());
+	subdivide(0, 0, (int)boxes.size(), 0, boxes, centroids);
+}
+
+void BVH::subdivide(int node, int first, int count, int depth,
+                    const vector<AABB> &boxes, const vector<glm::vec3> &centroids)
+{
+	AABB box;
+	AABB centroidBox;
+	for(int i = first; i < first + count; i++) {
+		box.grow(boxes[indices[i]]);
+		centroidBox.grow(centroids[indices[i]]);
+	}
+	nodes[node].box = box;
+	nodes[node].first = first;
+	nodes[node].count = count;
+	if(count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH) {
+		return;
+	}
+
+	// Split along the axis with the largest centroid extent
+	glm::vec3 extent = centroidBox.max - centroidBox.min;
+	int axis = 0;
+	if(extent.y > extent[axis]) axis = 1;
+	if(extent.z > extent[axis]) axis = 2;
+
+	int mid = first;
+	if(extent[axis] > 0.0f) {
+		// Bin the centroids and pick the plane with the lowest SAH cost
+		AABB binBoxes[NUM_BINS];
+		int binCounts[NUM_BINS] = {0};
+		float scale = NUM_BINS / extent[axis];
+		auto binOf = [&](int prim) {
+			int b = (int)((centroids[prim][axis] - centroidBox.min[axis]) * scale);
+			return std::min(b, NUM_BINS - 1);
+		};
+		for(int i = first; i < first + count; i++) {
+			int b = binOf(indices[i]);
+			binCounts[b]++;
+			binBoxes[b].grow(boxes[indices[i]]);
+		}
+
+		float rightCost[NUM_BINS];
+		AABB acc;
+		int n = 0;
+		for(int b = NUM_BINS - 1; b > 0; b--) {
+			acc.grow(binBoxes[b]);
+			n += binCounts[b];
+			rightCost[b] = n > 0 ? n * acc.area() : 0.0f;
+		}
+
+		float bestCost = FLT_MAX;
+		int bestBin = -1;
+		acc = AABB();
+		n = 0;
+		for(int b = 0; b < NUM_BINS - 1; b++) {
+			acc.grow(binBoxes[b]);
+			n += binCounts[b];
+			if(n == 0 || n == count) {
+				continue;
+			}
+			float cost = n * acc.area() + rightCost[b + 1];
+			if(cost < bestCost) {
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		if(bestBin >= 0) {
+			int *split = partition(&indices[first], &indices[first] + count, [&](int prim) { return binOf(prim) <= bestBin; });
+			mid = (int)(split - &indices[0]);
+		}
+	}
+
+	// All centroids in one bin: fall back to splitting the list in half
+	if(mid == first || mid == first + count) {
+		mid = first + count / 2;
+		nth_element(&indices[first], &indices[mid], &indices[first] + count,
+		            [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+	}
+
+	int left = (int)nodes.size();
+	nodes.push_back(Node());
+	subdivide(left, first, mid - first, depth + 1, boxes, centroids);
+	int right = (int)nodes.size();
+	nodes.push_back(Node());
+	subdivide(right, mid, first + count - mid, depth + 1, boxes, centroids);
+
+	nodes[node].first = right;
+	nodes[node].count = 0;
+}
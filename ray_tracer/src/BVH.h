@@ -0,0 +1,152 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Stats.h"
+
+struct AABB
+{
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	void grow(const glm::vec3 &p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const AABB &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	glm::vec3 centroid() const { return 0.5f * (min + max); }
+	float area() const
+	{
+		glm::vec3 d = max - min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+	// Box around the eight transformed corners
+	AABB transform(const glm::mat4 &M) const;
+
+	// Slab test against [0, tmax]. Returns the entry distance in tnear.
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &invDir, float tmax, float &tnear) const
+	{
+		glm::vec3 t0 = (min - origin) * invDir;
+		glm::vec3 t1 = (max - origin) * invDir;
+		glm::vec3 tsmall = glm::min(t0, t1);
+		glm::vec3 tbig = glm::max(t0, t1);
+		tnear = std::max(std::max(tsmall.x, tsmall.y), std::max(tsmall.z, 0.0f));
+		float tfar = std::min(std::min(tbig.x, tbig.y), std::min(tbig.z, tmax));
+		return tnear <= tfar;
+	}
+};
+
+// Bounding volume hierarchy over a list of boxes, built with binned SAH.
+// Nodes are stored depth first, so the left child of node i is i + 1.
+class BVH
+{
+public:
+	struct Node
+	{
+		AABB box;
+		int first; // first index into indices (leaf) or right child (interior)
+		int count; // number of primitives, 0 for interior nodes
+	};
+
+	void build(const std::vector<AABB> &boxes);
+	bool empty() const { return nodes.empty(); }
+	const AABB &bounds() const { return nodes[0].box; }
+
+	// Calls visit(primitive, tmax) for the primitives in every leaf the ray
+	// enters before tmax, nearest child first. visit returns true on a hit
+	// after shrinking tmax to the hit distance. Setting tmax below zero ends
+	// the traversal, for rays that only need to know whether anything is
+	// hit.
+	template <typename F>
+	bool traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tmax, F visit) const;
+
+	std::vector<Node> nodes;
+	std::vector<int> indices;
+
+	static const int MAX_DEPTH = 60;
+
+private:
+	void subdivide(int node, int first, int count, int depth,
+	               const std::vector<AABB> &boxes, const std::vector<glm::vec3> &centroids);
+};
+
+template <typename F>
+bool BVH::traverse(const glm::vec3 &origin, const glm::vec3 &dir, float tmax, F visit) const
+{
+	if(nodes.empty()) {
+		return false;
+	}
+
+	// Avoid 0 * inf in the slab test for axis aligned rays
+	glm::vec3 invDir;
+	for(int i = 0; i < 3; i++) {
+		float d = std::abs(dir[i]) < 1e-12f ? std::copysign(1e-12f, dir[i]) : dir[i];
+		invDir[i] = 1.0f / d;
+	}
+
+	float tnear;
+	if(!nodes[0].box.intersect(origin, invDir, tmax, tnear)) {
+		return false;
+	}
+
+	struct Entry { int node; float tnear; };
+	Entry stack[MAX_DEPTH + 4];
+	int sp = 0;
+	int node = 0;
+	bool hit = false;
+	while(true) {
+		const Node &n = nodes[node];
+		stats::countNodeVisit();
+		if(n.count > 0) {
+			for(int i = 0; i < n.count; i++) {
+				if(visit(indices[n.first + i], tmax)) {
+					hit = true;
+					if(tmax < 0.0f) {
+						return true;
+					}
+				}
+			}
+		} else {
+			int left = node + 1;
+			int right = n.first;
+			float tleft, tright;
+			bool hitLeft = nodes[left].box.intersect(origin, invDir, tmax, tleft);
+			bool hitRight = nodes[right].box.intersect(origin, invDir, tmax, tright);
+			if(hitLeft && hitRight) {
+				if(tright < tleft) {
+					std::swap(left, right);
+					std::swap(tleft, tright);
+				}
+				stack[sp++] = {right, tright};
+				node = left;
+				continue;
+			} else if(hitLeft) {
+				node = left;
+				continue;
+			} else if(hitRight) {
+				node = right;
+				continue;
+			}
+		}
+
+		// Pop the next node that can still beat the closest hit
+		node = -1;
+		while(sp > 0) {
+			Entry e = stack[--sp];
+			if(e.tnear <= tmax) {
+				node = e.node;
+				break;
+			}
+		}
+		if(node < 0) {
+			break;
+		}
+	}
+	return hit;
+}
+
+#endif
@@ -9,34 +9,55 @@ using namespace std;
 Camera::Camera(int width, int height, float fov, float aspect, glm::vec3 position, glm::vec3 front, glm::vec3 up)
     : width(width), height(height), fov(glm::radians(fov)), aspect(aspect), position(position), front(glm::normalize(front)), up(glm::normalize(up))
 {
-}
+    // Orthonormal basis
+    right = glm::normalize(glm::cross(this->front, this->up));
+    this->up = glm::normalize(glm::cross(right, this->front));
 
-vector<glm::vec3> Camera::genRays(vector<glm::vec3>& rays)
-{
-    glm::vec3 right = glm::normalize(glm::cross(up, front));
-    up = glm::normalize(glm::cross(right, front));
+    float tanHalfFOV = tan(this->fov / 2.0f);
 
-    float tanHalfFOV = tan(fov / 2.0f);
-    
     /*                (Gives Dx since adj * Opp/adj) (scale with aspect) (Gets full width since have of FOV obly gets top half)  */
-    float fullWidth = tanHalfFOV * aspect * 2;
-    float fullHeight = tanHalfFOV * 2;
+    fullWidth = tanHalfFOV * aspect * 2;
+    fullHeight = tanHalfFOV * 2;
+}
 
+vector<glm::vec3> Camera::genRays(vector<glm::vec3>& rays)
+{
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            float dx = (fullWidth  *  (x * 2 + 1) / (width * 2) - fullWidth / 2);
-            float dy = (fullHeight *  (y * 2 + 1) / (height * 2) - fullHeight / 2);
-
-            glm::vec3 planeIntersection = dx * right + dy * up + front;
-            glm::vec3 rayDirection = glm::normalize(planeIntersection);
-            
-            rays.push_back(rayDirection);
+            rays.push_back(genRay(x, y));
         }
     }
 
     return rays;
 }
 
+glm::vec3 Camera::genRay(int x, int y) const
+{
+    float dx = (fullWidth  *  (x * 2 + 1) / (width * 2) - fullWidth / 2);
+    float dy = (fullHeight *  (y * 2 + 1) / (height * 2) - fullHeight / 2);
+
+    glm::vec3 planeIntersection = dx * right + dy * up + front;
+    return glm::normalize(planeIntersection);
+}
+
+void Camera::genRayDifferential(int x, int y, glm::vec3& dDdx, glm::vec3& dDdy) const
+{
+    glm::vec3 ray = genRay(x, y);
+    dDdx = genRay(x + 1, y) - ray;
+    dDdy = genRay(x, y + 1) - ray;
+}
+
+glm::vec2 Camera::project(const glm::vec3& p, float& depth) const
+{
+    // Inverse of genRay
+    glm::vec3 d = p - position;
+    depth = glm::dot(d, front);
+    float dx = glm::dot(d, right) / depth;
+    float dy = glm::dot(d, up) / depth;
+    return glm::vec2((dx + fullWidth / 2) * width / fullWidth - 0.5f,
+                     (dy + fullHeight / 2) * height / fullHeight - 0.5f);
+}
+
 void Camera::applyViewMatrix(shared_ptr<MatrixStack> MV)
 {
     MV->translate(-position);
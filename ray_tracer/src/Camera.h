@@ -11,8 +11,20 @@ public:
     Camera(int width, int height, float fov, float aspect, glm::vec3 position, glm::vec3 front, glm::vec3 up);
 
     std::vector<glm::vec3> genRays(std::vector<glm::vec3>& rays);
+    // Direction of the ray through the center of pixel (x, y)
+    glm::vec3 genRay(int x, int y) const;
+    // Change of genRay(x, y) to the next pixel in x and in y
+    void genRayDifferential(int x, int y, glm::vec3& dDdx, glm::vec3& dDdy) const;
+    // Image position of the world point p, with the center of pixel (x, y)
+    // at (x, y), and its distance in front of the camera along the view
+    // direction. Only meaningful for depth > 0.
+    glm::vec2 project(const glm::vec3& p, float& depth) const;
     void applyViewMatrix(std::shared_ptr<MatrixStack> MV);
 
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const glm::vec3 &getPosition() const { return position; }
+
 
 private:
     int width;
@@ -22,6 +34,11 @@ private:
     glm::vec3 position;
     glm::vec3 front;
     glm::vec3 up;
+    // Set once by the constructor: right, front and up are orthonormal, and
+    // the image plane one unit along front is fullWidth x fullHeight
+    glm::vec3 right;
+    float fullWidth;
+    float fullHeight;
 };
 
 #endif 
\ No newline at end of file
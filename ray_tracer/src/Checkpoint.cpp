@@ -0,0 +1,212 @@
+#include "Checkpoint.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+using namespace std;
+
+static const char MAGIC[4] = {'R', 'T', 'C', 'K'};
+static const uint32_t VERSION = 1;
+
+struct CheckpointHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t width;
+	int32_t height;
+	int32_t tileSize;
+	uint32_t padding;
+	uint64_t key;
+};
+
+Checkpoint::Checkpoint(const string &filename, int width, int height, int tileSize, uint64_t key, double interval) :
+	filename(filename),
+	width(width),
+	height(height),
+	tileSize(tileSize),
+	tilesX((width + tileSize - 1) / tileSize),
+	tilesY((height + tileSize - 1) / tileSize),
+	key(key),
+	interval(interval),
+	fp(nullptr),
+	failed(false),
+	lastWrite(chrono::steady_clock::now())
+{
+}
+
+Checkpoint::~Checkpoint()
+{
+	if(fp) {
+		fclose(fp);
+	}
+}
+
+uint64_t Checkpoint::makeKey(const string &settings)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for(unsigned char c : settings) {
+		hash = (hash ^ c) * 1099511628211ull;
+	}
+	return hash;
+}
+
+void Checkpoint::tileRect(int tile, int &cols, int &rows) const
+{
+	int x0 = (tile % tilesX) * tileSize;
+	int y0 = (tile / tilesX) * tileSize;
+	cols = min(tileSize, width - x0);
+	rows = min(tileSize, height - y0);
+}
+
+bool Checkpoint::load()
+{
+	loaded.clear();
+	FILE *in = fopen(filename.c_str(), "rb");
+	if(!in) {
+		return false;
+	}
+	CheckpointHeader header;
+	if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION) {
+		cerr << filename << " is not a checkpoint file" << endl;
+		fclose(in);
+		return false;
+	}
+	if(header.width != width || header.height != height || header.tileSize != tileSize || header.key != key) {
+		cerr << filename << " was written for a different scene or settings" << endl;
+		fclose(in);
+		return false;
+	}
+
+	// Read records until the end, keeping everything up to the last
+	// complete one
+	long valid = ftell(in);
+	int32_t tile;
+	while(fread(&tile, sizeof(tile), 1, in) == 1) {
+		if(tile < 0 || tile >= getTileCount()) {
+			break;
+		}
+		int cols, rows;
+		tileRect(tile, cols, rows);
+		vector<float> rgb(cols * rows * 3);
+		if(fread(rgb.data(), sizeof(float), rgb.size(), in) != rgb.size()) {
+			break;
+		}
+		loaded[tile] = move(rgb);
+		valid = ftell(in);
+	}
+	fclose(in);
+
+	// Drop a torn last record so new records follow the good ones
+	error_code ec;
+	filesystem::resize_file(filename, valid, ec);
+	if(ec) {
+		cerr << "Couldn't truncate " << filename << endl;
+		loaded.clear();
+		return false;
+	}
+	fp = fopen(filename.c_str(), "ab");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		loaded.clear();
+		return false;
+	}
+	return true;
+}
+
+bool Checkpoint::isDone(int tile) const
+{
+	return loaded.count(tile) > 0;
+}
+
+int Checkpoint::getDoneCount() const
+{
+	return (int)loaded.size();
+}
+
+void Checkpoint::getTile(int tile, float *rgb) const
+{
+	auto it = loaded.find(tile);
+	if(it == loaded.end()) {
+		return;
+	}
+	int cols, rows;
+	tileRect(tile, cols, rows);
+	for(int y = 0; y < rows; y++) {
+		memcpy(&rgb[y * tileSize * 3], &it->second[y * cols * 3], cols * 3 * sizeof(float));
+	}
+}
+
+void Checkpoint::record(int tile, const float *rgb)
+{
+	int cols, rows;
+	tileRect(tile, cols, rows);
+	vector<float> packed(cols * rows * 3);
+	for(int y = 0; y < rows; y++) {
+		memcpy(&packed[y * cols * 3], &rgb[y * tileSize * 3], cols * 3 * sizeof(float));
+	}
+
+	lock_guard<mutex> lock(pendingMutex);
+	pending.emplace_back(tile, move(packed));
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - lastWrite;
+	if(elapsed.count() >= interval) {
+		writePending();
+	}
+}
+
+bool Checkpoint::flush()
+{
+	lock_guard<mutex> lock(pendingMutex);
+	return writePending();
+}
+
+bool Checkpoint::writePending()
+{
+	lastWrite = chrono::steady_clock::now();
+	if(pending.empty() || failed) {
+		return !failed;
+	}
+	if(!fp) {
+		// First write of a new render
+		fp = fopen(filename.c_str(), "wb");
+		CheckpointHeader header = {};
+		memcpy(header.magic, MAGIC, 4);
+		header.version = VERSION;
+		header.width = width;
+		header.height = height;
+		header.tileSize = tileSize;
+		header.key = key;
+		if(!fp || fwrite(&header, sizeof(header), 1, fp) != 1) {
+			cerr << "Couldn't write to " << filename << endl;
+			failed = true;
+			return false;
+		}
+	}
+	for(const auto &record : pending) {
+		int32_t tile = record.first;
+		if(fwrite(&tile, sizeof(tile), 1, fp) != 1 ||
+		   fwrite(record.second.data(), sizeof(float), record.second.size(), fp) != record.second.size()) {
+			failed = true;
+		}
+	}
+	if(fflush(fp) != 0) {
+		failed = true;
+	}
+	if(failed) {
+		cerr << "Couldn't write to " << filename << endl;
+	}
+	pending.clear();
+	return !failed;
+}
+
+void Checkpoint::remove()
+{
+	lock_guard<mutex> lock(pendingMutex);
+	pending.clear();
+	if(fp) {
+		fclose(fp);
+		fp = nullptr;
+	}
+	std::remove(filename.c_str());
+}
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Log of the finished tiles of a render, so that a render that is killed
+// or preempted can continue where it stopped instead of starting over.
+//
+// The file is a small header (image and tile size plus a key identifying
+// the scene and settings) followed by one record per finished tile: the
+// tile index and its RGB floats. Tiles are buffered in memory and appended
+// at most every `interval` seconds, so short renders never touch the disk.
+// Tiles are numbered row by row in the order the rows appear in the image
+// file, and tile (0, 0) is the full sized one.
+class Checkpoint
+{
+public:
+	Checkpoint(const std::string &filename, int width, int height, int tileSize, uint64_t key, double interval);
+	virtual ~Checkpoint();
+
+	// Reads the tiles of an earlier run. Returns false if there is no file
+	// or it belongs to a different render. A partly written last record is
+	// dropped.
+	bool load();
+
+	bool isDone(int tile) const;
+	int getDoneCount() const;
+	int getTileCount() const { return tilesX * tilesY; }
+	// Copies a loaded tile into rgb, tileSize pixels per row
+	void getTile(int tile, float *rgb) const;
+	// Stores a finished tile given with tileSize pixels per row and writes
+	// the pending tiles if the interval has passed. Thread safe.
+	void record(int tile, const float *rgb);
+	// Writes all pending tiles now
+	bool flush();
+	// Deletes the file once the render is complete
+	void remove();
+
+	// Hash of the settings that must match for a checkpoint to be reused
+	static uint64_t makeKey(const std::string &settings);
+
+private:
+	void tileRect(int tile, int &cols, int &rows) const;
+	bool writePending();
+
+	std::string filename;
+	int width;
+	int height;
+	int tileSize;
+	int tilesX;
+	int tilesY;
+	uint64_t key;
+	double interval;
+
+	std::map<int, std::vector<float> > loaded;
+	std::vector<std::pair<int, std::vector<float> > > pending;
+	FILE *fp;
+	bool failed;
+	std::chrono::steady_clock::time_point lastWrite;
+	std::mutex pendingMutex;
+};
+
+#endif
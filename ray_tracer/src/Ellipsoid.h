@@ -90,6 +90,23 @@ public:
 
     Material getColor() override { return color; }
 
+    bool getBounds(AABB& box) override {
+        AABB unit;
+        unit.min = glm::vec3(-1.0f);
+        unit.max = glm::vec3(1.0f);
+        box = unit.transform(modelMatrix);
+        return true;
+    }
+
+    // The unit sphere's coordinates, stretched with the ellipsoid
+    bool getUV(const Hit& hit, glm::vec2& uv, glm::vec3& dpdu, glm::vec3& dpdv) override {
+        glm::vec3 p = glm::vec3(invModelMatrix * glm::vec4(hit.x, 1.0f));
+        sphericalUV(glm::normalize(p), 1.0f, uv, dpdu, dpdv);
+        dpdu = glm::vec3(modelMatrix * glm::vec4(dpdu, 0.0f));
+        dpdv = glm::vec3(modelMatrix * glm::vec4(dpdv, 0.0f));
+        return true;
+    }
+
 private:
     shared_ptr<MatrixStack> M;
     glm::mat4 modelMatrix;
@@ -0,0 +1,86 @@
+#include "EnvironmentLight.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "ImageReader.h"
+#include "Sampling.h"
+
+using namespace std;
+
+EnvironmentLight::EnvironmentLight() :
+	width(0),
+	height(0),
+	intensity(1.0f),
+	rotation(0.0f),
+	samples(16)
+{
+}
+
+EnvironmentLight::~EnvironmentLight()
+{
+}
+
+bool EnvironmentLight::load(const string &filename, float intensity, float rotation)
+{
+	if(!readImage(filename, width, height, rgb)) {
+		return false;
+	}
+	this->intensity = intensity;
+	this->rotation = rotation / 360.0f;
+
+	// The texels of a row cover less solid angle toward the poles, by
+	// sin(theta) at the row's center
+	vector<float> weights((size_t)width * height);
+	for(int y = 0; y < height; y++) {
+		float sinTheta = sin(PI * (y + 0.5f) / height);
+		for(int x = 0; x < width; x++) {
+			const float *c = &rgb[((size_t)y * width + x) * 3];
+			float luminance = 0.2126f * c[0] + 0.7152f * c[1] + 0.0722f * c[2];
+			weights[(size_t)y * width + x] = max(luminance, 0.0f) * sinTheta;
+		}
+	}
+	table.build(weights);
+	return true;
+}
+
+glm::vec3 EnvironmentLight::eval(const glm::vec3 &dir) const
+{
+	float u = 0.5f + atan2(dir.x, -dir.z) / (2.0f * PI) + rotation;
+	float v = acos(glm::clamp(dir.y, -1.0f, 1.0f)) / PI;
+	u -= floor(u);
+	int x = min((int)(u * width), width - 1);
+	int y = min((int)(v * height), height - 1);
+	const float *c = &rgb[((size_t)y * width + x) * 3];
+	return glm::vec3(c[0], c[1], c[2]) * intensity;
+}
+
+bool EnvironmentLight::sample(const glm::vec2 &u, glm::vec3 &dir, glm::vec3 &radiance, float &pdf) const
+{
+	if(table.empty()) {
+		return false;
+	}
+	// The fraction of u.x left over from picking the bin and the remapped
+	// u.y place the direction uniformly within the texel
+	float fy;
+	int i = table.sample(u.x, u.y, fy);
+	float fx = u.x * table.size();
+	fx -= floor(fx);
+	int x = i % width;
+	int y = i / width;
+
+	float phi = 2.0f * PI * ((x + fx) / width - 0.5f - rotation);
+	float theta = PI * (y + fy) / height;
+	float sinTheta = sin(theta);
+	if(sinTheta <= 0.0f) {
+		return false;
+	}
+	dir = glm::vec3(sinTheta * sin(phi), cos(theta), -sinTheta * cos(phi));
+
+	// The texel is picked with table.pmf(i) and covers
+	// (2 pi / width) (pi / height) sin(theta) steradians
+	pdf = table.pmf(i) * width * height / (2.0f * PI * PI * sinTheta);
+	const float *c = &rgb[(size_t)i * 3];
+	radiance = glm::vec3(c[0], c[1], c[2]) * intensity;
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef ENVIRONMENTLIGHT_H
+#define ENVIRONMENTLIGHT_H
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "AliasTable.h"
+
+// Light arriving from infinitely far away in every direction, given as an
+// equirectangular (latitude-longitude) HDR image. The top row of the image
+// is straight up (+y), the middle column looks down -z, and the image can
+// be turned around the y axis.
+//
+// Directions are sampled in proportion to the luminance of the texels they
+// fall in, through an alias table built when the image is loaded, so the
+// few bright texels of a sun or window get most of the shadow rays.
+class EnvironmentLight
+{
+public:
+	EnvironmentLight();
+	virtual ~EnvironmentLight();
+
+	// Loads any image readImage reads, normally .hdr or .pfm. Rotation is
+	// in degrees.
+	bool load(const std::string &filename, float intensity, float rotation);
+
+	// Radiance arriving along -dir, i.e. seen looking along dir
+	glm::vec3 eval(const glm::vec3 &dir) const;
+	// Picks a direction for the uniform numbers u. Returns the radiance from
+	// that direction and its probability density per unit solid angle, or
+	// false if the image is black.
+	bool sample(const glm::vec2 &u, glm::vec3 &dir, glm::vec3 &radiance, float &pdf) const;
+
+	// Shadow rays per shaded point
+	void setSamples(int samples) { this->samples = samples; }
+	int getSamples() const { return samples; }
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+private:
+	int width;
+	int height;
+	float intensity;
+	float rotation; // fraction of a turn
+	int samples;
+	std::vector<float> rgb;
+	AliasTable table;
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "ImageReader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace std;
+
+// Next whitespace separated token of a Netpbm style header, skipping
+// comments
+static string headerToken(const vector<unsigned char> &data, size_t &pos)
+{
+	while(pos < data.size()) {
+		if(data[pos] == '#') {
+			while(pos < data.size() && data[pos] != '\n') {
+				pos++;
+			}
+		} else if(isspace(data[pos])) {
+			pos++;
+		} else {
+			break;
+		}
+	}
+	string token;
+	while(pos < data.size() && !isspace(data[pos])) {
+		token += (char)data[pos++];
+	}
+	return token;
+}
+
+static bool readPfm(const vector<unsigned char> &data, int &width, int &height, vector<float> &rgb)
+{
+	size_t pos = 0;
+	string type = headerToken(data, pos);
+	int channels = type == "PF" ? 3 : type == "Pf" ? 1 : 0;
+	width = atoi(headerToken(data, pos).c_str());
+	height = atoi(headerToken(data, pos).c_str());
+	float scale = (float)atof(headerToken(data, pos).c_str());
+	pos++;
+	size_t n = (size_t)width * height * channels;
+	if(channels == 0 || width <= 0 || height <= 0 || scale == 0.0f || pos + n * 4 > data.size()) {
+		return false;
+	}
+
+	// A negative scale marks little endian data. Rows are stored bottom up.
+	uint16_t one = 1;
+	bool swap = (scale < 0.0f) != (*(unsigned char *)&one == 1);
+	rgb.resize((size_t)width * height * 3);
+	for(int y = 0; y < height; y++) {
+		const unsigned char *row = &data[pos + (size_t)(height - 1 - y) * width * channels * 4];
+		for(int x = 0; x < width; x++) {
+			for(int c = 0; c < 3; c++) {
+				unsigned char bytes[4];
+				memcpy(bytes, row + (x * channels + (channels == 3 ? c : 0)) * 4, 4);
+				if(swap) {
+					std::swap(bytes[0], bytes[3]);
+					std::swap(bytes[1], bytes[2]);
+				}
+				memcpy(&rgb[((size_t)y * width + x) * 3 + c], bytes, 4);
+			}
+		}
+	}
+	return true;
+}
+
+static bool readQoi(const vector<unsigned char> &data, int &width, int &height, vector<float> &rgb)
+{
+	if(data.size() < 14 || memcmp(data.data(), "qoif", 4) != 0) {
+		return false;
+	}
+	auto get32be = [&](size_t i) {
+		return (uint32_t)data[i] << 24 | (uint32_t)data[i + 1] << 16 | (uint32_t)data[i + 2] << 8 | data[i + 3];
+	};
+	width = (int)get32be(4);
+	height = (int)get32be(8);
+	if(width <= 0 || height <= 0) {
+		return false;
+	}
+
+	struct Pixel
+	{
+		unsigned char r, g, b, a;
+	};
+	Pixel index[64] = {};
+	Pixel px = {0, 0, 0, 255};
+	size_t n = (size_t)width * height;
+	size_t pos = 14;
+	int run = 0;
+	rgb.resize(n * 3);
+	for(size_t i = 0; i < n; i++) {
+		if(run > 0) {
+			run--;
+		} else if(pos < data.size()) {
+			unsigned char b = data[pos++];
+			if(b == 0xfe && pos + 3 <= data.size()) {
+				px.r = data[pos];
+				px.g = data[pos + 1];
+				px.b = data[pos + 2];
+				pos += 3;
+			} else if(b == 0xff && pos + 4 <= data.size()) {
+				px.r = data[pos];
+				px.g = data[pos + 1];
+				px.b = data[pos + 2];
+				px.a = data[pos + 3];
+				pos += 4;
+			} else if((b & 0xc0) == 0x00) {
+				px = index[b];
+			} else if((b & 0xc0) == 0x40) {
+				px.r += ((b >> 4) & 3) - 2;
+				px.g += ((b >> 2) & 3) - 2;
+				px.b += (b & 3) - 2;
+			} else if((b & 0xc0) == 0x80 && pos < data.size()) {
+				int vg = (b & 0x3f) - 32;
+				unsigned char b2 = data[pos++];
+				px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.g += vg;
+				px.b += vg - 8 + (b2 & 0x0f);
+			} else if((b & 0xc0) == 0xc0) {
+				run = b & 0x3f;
+			} else {
+				return false;
+			}
+			index[(px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64] = px;
+		} else {
+			return false;
+		}
+		rgb[i * 3 + 0] = px.r / 255.0f;
+		rgb[i * 3 + 1] = px.g / 255.0f;
+		rgb[i * 3 + 2] = px.b / 255.0f;
+	}
+	return true;
+}
+
+// Everything else stb_image decodes (.png, .jpg, .hdr, .ppm, .bmp, .tga,
+// ...), told apart by content. Only .hdr is read as float.
+static bool readStb(const vector<unsigned char> &data, int &width, int &height, vector<float> &rgb)
+{
+	if(data.empty() || data.size() > INT32_MAX) {
+		return false;
+	}
+	const stbi_uc *buffer = data.data();
+	int length = (int)data.size();
+	int channels;
+	if(stbi_is_hdr_from_memory(buffer, length)) {
+		float *pixels = stbi_loadf_from_memory(buffer, length, &width, &height, &channels, 3);
+		if(!pixels) {
+			return false;
+		}
+		rgb.assign(pixels, pixels + (size_t)width * height * 3);
+		stbi_image_free(pixels);
+		return true;
+	}
+	stbi_uc *pixels = stbi_load_from_memory(buffer, length, &width, &height, &channels, 3);
+	if(!pixels) {
+		return false;
+	}
+	size_t n = (size_t)width * height * 3;
+	rgb.resize(n);
+	for(size_t i = 0; i < n; i++) {
+		rgb[i] = pixels[i] / 255.0f;
+	}
+	stbi_image_free(pixels);
+	return true;
+}
+
+bool readImage(const string &filename, int &width, int &height, vector<float> &rgb)
+{
+	ifstream in(filename, ios::binary);
+	if(!in) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+	vector<unsigned char> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+	size_t dot = filename.find_last_of('.');
+	string ext = dot == string::npos ? "" : filename.substr(dot + 1);
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if(ext == "pfm") {
+		if(!readPfm(data, width, height, rgb)) {
+			cerr << filename << " is not a valid .pfm image" << endl;
+			return false;
+		}
+	} else if(ext == "qoi") {
+		if(!readQoi(data, width, height, rgb)) {
+			cerr << filename << " is not a valid .qoi image" << endl;
+			return false;
+		}
+	} else if(!readStb(data, width, height, rgb)) {
+		const char *reason = stbi_failure_reason();
+		cerr << "Couldn't read " << filename << " (" << (reason ? reason : "unknown format") << ")" << endl;
+		return false;
+	}
+	return true;
+}
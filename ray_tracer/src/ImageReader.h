@@ -0,0 +1,19 @@
+#pragma once
+#ifndef _IMAGEREADER_H_
+#define _IMAGEREADER_H_
+
+#include <string>
+#include <vector>
+
+// Reads the images ImageWriter writes and the common interchange formats:
+//   .qoi  8-bit RGB or RGBA
+//   .pfm  32-bit float RGB or grayscale
+//   other files go through stb_image, which tells the format from the
+//   content: .png, .jpg, .ppm, .bmp, .tga and the rest it decodes as
+//   8-bit, Radiance .hdr as float
+// Alpha is dropped. rgb gets width x height RGB triples, top row first,
+// with 8-bit channels scaled to [0, 1]. Prints the reason and returns
+// false on failure.
+bool readImage(const std::string &filename, int &width, int &height, std::vector<float> &rgb);
+
+#endif
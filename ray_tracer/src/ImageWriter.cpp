@@ -0,0 +1,575 @@
+#include "ImageWriter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+ImageWriter::ImageWriter() :
+	width(0),
+	height(0),
+	bandHeight(1),
+	fp(nullptr),
+	ok(false),
+	nextBand(0)
+{
+}
+
+ImageWriter::~ImageWriter()
+{
+	if(fp) {
+		fclose(fp);
+	}
+}
+
+bool ImageWriter::open(const string &filename, int width, int height, int bandHeight)
+{
+	this->filename = filename;
+	this->width = width;
+	this->height = height;
+	this->bandHeight = max(1, bandHeight);
+	nextBand = 0;
+	pending.clear();
+	fp = fopen(filename.c_str(), "wb");
+	if(!fp) {
+		cout << "Couldn't write to " << filename << endl;
+		return false;
+	}
+	ok = true;
+	return writeHeader();
+}
+
+bool ImageWriter::write(const void *data, size_t size)
+{
+	if(ok && fwrite(data, 1, size, fp) != size) {
+		ok = false;
+	}
+	return ok;
+}
+
+void ImageWriter::writeBand(int band, const float *rgb)
+{
+	EncodedBand encoded;
+	encodeBand(band, getBandRows(band), rgb, encoded);
+
+	lock_guard<mutex> lock(bandMutex);
+	pending[band] = move(encoded);
+	// Whoever completes the next band in order writes every band that is
+	// ready, so the file is filled front to back
+	for(auto it = pending.find(nextBand); it != pending.end(); it = pending.find(nextBand)) {
+		write(it->second.bytes.data(), it->second.bytes.size());
+		bandWritten(it->second);
+		pending.erase(it);
+		nextBand++;
+	}
+	bandWrittenCondition.notify_all();
+}
+
+void ImageWriter::waitForBands(int band)
+{
+	unique_lock<mutex> lock(bandMutex);
+	bandWrittenCondition.wait(lock, [&]() { return nextBand >= band; });
+}
+
+bool ImageWriter::close()
+{
+	if(!fp) {
+		return false;
+	}
+	writeTrailer();
+	if(fclose(fp) != 0) {
+		ok = false;
+	}
+	fp = nullptr;
+	if(ok) {
+		cout << "Wrote to " << filename << endl;
+	} else {
+		cout << "Couldn't write to " << filename << endl;
+	}
+	return ok;
+}
+
+static void put32be(vector<unsigned char> &out, uint32_t v)
+{
+	out.push_back((v >> 24) & 0xff);
+	out.push_back((v >> 16) & 0xff);
+	out.push_back((v >> 8) & 0xff);
+	out.push_back(v & 0xff);
+}
+
+//
+// PNG
+//
+
+struct CrcTable
+{
+	uint32_t v[256];
+	CrcTable()
+	{
+		for(uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for(int k = 0; k < 8; k++) {
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			v[n] = c;
+		}
+	}
+};
+
+static uint32_t crc32(uint32_t crc, const unsigned char *data, size_t size)
+{
+	static const CrcTable table;
+	crc = ~crc;
+	for(size_t i = 0; i < size; i++) {
+		crc = table.v[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static const uint32_t ADLER_BASE = 65521;
+
+static uint32_t adler32(const unsigned char *data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+	while(size > 0) {
+		// 5552 is the most bytes that can't overflow b before the modulo
+		size_t n = min(size, (size_t)5552);
+		for(size_t i = 0; i < n; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+		data += n;
+		size -= n;
+	}
+	return (b << 16) | a;
+}
+
+// Adler-32 of two blocks from the checksums of each, as in zlib
+static uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2)
+{
+	uint64_t rem = size2 % ADLER_BASE;
+	uint64_t sum1 = adler1 & 0xffff;
+	uint64_t sum2 = (rem * sum1) % ADLER_BASE;
+	sum1 += (adler2 & 0xffff) + ADLER_BASE - 1;
+	sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + ADLER_BASE - rem;
+	sum1 %= ADLER_BASE;
+	sum2 %= ADLER_BASE;
+	return (uint32_t)((sum2 << 16) | sum1);
+}
+
+static void appendChunk(vector<unsigned char> &out, const char *type, const unsigned char *data, size_t size)
+{
+	put32be(out, (uint32_t)size);
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + size);
+	put32be(out, crc32(0, &out[start], out.size() - start));
+}
+
+// Writes bits least significant first, as deflate expects
+class BitWriter
+{
+public:
+	BitWriter(vector<unsigned char> &out) : out(out), bits(0), count(0) {}
+
+	void put(uint32_t value, int n)
+	{
+		bits |= value << count;
+		count += n;
+		while(count >= 8) {
+			out.push_back(bits & 0xff);
+			bits >>= 8;
+			count -= 8;
+		}
+	}
+
+	// Huffman codes are stored most significant bit first
+	void putCode(uint32_t code, int n)
+	{
+		uint32_t reversed = 0;
+		for(int i = 0; i < n; i++) {
+			reversed = (reversed << 1) | ((code >> i) & 1);
+		}
+		put(reversed, n);
+	}
+
+	void align()
+	{
+		if(count > 0) {
+			put(0, 8 - count);
+		}
+	}
+
+private:
+	vector<unsigned char> &out;
+	uint32_t bits;
+	int count;
+};
+
+static const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const int DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Literal/length symbol with the fixed Huffman code
+static void putSymbol(BitWriter &w, int symbol)
+{
+	if(symbol < 144) {
+		w.putCode(0x30 + symbol, 8);
+	} else if(symbol < 256) {
+		w.putCode(0x190 + symbol - 144, 9);
+	} else if(symbol < 280) {
+		w.putCode(symbol - 256, 7);
+	} else {
+		w.putCode(0xc0 + symbol - 280, 8);
+	}
+}
+
+static void putMatch(BitWriter &w, int length, int dist)
+{
+	int i = 0;
+	while(i < 28 && LENGTH_BASE[i + 1] <= length) {
+		i++;
+	}
+	putSymbol(w, 257 + i);
+	w.put(length - LENGTH_BASE[i], LENGTH_EXTRA[i]);
+	int j = 0;
+	while(j < 29 && DIST_BASE[j + 1] <= dist) {
+		j++;
+	}
+	w.putCode(j, 5);
+	w.put(dist - DIST_BASE[j], DIST_EXTRA[j]);
+}
+
+// Compresses data into one non-final deflate block with fixed Huffman codes,
+// followed by an empty stored block so that it ends on a byte boundary (a
+// "sync flush"). Blocks made this way can be concatenated into one stream.
+static void deflateBlock(const unsigned char *data, int size, vector<unsigned char> &out)
+{
+	const int HASH_BITS = 15;
+	const int WINDOW = 32768;
+	const int MAX_CHAIN = 32;
+	const int MAX_MATCH = 258;
+
+	BitWriter w(out);
+	w.put(0, 1); // not the last block
+	w.put(1, 2); // fixed Huffman codes
+
+	vector<int> head(1 << HASH_BITS, -1);
+	vector<int> prev(size);
+	auto hash = [&](int i) {
+		uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+		return (v * 2654435761u) >> (32 - HASH_BITS);
+	};
+	auto insert = [&](int i) {
+		uint32_t h = hash(i);
+		prev[i] = head[h];
+		head[h] = i;
+	};
+
+	int i = 0;
+	while(i < size) {
+		int bestLength = 0;
+		int bestDist = 0;
+		if(i + 3 <= size) {
+			int maxLength = min(size - i, MAX_MATCH);
+			int chain = MAX_CHAIN;
+			for(int j = head[hash(i)]; j >= 0 && i - j <= WINDOW && chain-- > 0; j = prev[j]) {
+				int length = 0;
+				while(length < maxLength && data[j + length] == data[i + length]) {
+					length++;
+				}
+				if(length > bestLength) {
+					bestLength = length;
+					bestDist = i - j;
+					if(length == maxLength) {
+						break;
+					}
+				}
+			}
+			insert(i);
+		}
+		if(bestLength >= 3) {
+			putMatch(w, bestLength, bestDist);
+			for(int k = i + 1; k < i + bestLength && k + 3 <= size; k++) {
+				insert(k);
+			}
+			i += bestLength;
+		} else {
+			putSymbol(w, data[i]);
+			i++;
+		}
+	}
+	putSymbol(w, 256); // end of block
+
+	w.put(0, 3);
+	w.align();
+	out.push_back(0x00);
+	out.push_back(0x00);
+	out.push_back(0xff);
+	out.push_back(0xff);
+}
+
+static int paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	if(pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+// Every band becomes one IDAT chunk holding a sync-flushed deflate block of
+// its filtered rows. The zlib header and the final block go into IDAT chunks
+// of their own, and the Adler-32 of the whole stream is combined from the
+// checksums of the bands as they are written.
+class PngWriter : public ImageWriter
+{
+protected:
+	bool writeHeader() override
+	{
+		static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+		vector<unsigned char> out(SIGNATURE, SIGNATURE + 8);
+		vector<unsigned char> ihdr;
+		put32be(ihdr, width);
+		put32be(ihdr, height);
+		ihdr.push_back(8); // bit depth
+		ihdr.push_back(2); // RGB
+		ihdr.push_back(0); // deflate
+		ihdr.push_back(0); // adaptive filtering
+		ihdr.push_back(0); // no interlace
+		appendChunk(out, "IHDR", ihdr.data(), ihdr.size());
+		static const unsigned char ZLIB_HEADER[2] = {0x78, 0x01};
+		appendChunk(out, "IDAT", ZLIB_HEADER, 2);
+		adler = 1;
+		return write(out.data(), out.size());
+	}
+
+	void encodeBand(int band, int rows, const float *rgb, EncodedBand &out) override
+	{
+		int stride = width * 3;
+		vector<unsigned char> pixels(rows * stride);
+		for(size_t i = 0; i < pixels.size(); i++) {
+			pixels[i] = toByte(rgb[i]);
+		}
+
+		// Pick the filter with the smallest sum of absolute values for each
+		// row. The row above belongs to another band for the first row, so
+		// that row can only use None or Sub.
+		vector<unsigned char> filtered(rows * (stride + 1));
+		vector<unsigned char> candidate(stride);
+		for(int y = 0; y < rows; y++) {
+			const unsigned char *row = &pixels[y * stride];
+			const unsigned char *up = y > 0 ? row - stride : nullptr;
+			unsigned char *dst = &filtered[y * (stride + 1)];
+			int bestSum = -1;
+			for(int filter = 0; filter < (up ? 5 : 2); filter++) {
+				int sum = 0;
+				for(int x = 0; x < stride; x++) {
+					int a = x >= 3 ? row[x - 3] : 0;
+					int b = up ? up[x] : 0;
+					int c = up && x >= 3 ? up[x - 3] : 0;
+					int p = 0;
+					switch(filter) {
+					case 1: p = a; break;
+					case 2: p = b; break;
+					case 3: p = (a + b) / 2; break;
+					case 4: p = paeth(a, b, c); break;
+					}
+					candidate[x] = (unsigned char)(row[x] - p);
+					sum += abs((signed char)candidate[x]);
+				}
+				if(bestSum < 0 || sum < bestSum) {
+					bestSum = sum;
+					dst[0] = filter;
+					memcpy(dst + 1, candidate.data(), stride);
+				}
+			}
+		}
+
+		vector<unsigned char> compressed;
+		deflateBlock(filtered.data(), (int)filtered.size(), compressed);
+		appendChunk(out.bytes, "IDAT", compressed.data(), compressed.size());
+		out.checksum = adler32(filtered.data(), filtered.size());
+		out.rawSize = filtered.size();
+	}
+
+	void bandWritten(const EncodedBand &band) override
+	{
+		adler = adler32Combine(adler, band.checksum, band.rawSize);
+	}
+
+	bool writeTrailer() override
+	{
+		vector<unsigned char> out;
+		// Last block: fixed Huffman codes with only the end of block symbol
+		vector<unsigned char> last = {0x03, 0x00};
+		put32be(last, adler);
+		appendChunk(out, "IDAT", last.data(), last.size());
+		appendChunk(out, "IEND", nullptr, 0);
+		return write(out.data(), out.size());
+	}
+
+private:
+	uint32_t adler = 1;
+};
+
+//
+// PPM
+//
+
+class PpmWriter : public ImageWriter
+{
+protected:
+	bool writeHeader() override
+	{
+		string header = "P6\n" + to_string(width) + " " + to_string(height) + "\n255\n";
+		return write(header.data(), header.size());
+	}
+
+	void encodeBand(int band, int rows, const float *rgb, EncodedBand &out) override
+	{
+		out.bytes.resize(rows * width * 3);
+		for(size_t i = 0; i < out.bytes.size(); i++) {
+			out.bytes[i] = toByte(rgb[i]);
+		}
+	}
+
+	bool writeTrailer() override { return true; }
+};
+
+//
+// QOI
+//
+
+// QOI keeps the previous pixel and a table of recently seen pixels across
+// the whole stream. A band can't see the end of the band before it, so it
+// starts its first pixel with a full RGB op and only refers to table entries
+// it has written itself. The decoder's state agrees with that for every op
+// the band emits.
+class QoiWriter : public ImageWriter
+{
+protected:
+	bool writeHeader() override
+	{
+		vector<unsigned char> out = {'q', 'o', 'i', 'f'};
+		put32be(out, width);
+		put32be(out, height);
+		out.push_back(3); // RGB
+		out.push_back(0); // sRGB with linear alpha
+		return write(out.data(), out.size());
+	}
+
+	void encodeBand(int band, int rows, const float *rgb, EncodedBand &out) override
+	{
+		struct Pixel
+		{
+			unsigned char r, g, b, a;
+			bool operator==(const Pixel &o) const { return r == o.r && g == o.g && b == o.b && a == o.a; }
+		};
+		// Entries with zero alpha never match an opaque pixel
+		Pixel index[64] = {};
+		Pixel prev = {0, 0, 0, 0};
+		int run = 0;
+		vector<unsigned char> &bytes = out.bytes;
+		bytes.reserve(rows * width);
+		int n = rows * width;
+		for(int i = 0; i < n; i++) {
+			Pixel px = {toByte(rgb[3 * i + 0]), toByte(rgb[3 * i + 1]), toByte(rgb[3 * i + 2]), 255};
+			if(i > 0 && px == prev) {
+				run++;
+				if(run == 62) {
+					bytes.push_back(0xc0 | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if(run > 0) {
+				bytes.push_back(0xc0 | (run - 1));
+				run = 0;
+			}
+			int h = (px.r * 3 + px.g * 5 + px.b * 7 + px.a * 11) % 64;
+			if(index[h] == px) {
+				bytes.push_back(h);
+			} else {
+				index[h] = px;
+				signed char vr = px.r - prev.r;
+				signed char vg = px.g - prev.g;
+				signed char vb = px.b - prev.b;
+				signed char vgr = vr - vg;
+				signed char vgb = vb - vg;
+				if(i > 0 && vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+					bytes.push_back(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+				} else if(i > 0 && vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+					bytes.push_back(0x80 | (vg + 32));
+					bytes.push_back((vgr + 8) << 4 | (vgb + 8));
+				} else {
+					bytes.push_back(0xfe);
+					bytes.push_back(px.r);
+					bytes.push_back(px.g);
+					bytes.push_back(px.b);
+				}
+			}
+			prev = px;
+		}
+		if(run > 0) {
+			bytes.push_back(0xc0 | (run - 1));
+		}
+	}
+
+	bool writeTrailer() override
+	{
+		static const unsigned char END[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+		return write(END, 8);
+	}
+};
+
+//
+// PFM
+//
+
+class PfmWriter : public ImageWriter
+{
+public:
+	bool bottomUp() const override { return true; }
+
+protected:
+	bool writeHeader() override
+	{
+		// A negative scale marks little endian data
+		uint16_t one = 1;
+		bool little = *(unsigned char *)&one == 1;
+		string header = "PF\n" + to_string(width) + " " + to_string(height) + (little ? "\n-1.0\n" : "\n1.0\n");
+		return write(header.data(), header.size());
+	}
+
+	void encodeBand(int band, int rows, const float *rgb, EncodedBand &out) override
+	{
+		out.bytes.resize(rows * width * 3 * sizeof(float));
+		memcpy(out.bytes.data(), rgb, out.bytes.size());
+	}
+
+	bool writeTrailer() override { return true; }
+};
+
+unique_ptr<ImageWriter> ImageWriter::create(const string &filename)
+{
+	size_t dot = filename.find_last_of('.');
+	string ext = dot == string::npos ? "" : filename.substr(dot + 1);
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	if(ext == "png") {
+		return unique_ptr<ImageWriter>(new PngWriter());
+	} else if(ext == "ppm") {
+		return unique_ptr<ImageWriter>(new PpmWriter());
+	} else if(ext == "qoi") {
+		return unique_ptr<ImageWriter>(new QoiWriter());
+	} else if(ext == "pfm") {
+		return unique_ptr<ImageWriter>(new PfmWriter());
+	}
+	cerr << "Unknown image format: " << filename << " (use .png, .ppm, .qoi or .pfm)" << endl;
+	return nullptr;
+}
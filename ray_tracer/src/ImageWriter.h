@@ -0,0 +1,92 @@
+#pragma once
+#ifndef _IMAGEWRITER_H_
+#define _IMAGEWRITER_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Converts a shaded color channel to 8 bits the way the renderer always has
+inline unsigned char toByte(float c)
+{
+	return static_cast<int>(std::min(c * 255.0f, 255.0f));
+}
+
+// Writes an image while it is being rendered. The image is split into
+// horizontal bands of bandHeight rows, numbered in the order they appear in
+// the file. writeBand() encodes a band on the calling thread, so several
+// bands can be encoded at once, and the band is written out as soon as every
+// band before it has been. Only the bands in flight are kept in memory.
+//
+// Formats:
+//   .png  8-bit RGB, each band deflated independently
+//   .ppm  8-bit binary RGB (P6), no compression
+//   .qoi  8-bit RGB "Quite OK Image" format, fast lossless compression
+//   .pfm  32-bit float RGB, unclamped
+class ImageWriter
+{
+public:
+	// Picks the format from the extension of the filename. Returns null for
+	// an unknown extension.
+	static std::unique_ptr<ImageWriter> create(const std::string &filename);
+
+	virtual ~ImageWriter();
+
+	// Opens the file and writes the header
+	bool open(const std::string &filename, int width, int height, int bandHeight);
+	// Encodes one band and writes it once all bands before it are written.
+	// rgb holds width x getBandRows(band) RGB triples, in file row order.
+	// Safe to call from several threads at once.
+	void writeBand(int band, const float *rgb);
+	// Blocks until bands [0, band) have been written
+	void waitForBands(int band);
+	// Writes the trailer and closes the file. Returns false if any write
+	// failed.
+	bool close();
+
+	// Whether the file stores the bottom row of the image first
+	virtual bool bottomUp() const { return false; }
+
+	int getBandHeight() const { return bandHeight; }
+	int getBandCount() const { return (height + bandHeight - 1) / bandHeight; }
+	int getBandRows(int band) const { return std::min(bandHeight, height - band * bandHeight); }
+
+protected:
+	struct EncodedBand
+	{
+		std::vector<unsigned char> bytes;
+		uint32_t checksum = 0; // format specific
+		size_t rawSize = 0;    // format specific
+	};
+
+	ImageWriter();
+
+	virtual bool writeHeader() = 0;
+	virtual void encodeBand(int band, int rows, const float *rgb, EncodedBand &out) = 0;
+	// Called in band order right after each band is written
+	virtual void bandWritten(const EncodedBand &band) {}
+	virtual bool writeTrailer() = 0;
+
+	bool write(const void *data, size_t size);
+
+	int width;
+	int height;
+	int bandHeight;
+
+private:
+	FILE *fp;
+	std::string filename;
+	bool ok;
+	int nextBand;
+	std::map<int, EncodedBand> pending;
+	std::mutex bandMutex;
+	std::condition_variable bandWrittenCondition;
+};
+
+#endif
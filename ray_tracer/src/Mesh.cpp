@@ -0,0 +1,266 @@
+#include "Mesh.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "raytri.h"
+
+using namespace std;
+
+int MeshGeometry::loadObj(const string &meshName)
+{
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    string errStr;
+    bool rc = tinyobj::LoadObj(&attrib, &shapes, &materials, &errStr, meshName.c_str());
+    if(!rc) {
+        cerr << errStr << endl;
+    } else {
+        // Some OBJ files have different indices for vertex positions, normals,
+        // and texture coordinates. For example, a cube corner vertex may have
+        // three different normals. Here, we are going to duplicate all such
+        // vertices.
+        // Loop over shapes
+        for(size_t s = 0; s < shapes.size(); s++) {
+            // Loop over faces (polygons)
+            size_t index_offset = 0;
+            for(size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+                size_t fv = shapes[s].mesh.num_face_vertices[f];
+                // Loop over vertices in the face.
+                for(size_t v = 0; v < fv; v++) {
+                    // access to vertex
+                    tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+
+                    posBuf.push_back(attrib.vertices[3*idx.vertex_index+0]);
+                    posBuf.push_back(attrib.vertices[3*idx.vertex_index+1]);
+                    posBuf.push_back(attrib.vertices[3*idx.vertex_index+2]);
+
+                    if(!attrib.normals.empty()) {
+                        norBuf.push_back(attrib.normals[3*idx.normal_index+0]);
+                        norBuf.push_back(attrib.normals[3*idx.normal_index+1]);
+                        norBuf.push_back(attrib.normals[3*idx.normal_index+2]);
+                    }
+                    if(!attrib.texcoords.empty()) {
+                        texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+0]);
+                        texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+1]);
+                    }
+                }
+                index_offset += fv;
+                // per-face material (IGNORE)
+                shapes[s].mesh.material_ids[f];
+            }
+        }
+    }
+
+    computeBounds();
+    return posBuf.size()/3;
+}
+
+void MeshGeometry::computeBounds()
+{
+    xmin = ymin = zmin = FLT_MAX;
+    xmax = ymax = zmax = -FLT_MAX;
+    for(size_t i = 0; i + 2 < posBuf.size(); i += 3) {
+        xmin = min(xmin, posBuf[i]);
+        xmax = max(xmax, posBuf[i]);
+
+        ymin = min(ymin, posBuf[i + 1]);
+        ymax = max(ymax, posBuf[i + 1]);
+
+        zmin = min(zmin, posBuf[i + 2]);
+        zmax = max(zmax, posBuf[i + 2]);
+    }
+}
+
+void MeshGeometry::buildBVH()
+{
+    if(!bvh.empty()) {
+        return;
+    }
+    vector<AABB> boxes(posBuf.size() / 9);
+    for(size_t i = 0; i < boxes.size(); i++) {
+        for(int k = 0; k < 3; k++) {
+            boxes[i].grow(glm::vec3(posBuf[9*i + 3*k], posBuf[9*i + 3*k + 1], posBuf[9*i + 3*k + 2]));
+        }
+    }
+    bvh.build(boxes);
+}
+
+Mesh::Mesh(string meshName, glm::mat4 modelMatrix, Material color)
+    : meshName(meshName),
+      modelMatrix(modelMatrix),
+      invModelMatrix(glm::inverse(modelMatrix)),
+      color(color)
+{
+    loadGeometry();
+}
+
+Mesh::Mesh(shared_ptr<MeshGeometry> geometry, glm::mat4 modelMatrix, Material color)
+    : geometry(geometry),
+      modelMatrix(modelMatrix),
+      invModelMatrix(glm::inverse(modelMatrix)),
+      color(color)
+{
+}
+
+bool Mesh::intersect(glm::vec3 origin, glm::vec3 ray, Hit& closestHit) {
+    glm::vec3 modelOrigin = glm::vec3(invModelMatrix * glm::vec4(origin, 1.0f));
+    glm::vec3 modelRay = glm::normalize(glm::vec3(invModelMatrix * glm::vec4(ray, 0.0f)));
+
+    // Closest triangle along the model space ray. The model matrix scales
+    // every distance along the ray by the same factor, so the closest
+    // triangle in model space is also the closest in world space.
+    int closest = -1;
+    double closestU = 0.0, closestV = 0.0;
+    float closestT = FLT_MAX;
+    geometry->bvh.traverse(modelOrigin, modelRay, closestT, [&](int tri, float &tmax) {
+        double t, u, v;
+        if (intersectModel(modelOrigin, modelRay, 9 * tri, t, u, v) && t < tmax) {
+            tmax = static_cast<float>(t);
+            closestT = tmax;
+            closest = 9 * tri;
+            closestU = u;
+            closestV = v;
+            return true;
+        }
+        return false;
+    });
+
+    if (closest < 0) {
+        return false;
+    }
+
+    closestHit = makeHit(origin, modelOrigin, modelRay, closest, closestT, closestU, closestV);
+    return true;
+}
+
+bool Mesh::intersectTriangle(glm::vec3 origin, glm::vec3 ray, int tri, Hit& hit) {
+    glm::vec3 modelOrigin = glm::vec3(invModelMatrix * glm::vec4(origin, 1.0f));
+    glm::vec3 modelRay = glm::normalize(glm::vec3(invModelMatrix * glm::vec4(ray, 0.0f)));
+    double t, u, v;
+    if (!intersectModel(modelOrigin, modelRay, 9 * tri, t, u, v)) {
+        return false;
+    }
+    hit = makeHit(origin, modelOrigin, modelRay, 9 * tri, static_cast<float>(t), u, v);
+    return true;
+}
+
+bool Mesh::intersectTriangle(glm::vec3 origin, glm::vec3 ray, int tri, float& distance) {
+    glm::vec3 modelOrigin = glm::vec3(invModelMatrix * glm::vec4(origin, 1.0f));
+    glm::vec3 modelRay = glm::normalize(glm::vec3(invModelMatrix * glm::vec4(ray, 0.0f)));
+    double t, u, v;
+    if (!intersectModel(modelOrigin, modelRay, 9 * tri, t, u, v)) {
+        return false;
+    }
+    distance = worldDistance(origin, modelOrigin, modelRay, static_cast<float>(t));
+    return true;
+}
+
+bool Mesh::intersectModel(const glm::vec3& modelOrigin, const glm::vec3& modelRay, int i, double& t, double& u, double& v) const {
+    const vector<float> &posBuf = geometry->posBuf;
+    double originDouble[3] = {static_cast<double>(modelOrigin.x), static_cast<double>(modelOrigin.y), static_cast<double>(modelOrigin.z)};
+    double rayDouble[3] = {static_cast<double>(modelRay.x), static_cast<double>(modelRay.y), static_cast<double>(modelRay.z)};
+    double v0[3] = {static_cast<double>(posBuf[i]), static_cast<double>(posBuf[i + 1]), static_cast<double>(posBuf[i + 2])};
+    double v1[3] = {static_cast<double>(posBuf[i + 3]), static_cast<double>(posBuf[i + 4]), static_cast<double>(posBuf[i + 5])};
+    double v2[3] = {static_cast<double>(posBuf[i + 6]), static_cast<double>(posBuf[i + 7]), static_cast<double>(posBuf[i + 8])};
+
+    stats::countPrimitiveTest();
+    return intersect_triangle2(originDouble, rayDouble, v0, v1, v2, &t, &u, &v) == 1 && t > 0.0 && t < FLT_MAX;
+}
+
+float Mesh::worldDistance(const glm::vec3& origin, const glm::vec3& modelOrigin, const glm::vec3& modelRay, float t) const {
+    glm::vec3 hitPos = glm::vec3(modelMatrix * glm::vec4((modelOrigin + t * modelRay), 1.0f));
+    return glm::length(hitPos - origin);
+}
+
+int Mesh::getTriangleCount() {
+    return (int)geometry->posBuf.size() / 9;
+}
+
+void Mesh::getTriangle(int tri, glm::vec3 v[3]) {
+    const vector<float> &posBuf = geometry->posBuf;
+    for (int k = 0; k < 3; k++) {
+        int i = 9 * tri + 3 * k;
+        v[k] = glm::vec3(modelMatrix * glm::vec4(posBuf[i], posBuf[i + 1], posBuf[i + 2], 1.0f));
+    }
+}
+
+Hit Mesh::makeHit(const glm::vec3& origin, const glm::vec3& modelOrigin, const glm::vec3& modelRay, int i, float t, double u, double v) {
+    const vector<float> &norBuf = geometry->norBuf;
+    glm::vec3 hitPos = glm::vec3(modelMatrix * glm::vec4((modelOrigin + t * modelRay), 1.0f));
+
+    glm::vec3 normal1 = glm::vec3(norBuf[i], norBuf[i + 1], norBuf[i + 2]);
+    glm::vec3 normal2 = glm::vec3(norBuf[i + 3], norBuf[i + 4], norBuf[i + 5]);
+    glm::vec3 normal3 = glm::vec3(norBuf[i + 6], norBuf[i + 7], norBuf[i + 8]);
+    glm::vec3 normal = static_cast<float>(1.0f - u - v) * normal1 + static_cast<float>(u) * normal2 + static_cast<float>(v) * normal3;
+    normal =  glm::normalize(glm::vec3(glm::transpose(invModelMatrix) * glm::vec4(normal,1.0f)));
+
+    float distance = glm::length(hitPos - origin);
+    Hit hit(hitPos, normal, distance);
+    hit.primitive = i;
+    hit.bary = glm::vec2(static_cast<float>(u), static_cast<float>(v));
+    return hit;
+}
+
+bool Mesh::getUV(const Hit& hit, glm::vec2& uv, glm::vec3& dpdu, glm::vec3& dpdv) {
+    const vector<float> &posBuf = geometry->posBuf;
+    const vector<float> &texBuf = geometry->texBuf;
+    int i = hit.primitive;
+
+    if (texBuf.size() * 3 != posBuf.size() * 2) {
+        glm::vec3 center = 0.5f * glm::vec3(geometry->xmin + geometry->xmax, geometry->ymin + geometry->ymax, geometry->zmin + geometry->zmax);
+        glm::vec3 p = glm::vec3(invModelMatrix * glm::vec4(hit.x, 1.0f)) - center;
+        float r = glm::length(p);
+        if (r <= 0.0f) {
+            return false;
+        }
+        sphericalUV(p / r, r, uv, dpdu, dpdv);
+    } else {
+        // Two texture coordinates per vertex against three positions
+        int k = i / 3 * 2;
+        glm::vec2 t0(texBuf[k], texBuf[k + 1]);
+        glm::vec2 t1(texBuf[k + 2], texBuf[k + 3]);
+        glm::vec2 t2(texBuf[k + 4], texBuf[k + 5]);
+        float u = hit.bary.x;
+        float v = hit.bary.y;
+        uv = (1.0f - u - v) * t0 + u * t1 + v * t2;
+
+        // Solve e1 = d1.x * dpdu + d1.y * dpdv (and the same for e2)
+        glm::vec3 p0(posBuf[i], posBuf[i + 1], posBuf[i + 2]);
+        glm::vec3 e1 = glm::vec3(posBuf[i + 3], posBuf[i + 4], posBuf[i + 5]) - p0;
+        glm::vec3 e2 = glm::vec3(posBuf[i + 6], posBuf[i + 7], posBuf[i + 8]) - p0;
+        glm::vec2 d1 = t1 - t0;
+        glm::vec2 d2 = t2 - t0;
+        float det = d1.x * d2.y - d1.y * d2.x;
+        if (fabs(det) < 1e-12f) {
+            // Degenerate mapping, filtered as if the texture was magnified
+            dpdu = dpdv = glm::vec3(0.0f);
+            return true;
+        }
+        dpdu = (d2.y * e1 - d1.y * e2) / det;
+        dpdv = (d1.x * e2 - d2.x * e1) / det;
+    }
+    dpdu = glm::vec3(modelMatrix * glm::vec4(dpdu, 0.0f));
+    dpdv = glm::vec3(modelMatrix * glm::vec4(dpdv, 0.0f));
+    return true;
+}
+
+bool Mesh::getBounds(AABB& box) {
+    AABB modelBox;
+    modelBox.min = glm::vec3(geometry->xmin, geometry->ymin, geometry->zmin);
+    modelBox.max = glm::vec3(geometry->xmax, geometry->ymax, geometry->zmax);
+    box = modelBox.transform(modelMatrix);
+    return true;
+}
+
+void Mesh::buildBVH() {
+    geometry->buildBVH();
+}
+
+int Mesh::loadGeometry(){
+    auto loaded = make_shared<MeshGeometry>();
+    int vertices = loaded->loadObj(meshName);
+    geometry = loaded;
+    return vertices;
+}
@@ -0,0 +1,307 @@
+#include "PhotonMap.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+using namespace std;
+
+// Uniform number in [0, 1) for photon g, dimension d
+static float uniform(uint32_t g, uint32_t d)
+{
+	return (hashBits(g * 0x9e3779b9u + hashBits(d)) >> 8) * 5.9604645e-8f;
+}
+
+// Cone of directions from a point toward the bounding sphere of a shape
+struct Cone
+{
+	glm::vec3 axis;
+	float cosMax;
+	float solidAngle;
+
+	Cone(const glm::vec3 &origin, const glm::vec3 &center, float radius)
+	{
+		glm::vec3 w = center - origin;
+		float d = glm::length(w);
+		if(d <= radius) {
+			// Inside the sphere every direction may hit the shape
+			axis = glm::vec3(0.0f, 1.0f, 0.0f);
+			cosMax = -1.0f;
+		} else {
+			axis = w / d;
+			cosMax = sqrt(1.0f - (radius * radius) / (d * d));
+		}
+		solidAngle = 2.0f * PI * (1.0f - cosMax);
+	}
+
+	glm::vec3 sample(float u, float v) const
+	{
+		float cosTheta = 1.0f - u * (1.0f - cosMax);
+		float sinTheta = sqrt(max(0.0f, 1.0f - cosTheta * cosTheta));
+		float phi = 2.0f * PI * v;
+		glm::vec3 t, b;
+		basis(axis, t, b);
+		return (t * cos(phi) + b * sin(phi)) * sinTheta + axis * cosTheta;
+	}
+
+	bool contains(const glm::vec3 &dir) const
+	{
+		return glm::dot(dir, axis) >= cosMax;
+	}
+};
+
+PhotonMap::PhotonMap() :
+	emitted(0),
+	k(50),
+	maxRadius(0.1f),
+	emitSeconds(0.0),
+	buildSeconds(0.0)
+{
+}
+
+PhotonMap::~PhotonMap()
+{
+}
+
+void PhotonMap::setGather(int k, float maxRadius)
+{
+	this->k = max(1, k);
+	this->maxRadius = maxRadius;
+}
+
+void PhotonMap::trace(Scene &scene, const vector<Light> &lights, int count, int depth, int threads)
+{
+	typedef chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	photons.clear();
+	emitted = 0;
+	emitSeconds = buildSeconds = 0.0;
+
+	// Caustics start at mirrors, so photons are only aimed at the bounding
+	// spheres of reflective shapes. Unbounded mirrors (planes) can't be
+	// aimed at and get none.
+	vector<glm::vec3> centers;
+	vector<float> radii;
+	for(Shape *shape : scene.getShapes()) {
+		AABB box;
+		if(shape->getColor().isReflective && shape->getBounds(box)) {
+			centers.push_back(0.5f * (box.min + box.max));
+			radii.push_back(0.5f * glm::length(box.max - box.min));
+		}
+	}
+	const int numTargets = (int)centers.size();
+	const int numLights = (int)lights.size();
+	if(numTargets == 0 || numLights == 0 || count <= 0) {
+		return;
+	}
+
+	// Each light gets photons in proportion to the power it sends toward
+	// the targets, and picks a target for each in proportion to its share
+	vector<float> pick(numLights * numTargets);
+	vector<double> lightWeight(numLights);
+	double total = 0.0;
+	for(int i = 0; i < numLights; i++) {
+		float sum = 0.0f;
+		for(int j = 0; j < numTargets; j++) {
+			pick[i * numTargets + j] = Cone(lights[i].position, centers[j], radii[j]).solidAngle;
+			sum += pick[i * numTargets + j];
+		}
+		for(int j = 0; j < numTargets; j++) {
+			pick[i * numTargets + j] /= sum;
+		}
+		lightWeight[i] = (double)sum * lights[i].intensity;
+		total += lightWeight[i];
+	}
+	vector<int> firstPhoton(numLights + 1, 0);
+	double cumulative = 0.0;
+	for(int i = 0; i < numLights; i++) {
+		cumulative += lightWeight[i];
+		firstPhoton[i + 1] = (int)llround(count * (cumulative / total));
+	}
+	firstPhoton[numLights] = count;
+
+	auto emit = [&](int g, vector<Photon> &out) {
+		int i = (int)(upper_bound(firstPhoton.begin(), firstPhoton.end(), g) - firstPhoton.begin()) - 1;
+		const Light &light = lights[i];
+		const int lightPhotons = firstPhoton[i + 1] - firstPhoton[i];
+
+		// A point on the light. Sphere lights emit from anywhere inside.
+		glm::vec3 origin = light.position;
+		if(light.type == Light::RECTANGLE) {
+			origin = light.samplePoint(origin, glm::vec2(uniform(g, 0), uniform(g, 1)));
+		} else if(light.type == Light::SPHERE) {
+			float z = 1.0f - 2.0f * uniform(g, 0);
+			float r = sqrt(max(0.0f, 1.0f - z * z));
+			float phi = 2.0f * PI * uniform(g, 1);
+			origin += glm::vec3(r * cos(phi), r * sin(phi), z) * (light.radius * cbrt(uniform(g, 2)));
+		}
+
+		// A direction in the cone of one target. Cones can overlap, so the
+		// density is that of picking the direction through any of them.
+		const float *p = &pick[i * numTargets];
+		float u = uniform(g, 3);
+		int target = 0;
+		while(target < numTargets - 1 && u >= p[target]) {
+			u -= p[target];
+			target++;
+		}
+		glm::vec3 dir = Cone(origin, centers[target], radii[target]).sample(uniform(g, 4), uniform(g, 5));
+		float pdf = 0.0f;
+		for(int j = 0; j < numTargets; j++) {
+			Cone cone(origin, centers[j], radii[j]);
+			if(cone.contains(dir)) {
+				pdf += p[j] / cone.solidAngle;
+			}
+		}
+		if(!(pdf > 0.0f)) {
+			return;
+		}
+		glm::vec3 power(light.intensity / (lightPhotons * pdf));
+
+		// Bounce off mirrors and stop at the first diffuse surface. Photons
+		// that reach it directly are the renderer's direct light.
+		bool bounced = false;
+		for(int bounce = 0; bounce <= depth; bounce++) {
+			Hit hit;
+			Material mat;
+			if(!scene.hit(origin, dir, hit, mat)) {
+				return;
+			}
+			if(!mat.isReflective) {
+				if(bounced) {
+					out.push_back({hit.x, power, dir, 0});
+				}
+				return;
+			}
+			dir = glm::reflect(dir, hit.n);
+			origin = hit.x + 0.001f * dir;
+			bounced = true;
+		}
+	};
+
+	// Each thread emits a contiguous range of photons and the ranges are
+	// joined in order
+	if(threads <= 0) {
+		threads = max(1, (int)thread::hardware_concurrency());
+	}
+	threads = min(threads, count);
+	vector<vector<Photon> > stored(threads);
+	int chunk = (count + threads - 1) / threads;
+	vector<thread> workers;
+	for(int t = 0; t < threads; t++) {
+		workers.emplace_back([&, t]() {
+			int end = min(count, (t + 1) * chunk);
+			for(int g = t * chunk; g < end; g++) {
+				emit(g, stored[t]);
+			}
+		});
+	}
+	for(thread &worker : workers) {
+		worker.join();
+	}
+	size_t numStored = 0;
+	for(const auto &s : stored) {
+		numStored += s.size();
+	}
+	photons.reserve(numStored);
+	for(auto &s : stored) {
+		photons.insert(photons.end(), s.begin(), s.end());
+		vector<Photon>().swap(s);
+	}
+	emitted = count;
+	Clock::time_point emitEnd = Clock::now();
+	emitSeconds = chrono::duration<double>(emitEnd - start).count();
+
+	build(0, (int)photons.size(), 0);
+	buildSeconds = chrono::duration<double>(Clock::now() - emitEnd).count();
+}
+
+void PhotonMap::build(int lo, int hi, int level)
+{
+	if(hi - lo <= 1) {
+		return;
+	}
+	glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+	for(int i = lo; i < hi; i++) {
+		bmin = glm::min(bmin, photons[i].position);
+		bmax = glm::max(bmax, photons[i].position);
+	}
+	glm::vec3 extent = bmax - bmin;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	int mid = (lo + hi) / 2;
+	nth_element(photons.begin() + lo, photons.begin() + mid, photons.begin() + hi,
+	            [axis](const Photon &a, const Photon &b) { return a.position[axis] < b.position[axis]; });
+	photons[mid].axis = axis;
+
+	// The halves don't overlap, so big ones can be built side by side
+	if(level < 3 && hi - lo > 65536) {
+		thread left([=]() { build(lo, mid, level + 1); });
+		build(mid + 1, hi, level + 1);
+		left.join();
+	} else {
+		build(lo, mid, level + 1);
+		build(mid + 1, hi, level + 1);
+	}
+}
+
+void PhotonMap::search(int lo, int hi, const glm::vec3 &x, vector<pair<float, int> > &heap, float &r2) const
+{
+	if(lo >= hi) {
+		return;
+	}
+	int mid = (lo + hi) / 2;
+	const Photon &photon = photons[mid];
+	glm::vec3 d = photon.position - x;
+	float d2 = glm::dot(d, d);
+	if(d2 < r2) {
+		if((int)heap.size() == k) {
+			pop_heap(heap.begin(), heap.end());
+			heap.pop_back();
+		}
+		heap.push_back(make_pair(d2, mid));
+		push_heap(heap.begin(), heap.end());
+		if((int)heap.size() == k) {
+			r2 = heap.front().first;
+		}
+	}
+
+	// Near half first, the far half only if the search sphere reaches it
+	float delta = x[photon.axis] - photon.position[photon.axis];
+	if(delta < 0.0f) {
+		search(lo, mid, x, heap, r2);
+		if(delta * delta < r2) {
+			search(mid + 1, hi, x, heap, r2);
+		}
+	} else {
+		search(mid + 1, hi, x, heap, r2);
+		if(delta * delta < r2) {
+			search(lo, mid, x, heap, r2);
+		}
+	}
+}
+
+glm::vec3 PhotonMap::irradiance(const glm::vec3 &x, const glm::vec3 &n) const
+{
+	if(photons.empty()) {
+		return glm::vec3(0.0f);
+	}
+	static thread_local vector<pair<float, int> > heap;
+	heap.clear();
+	float r2 = maxRadius * maxRadius;
+	search(0, (int)photons.size(), x, heap, r2);
+
+	// Photon power over the disk holding the k nearest (or over the whole
+	// search disk if there are fewer), counting only photons that arrive
+	// at the front of the surface
+	glm::vec3 power(0.0f);
+	for(const auto &neighbor : heap) {
+		const Photon &photon = photons[neighbor.second];
+		if(glm::dot(photon.dir, n) < 0.0f) {
+			power += photon.power;
+		}
+	}
+	return power / (PI * r2);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef PHOTONMAP_H
+#define PHOTONMAP_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+
+// Power arriving at a diffuse surface after one or more mirror bounces
+struct Photon
+{
+	glm::vec3 position;
+	glm::vec3 power;
+	glm::vec3 dir; // of travel
+	int axis;      // split axis of the kd-tree node this photon is
+};
+
+// Caustic photon map. trace() shoots photons from the lights toward the
+// reflective shapes of a scene and keeps those that land on a diffuse
+// surface after bouncing off mirrors; irradiance() estimates the light
+// they bring to a point from its k nearest photons.
+//
+// The photons are stored as a balanced kd-tree in one array: each node is
+// the median of its range along the range's widest axis, and its subtrees
+// are the halves on either side, so a lookup only walks memory that is
+// close together.
+//
+// Light intensities are radiant intensities here (power per steradian),
+// so caustics fall off with distance as they should even though the
+// direct lighting of the renderer doesn't.
+class PhotonMap
+{
+public:
+	PhotonMap();
+	virtual ~PhotonMap();
+
+	// Emits count photons in total, at most one stored per photon, so the
+	// map never takes more than count * sizeof(Photon) bytes. depth limits
+	// the mirror bounces. Emission runs on the given number of threads
+	// (every hardware thread for threads <= 0) and gives the same map for
+	// any thread count.
+	void trace(Scene &scene, const std::vector<Light> &lights, int count, int depth, int threads);
+
+	// Photons per estimate and the largest radius searched for them
+	void setGather(int k, float maxRadius);
+
+	// Irradiance at x on a surface with normal n
+	glm::vec3 irradiance(const glm::vec3 &x, const glm::vec3 &n) const;
+
+	size_t size() const { return photons.size(); }
+	size_t getEmitted() const { return emitted; }
+	size_t getMemory() const { return photons.capacity() * sizeof(Photon); }
+	double getEmitSeconds() const { return emitSeconds; }
+	double getBuildSeconds() const { return buildSeconds; }
+
+private:
+	// Makes photons[lo, hi) a kd-tree, the top levels in parallel
+	void build(int lo, int hi, int level);
+	// Adds the photons of photons[lo, hi) within sqrt(r2) of x to the max
+	// heap of the k nearest, shrinking r2 once there are k
+	void search(int lo, int hi, const glm::vec3 &x, std::vector<std::pair<float, int> > &heap, float &r2) const;
+
+	std::vector<Photon> photons;
+	size_t emitted;
+	int k;
+	float maxRadius;
+	double emitSeconds;
+	double buildSeconds;
+};
+
+#endif
@@ -37,6 +37,18 @@ public:
 
     Material getColor() override { return color; }
 
+    // Planar mapping through the plane's position, one texture repeat per
+    // unit of distance
+    bool getUV(const Hit& hit, glm::vec2& uv, glm::vec3& dpdu, glm::vec3& dpdv) override {
+        glm::vec3 n = glm::normalize(normal);
+        glm::vec3 helper = fabs(n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        dpdu = glm::normalize(glm::cross(helper, n));
+        dpdv = glm::cross(n, dpdu);
+        glm::vec3 d = hit.x - position;
+        uv = glm::vec2(glm::dot(d, dpdu), glm::dot(d, dpdv));
+        return true;
+    }
+
 private:
     glm::vec3 position;
     glm::vec3 normal;
@@ -0,0 +1,250 @@
+#include "PrimaryRaster.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "Stats.h"
+
+using namespace std;
+
+PrimaryRaster::PrimaryRaster(Scene &scene, const Camera &camera, int tileSize) :
+	camera(camera),
+	tileSize(tileSize)
+{
+	tilesX = (camera.getWidth() + tileSize - 1) / tileSize;
+	tilesY = (camera.getHeight() + tileSize - 1) / tileSize;
+	bins.resize(tilesX * tilesY);
+	build(scene);
+}
+
+PrimaryRaster::~PrimaryRaster()
+{
+}
+
+void PrimaryRaster::build(Scene &scene)
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+	Item everywhere;
+	everywhere.x0 = everywhere.y0 = 0;
+	everywhere.x1 = width - 1;
+	everywhere.y1 = height - 1;
+	everywhere.testEdges = false;
+	// Depth along the view direction is linear across a triangle or box
+	// and never more than the distance along a ray, so the least depth of
+	// the corners bounds the distance to any hit
+	everywhere.minDepth = FLT_MAX;
+
+	// Pixels whose centers fall in [lo, hi], pushed out by half a pixel.
+	// False if that misses the image.
+	auto cover = [&](const glm::vec2 &lo, const glm::vec2 &hi, Item &item) {
+		item.x0 = max(0, (int)ceil(lo.x - 0.5f));
+		item.y0 = max(0, (int)ceil(lo.y - 0.5f));
+		item.x1 = min(width - 1, (int)floor(hi.x + 0.5f));
+		item.y1 = min(height - 1, (int)floor(hi.y + 0.5f));
+		return item.x0 <= item.x1 && item.y0 <= item.y1;
+	};
+
+	for(Shape *shape : scene.getShapes()) {
+		AABB box;
+		if(!shape->getBounds(box)) {
+			unbounded.push_back(shape);
+			continue;
+		}
+
+		int numTriangles = shape->getTriangleCount();
+		if(numTriangles == 0) {
+			// Covered by the projection of its bounds, intersected whole
+			Item item = everywhere;
+			item.shape = shape;
+			item.triangle = -1;
+			glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+			int behind = 0;
+			for(int k = 0; k < 8; k++) {
+				glm::vec3 corner((k & 1) ? box.max.x : box.min.x, (k & 2) ? box.max.y : box.min.y, (k & 4) ? box.max.z : box.min.z);
+				float depth;
+				glm::vec2 p = camera.project(corner, depth);
+				if(depth <= 0.0f) {
+					behind++;
+				}
+				item.minDepth = min(item.minDepth, depth);
+				lo = glm::min(lo, p);
+				hi = glm::max(hi, p);
+			}
+			if(behind == 8) {
+				continue;
+			}
+			if(behind > 0 || cover(lo, hi, item)) {
+				addItem(item);
+			}
+			continue;
+		}
+
+		for(int i = 0; i < numTriangles; i++) {
+			glm::vec3 v[3];
+			shape->getTriangle(i, v);
+			Item item = everywhere;
+			item.shape = shape;
+			item.triangle = i;
+			glm::vec2 p[3];
+			int behind = 0;
+			for(int k = 0; k < 3; k++) {
+				float depth;
+				p[k] = camera.project(v[k], depth);
+				if(depth <= 0.0f) {
+					behind++;
+				}
+				item.minDepth = min(item.minDepth, depth);
+			}
+			if(behind == 3) {
+				continue;
+			}
+			if(behind > 0) {
+				// The projection wraps around, so it can't bound the pixels
+				addItem(item);
+				continue;
+			}
+			if(!cover(glm::min(glm::min(p[0], p[1]), p[2]), glm::max(glm::max(p[0], p[1]), p[2]), item)) {
+				continue;
+			}
+
+			// Edge functions facing inward, each pushed out by the most a
+			// half pixel can reach across it. Triangles seen edge on are
+			// left to their bounds.
+			float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+			if(fabs(area) > 1e-6f) {
+				float sign = area > 0.0f ? 1.0f : -1.0f;
+				for(int k = 0; k < 3; k++) {
+					const glm::vec2 &a = p[k];
+					const glm::vec2 &b = p[(k + 1) % 3];
+					float ea = -(b.y - a.y) * sign;
+					float eb = (b.x - a.x) * sign;
+					float ec = -(ea * a.x + eb * a.y) + 0.5f * (fabs(ea) + fabs(eb));
+					item.edges[k] = glm::vec3(ea, eb, ec);
+				}
+				item.testEdges = true;
+			}
+			addItem(item);
+		}
+	}
+
+	for(vector<int> &bin : bins) {
+		stable_sort(bin.begin(), bin.end(), [this](int a, int b) { return items[a].minDepth < items[b].minDepth; });
+	}
+}
+
+void PrimaryRaster::addItem(const Item &item)
+{
+	int index = (int)items.size();
+	items.push_back(item);
+	for(int ty = item.y0 / tileSize; ty <= item.y1 / tileSize; ty++) {
+		for(int tx = item.x0 / tileSize; tx <= item.x1 / tileSize; tx++) {
+			bins[ty * tilesX + tx].push_back(index);
+		}
+	}
+}
+
+void PrimaryRaster::hitTile(int x0, int y0, int x1, int y1, Hit *hits, PixelStats *pixelStats, int stride) const
+{
+	const glm::vec3 &origin = camera.getPosition();
+	const int cols = x1 - x0;
+	const int n = cols * (y1 - y0);
+	// The closest triangle of each pixel so far. Only its distance is
+	// known until the end, when its full hit is worked out.
+	struct Candidate
+	{
+		const Item *item;
+		float t;
+	};
+	static thread_local vector<glm::vec3> rays;
+	static thread_local vector<Candidate> candidates;
+	rays.resize(n);
+	candidates.assign(n, Candidate{nullptr, FLT_MAX});
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x1; x++) {
+			rays[(y - y0) * cols + (x - x0)] = camera.genRay(x, y);
+			hits[(y - y0) * stride + (x - x0)] = Hit();
+		}
+	}
+
+	// Same tie breaking as Scene::hit: a later shape only wins if it is
+	// strictly closer
+	auto testShape = [&](Shape *shape, int x, int y) {
+		stats::PixelScope scope(pixelStats[(y - y0) * stride + (x - x0)]);
+		Hit hit;
+		stats::countPrimitiveTest();
+		if(shape->intersect(origin, rays[(y - y0) * cols + (x - x0)], hit)) {
+			Hit &closest = hits[(y - y0) * stride + (x - x0)];
+			if(!closest.valid || closest.t > hit.t) {
+				closest = hit;
+				closest.shape = shape;
+			}
+		}
+	};
+
+	for(Shape *shape : unbounded) {
+		for(int y = y0; y < y1; y++) {
+			for(int x = x0; x < x1; x++) {
+				testShape(shape, x, y);
+			}
+		}
+	}
+
+	// Each bin covers its own part of the rectangle, so no pixel sees an
+	// item twice even when the rectangle straddles bins
+	for(int ty = y0 / tileSize; ty <= (y1 - 1) / tileSize; ty++) {
+		for(int tx = x0 / tileSize; tx <= (x1 - 1) / tileSize; tx++) {
+			int cx0 = max(x0, tx * tileSize);
+			int cy0 = max(y0, ty * tileSize);
+			int cx1 = min(x1, (tx + 1) * tileSize) - 1;
+			int cy1 = min(y1, (ty + 1) * tileSize) - 1;
+			for(int index : bins[ty * tilesX + tx]) {
+				const Item &item = items[index];
+				int ix0 = max(item.x0, cx0);
+				int iy0 = max(item.y0, cy0);
+				int ix1 = min(item.x1, cx1);
+				int iy1 = min(item.y1, cy1);
+				for(int y = iy0; y <= iy1; y++) {
+					for(int x = ix0; x <= ix1; x++) {
+						int i = (y - y0) * cols + (x - x0);
+						const Hit &closest = hits[(y - y0) * stride + (x - x0)];
+						if(item.minDepth >= candidates[i].t || (closest.valid && item.minDepth >= closest.t)) {
+							continue;
+						}
+						if(item.triangle < 0) {
+							testShape(item.shape, x, y);
+							continue;
+						}
+						if(item.testEdges) {
+							glm::vec3 p((float)x, (float)y, 1.0f);
+							if(glm::dot(item.edges[0], p) < 0.0f || glm::dot(item.edges[1], p) < 0.0f || glm::dot(item.edges[2], p) < 0.0f) {
+								continue;
+							}
+						}
+						stats::PixelScope scope(pixelStats[(y - y0) * stride + (x - x0)]);
+						float t;
+						if(item.shape->intersectTriangle(origin, rays[i], item.triangle, t) && t < candidates[i].t) {
+							candidates[i].item = &item;
+							candidates[i].t = t;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x1; x++) {
+			const Candidate &candidate = candidates[(y - y0) * cols + (x - x0)];
+			Hit &closest = hits[(y - y0) * stride + (x - x0)];
+			stats::PixelScope scope(pixelStats[(y - y0) * stride + (x - x0)]);
+			Hit hit;
+			if(candidate.item && (!closest.valid || closest.t > candidate.t) &&
+			   candidate.item->shape->intersectTriangle(origin, rays[(y - y0) * cols + (x - x0)], candidate.item->triangle, hit)) {
+				closest = hit;
+				closest.shape = candidate.item->shape;
+			}
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef PRIMARYRASTER_H
+#define PRIMARYRASTER_H
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "Camera.h"
+
+// Primary visibility by rasterization instead of tracing. build() projects
+// every mesh triangle and the bounds of every other bounded shape into the
+// camera's image once and bins them into tiles. hitTile() then finds the
+// closest hit of each pixel's primary ray by testing only the triangles and
+// shapes that cover the pixel, with no BVH traversal.
+//
+// Each tile's list is sorted front to back, so a pixel skips whatever
+// starts behind its closest hit so far.
+//
+// Coverage is conservative (edges are pushed out by half a pixel) and each
+// covering primitive is intersected exactly with the pixel's ray, so the
+// hits are those Scene::hit finds. Unbounded shapes (planes) are
+// intersected at every pixel.
+class PrimaryRaster
+{
+public:
+	PrimaryRaster(Scene &scene, const Camera &camera, int tileSize);
+	virtual ~PrimaryRaster();
+
+	const Camera &getCamera() const { return camera; }
+
+	// Closest hit along camera.genRay(x, y) from the camera position for
+	// every pixel of [x0, x1) x [y0, y1), stride hits per row. Misses are
+	// left invalid. hit.shape is set like Scene::hit does. The tests of each
+	// pixel are added to its entry of pixelStats, laid out like hits.
+	void hitTile(int x0, int y0, int x1, int y1, Hit *hits, PixelStats *pixelStats, int stride) const;
+
+private:
+	struct Item
+	{
+		Shape *shape;
+		int triangle;         // -1 to intersect the whole shape
+		int x0, y0, x1, y1;   // covered pixels, inclusive
+		glm::vec3 edges[3];   // a x + b y + c >= 0 inside, for triangles
+		bool testEdges;
+		float minDepth;       // no hit is closer to the camera than this
+	};
+
+	void build(Scene &scene);
+	void addItem(const Item &item);
+
+	const Camera &camera;
+	int tileSize;
+	int tilesX;
+	int tilesY;
+	std::vector<Item> items;
+	std::vector<std::vector<int> > bins;
+	std::vector<Shape*> unbounded;
+};
+
+#endif
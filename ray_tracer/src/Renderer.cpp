@@ -0,0 +1,918 @@
+#include "Renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "EnvironmentLight.h"
+#include "Texture.h"
+
+using namespace std;
+
+RayCounts &RayCounts::operator+=(const RayCounts &other)
+{
+	primary += other.primary;
+	shadow += other.shadow;
+	reflection += other.reflection;
+	gathers += other.gathers;
+	gatherNanos += other.gatherNanos;
+	return *this;
+}
+
+Renderer::Renderer(Scene &scene, const vector<Light> &lights, bool shadows, int depth) :
+	scene(scene),
+	lights(lights),
+	shadows(shadows),
+	depth(depth),
+	precision(FLOAT),
+	sortRays(false),
+	caustics(nullptr),
+	rasterPrimary(false),
+	stop(nullptr)
+{
+}
+
+Renderer::~Renderer()
+{
+}
+
+const vector<PixelStats> &Renderer::getPixelStats(int view) const
+{
+	static const vector<PixelStats> none;
+	return view < (int)pixelStats.size() ? pixelStats[view] : none;
+}
+
+int Renderer::defaultThreads()
+{
+	return max(1, (int)thread::hardware_concurrency());
+}
+
+glm::vec3 normalShader(const Hit &hit) {
+    // Convert the normal from [-1, 1] to [0, 1]
+    glm::vec3 color = hit.n * 0.5f + 0.5f;
+    return color;
+}
+
+// Diffuse and specular reflectance toward the eye at origin for light
+// arriving at point x from lightDir
+template<typename Real>
+static glm::vec<3, Real> blinnPhong(const Material &mat, const glm::vec<3, Real> &lightDir, const glm::vec<3, Real> &origin, const glm::vec<3, Real> &x, const glm::vec<3, Real> &n)
+{
+    typedef glm::vec<3, Real> Vec3;
+    // diffuse
+    Vec3 diffuse = Vec3(mat.diff) * max(Real(0), glm::dot(n, lightDir));
+    // specular
+    Vec3 viewDir = glm::normalize(origin - x);
+    Vec3 halfDir = glm::normalize(viewDir + lightDir);
+    Vec3 specular = Vec3(mat.spec) * pow(max(Real(0), glm::dot(n, halfDir)), Real(mat.exp));
+
+    return diffuse + specular;
+}
+
+// Hash of a pixel, the seed of its random numbers so that a pixel comes out
+// the same whichever thread and kernel renders it
+static uint32_t pixelSeed(int x, int y)
+{
+    return hashBits((uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u);
+}
+
+// Sample k of n in the unit square for a pixel: Hammersley points shifted
+// by a random offset per pixel, so the samples of a pixel are stratified
+// and neighbouring pixels don't repeat the same pattern
+static glm::vec2 stratifiedSample(uint32_t seed, int k, int n)
+{
+    glm::vec2 shift((seed >> 8) * 5.9604645e-8f, (pixelSeed((int)seed, 1) >> 8) * 5.9604645e-8f);
+    glm::vec2 u = glm::vec2((k + 0.5f) / n, radicalInverse(k)) + shift;
+    return glm::min(u - glm::floor(u), glm::vec2(0.99999994f));
+}
+
+// Last shape that blocked a shadow ray toward each light, and after the
+// lights toward the environment, on this thread. Cleared at the start of
+// every tile so no pointer outlives its scene.
+static thread_local vector<Shape*> lastOccluder;
+
+// Spreads the low 10 bits of v out to every third bit
+static uint32_t expandBits(uint32_t v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Sort key for a secondary ray. The top bits are the octant of the
+// direction, then the Morton code of the origin on a 1024^3 grid over the
+// scene bounds, then the direction quantized to 32 steps per axis. Sorting
+// by it bins the rays by octant and origin cell and orders every bin along
+// a space filling curve.
+static uint64_t rayKey(const glm::vec3 &origin, const glm::vec3 &dir, const AABB &bounds)
+{
+    glm::vec3 extent = bounds.max - bounds.min;
+    uint32_t cell[3], quantized[3];
+    uint64_t octant = 0;
+    for(int i = 0; i < 3; i++) {
+        float t = extent[i] > 0.0f ? (origin[i] - bounds.min[i]) / extent[i] : 0.0f;
+        cell[i] = (uint32_t)min(max(t, 0.0f) * 1024.0f, 1023.0f);
+        quantized[i] = (uint32_t)min(fabs(dir[i]) * 32.0f, 31.0f);
+        octant |= (uint64_t)(dir[i] < 0.0f) << i;
+    }
+    uint64_t originCode = expandBits(cell[0]) | (expandBits(cell[1]) << 1) | (expandBits(cell[2]) << 2);
+    uint64_t dirCode = expandBits(quantized[0]) | (expandBits(quantized[1]) << 1) | (expandBits(quantized[2]) << 2);
+    return (octant << 45) | (originCode << 15) | dirCode;
+}
+
+// Moves the differentials of a ray with unit direction ray from its origin
+// to the plane tangent to the surface at the hit
+static void transferDifferential(RayDifferential &diff, const glm::vec3 &ray, const Hit &hit)
+{
+    float dn = glm::dot(ray, hit.n);
+    if (fabs(dn) < 1e-6f) {
+        return;
+    }
+    glm::vec3 px = diff.dpdx + hit.t * diff.dddx;
+    glm::vec3 py = diff.dpdy + hit.t * diff.dddy;
+    diff.dpdx = px - ray * (glm::dot(px, hit.n) / dn);
+    diff.dpdy = py - ray * (glm::dot(py, hit.n) / dn);
+}
+
+// Mirrors the direction differentials of a ray reflected at a hit. The
+// change of the normal across the footprint is ignored, so curved mirrors
+// blur their reflection a little less than they should.
+static void reflectDifferential(RayDifferential &diff, const Hit &hit)
+{
+    diff.dddx = glm::reflect(diff.dddx, hit.n);
+    diff.dddy = glm::reflect(diff.dddy, hit.n);
+}
+
+glm::vec3 Renderer::textureColor(int texture, const Hit &hit, const RayDifferential &diff) const
+{
+    glm::vec2 uv;
+    glm::vec3 dpdu, dpdv;
+    if (!hit.shape || !hit.shape->getUV(hit, uv, dpdu, dpdv)) {
+        return glm::vec3(1.0f);
+    }
+
+    // dpdx = dudx * dpdu + dvdx * dpdv has more equations than unknowns;
+    // solve it on the two axes the surface is the least edge-on to
+    glm::vec3 an = glm::abs(hit.n);
+    int a = 0, b = 1;
+    if (an.x > an.y && an.x > an.z) {
+        a = 1;
+        b = 2;
+    } else if (an.y > an.z) {
+        b = 2;
+    }
+    glm::vec2 duvdx(0.0f), duvdy(0.0f);
+    float det = dpdu[a] * dpdv[b] - dpdv[a] * dpdu[b];
+    if (fabs(det) > 1e-12f) {
+        duvdx = glm::vec2(dpdv[b] * diff.dpdx[a] - dpdv[a] * diff.dpdx[b], dpdu[a] * diff.dpdx[b] - dpdu[b] * diff.dpdx[a]) / det;
+        duvdy = glm::vec2(dpdv[b] * diff.dpdy[a] - dpdv[a] * diff.dpdy[b], dpdu[a] * diff.dpdy[b] - dpdu[b] * diff.dpdy[a]) / det;
+    }
+    return scene.getTextures()[texture]->sample(uv, duvdx, duvdy);
+}
+
+bool Renderer::environmentSample(uint32_t seed, int k, const glm::vec3 &n, glm::vec3 &dir, glm::vec3 &weight) const
+{
+    const EnvironmentLight &environment = *scene.getEnvironment();
+    int samples = environment.getSamples();
+    glm::vec2 u = stratifiedSample(seed, k, samples);
+
+    glm::vec3 radiance;
+    float pdf;
+    if (!environment.sample(u, dir, radiance, pdf) || glm::dot(dir, n) <= 0.0f || !(pdf > 0.0f)) {
+        return false;
+    }
+    // Monte Carlo estimate of the light over the hemisphere. The 1 / pi
+    // makes a white environment of radiance 1 light a surface as much as
+    // a point light of intensity 1 straight above it.
+    weight = radiance / (pdf * samples * PI);
+    return true;
+}
+
+glm::vec3 Renderer::lightPoint(int i, uint32_t seed, int k, const glm::vec3 &x) const
+{
+    const Light &light = lights[i];
+    if (light.type == Light::POINT) {
+        return light.position;
+    }
+    // Each light gets its own pattern
+    return light.samplePoint(x, stratifiedSample(pixelSeed((int)seed, i + 2), k, light.samples));
+}
+
+bool Renderer::shadowed(int slot, const glm::vec3 &origin, const glm::vec3 &dir, float tmax) const
+{
+    return scene.occluded(origin, dir, tmax, lastOccluder[slot]);
+}
+
+glm::vec3 Renderer::causticIrradiance(const glm::vec3 &x, const glm::vec3 &n, RayCounts &counts) const
+{
+    typedef chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    glm::vec3 irradiance = caustics->irradiance(x, n);
+    counts.gathers++;
+    counts.gatherNanos += (uint64_t)chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+    return irradiance;
+}
+
+template<typename Real, typename F>
+glm::vec<3, Real> Renderer::shade(const Material &mat, const glm::vec<3, Real> &origin, const glm::vec<3, Real> &ray, const Hit &hit, const RayDifferential &diff, uint32_t seed, int recursionDepth, RayCounts &counts) {
+    typedef glm::vec<3, Real> Vec3;
+    const Vec3 x(hit.x);
+    const Vec3 n(hit.n);
+
+    RayDifferential atHit = diff;
+    if (F::textures) {
+        transferDifferential(atHit, glm::vec3(ray), hit);
+    }
+
+    if (mat.isReflective) {
+        if(!F::reflections || recursionDepth == 0){
+            return Vec3(Real(0));
+        }else{
+            Vec3 color = Vec3(Real(0));
+            Vec3 reflectDir = glm::reflect(ray, n);
+
+            Hit reflectHit;
+            Material reflectMat;
+            counts.reflection++;
+            stats::countRay(RAY_REFLECTION);
+            bool reflectRayHit = scene.hit(glm::vec3(x + Real(0.001) * reflectDir), glm::vec3(reflectDir), reflectHit, reflectMat);
+
+            if (reflectRayHit) {
+                if (F::textures) {
+                    reflectDifferential(atHit, hit);
+                }
+                return shade<Real, F>(reflectMat, x, reflectDir, reflectHit, atHit, seed, recursionDepth - 1, counts);
+            }else if (scene.getEnvironment()) {
+                return Vec3(scene.getEnvironment()->eval(glm::vec3(reflectDir)));
+            }else{
+                return color;
+            }
+        }
+    }
+
+    stats::countShade();
+    Vec3 color = Vec3(mat.amb);
+
+    // Textures scale the diffuse color
+    Material surface = mat;
+    if (F::textures && mat.texture >= 0) {
+        surface.diff *= textureColor(mat.texture, hit, atHit);
+    }
+
+    // A constant trip count lets the compiler unroll the light loop
+    const int numLights = F::lights > 0 ? F::lights : (int)lights.size();
+    for (int i = 0; i < numLights; i++) {
+        const Light &light = lights[i];
+        const Real intensity = Real(light.intensity / light.samples);
+        for (int k = 0; k < light.samples; k++) {
+            const Vec3 lightPos(lightPoint(i, seed, k, glm::vec3(x)));
+            const Vec3 lightDir = glm::normalize(lightPos - x);
+
+            if(F::shadows){
+                counts.shadow++;
+                stats::countRay(RAY_SHADOW);
+                if(shadowed(i, glm::vec3(x + Real(0.001) * n), glm::vec3(lightDir), (float)glm::length(lightPos - x))){
+                    continue;
+                }
+            }
+
+            color += blinnPhong(surface, lightDir, origin, x, n) * intensity;
+        }
+    }
+
+    if (scene.getEnvironment()) {
+        const int samples = scene.getEnvironment()->getSamples();
+        for (int k = 0; k < samples; k++) {
+            glm::vec3 dir, weight;
+            if (!environmentSample(seed, k, glm::vec3(n), dir, weight)) {
+                continue;
+            }
+            if (F::shadows) {
+                counts.shadow++;
+                stats::countRay(RAY_SHADOW);
+                if (shadowed(numLights, glm::vec3(x + Real(0.001) * n), dir, FLT_MAX)) {
+                    continue;
+                }
+            }
+            color += blinnPhong(surface, Vec3(dir), origin, x, n) * Vec3(weight);
+        }
+    }
+
+    if (caustics) {
+        color += Vec3(surface.diff * causticIrradiance(glm::vec3(x), glm::vec3(n), counts));
+    }
+
+    return color;
+}
+
+template<typename Real, typename F>
+void Renderer::renderTile(const Camera &camera, int x0, int y0, int x1, int y1, int stride, float *rgb, PixelStats *tileStats, RayCounts &counts)
+{
+	typedef glm::vec<3, Real> Vec3;
+	const glm::vec3 &camPos = camera.getPosition();
+	lastOccluder.assign(lights.size() + 1, nullptr);
+	const PrimaryRaster *raster = rasterFor(camera);
+	static thread_local vector<Hit> primaryHits;
+#ifdef RT_STATS
+	for(int y = y0; y < y1; y++) {
+		fill(tileStats + (y - y0) * stride, tileStats + (y - y0) * stride + (x1 - x0), PixelStats());
+	}
+#endif
+	if(raster) {
+		primaryHits.resize(stride * (y1 - y0));
+		raster->hitTile(x0, y0, x1, y1, primaryHits.data(), tileStats, stride);
+	}
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x1; x++) {
+			float *pixel = &rgb[((y - y0) * stride + (x - x0)) * 3];
+			// Adds to what the raster pass counted for the pixel
+			stats::PixelScope scope(tileStats[(y - y0) * stride + (x - x0)]);
+			glm::vec3 ray = camera.genRay(x, y);
+			Hit hit;
+			Material hitMaterial;
+			RayDifferential diff;
+			if(F::textures) {
+				camera.genRayDifferential(x, y, diff.dddx, diff.dddy);
+			}
+			// A rasterized primary ray is not traced but is still the pixel's
+			// first ray, and the raster pass tested primitives for it
+			stats::countRay(RAY_PRIMARY);
+			bool primaryHit;
+			if(raster) {
+				hit = primaryHits[(y - y0) * stride + (x - x0)];
+				primaryHit = hit.valid;
+				if(primaryHit) {
+					hitMaterial = hit.shape->getColor();
+				}
+			} else {
+				counts.primary++;
+				primaryHit = scene.hit(camPos, ray, hit, hitMaterial);
+			}
+			if(primaryHit) {
+				Vec3 color = shade<Real, F>(hitMaterial, Vec3(camPos), Vec3(ray), hit, diff, pixelSeed(x, y), depth, counts);
+				// glm::vec3 color = normalShader(hit);
+				pixel[0] = (float)color.r;
+				pixel[1] = (float)color.g;
+				pixel[2] = (float)color.b;
+			} else if(scene.getEnvironment()) {
+				glm::vec3 color = scene.getEnvironment()->eval(ray);
+				pixel[0] = color.r;
+				pixel[1] = color.g;
+				pixel[2] = color.b;
+			} else {
+				pixel[0] = pixel[1] = pixel[2] = 0.0f;
+			}
+		}
+	}
+}
+
+template<typename Real, typename F>
+void Renderer::renderTileSorted(const Camera &camera, int x0, int y0, int x1, int y1, int stride, float *rgb, PixelStats *tileStats, RayCounts &counts)
+{
+	typedef glm::vec<3, Real> Vec3;
+	struct Path
+	{
+		Vec3 origin; // where the last segment started
+		Vec3 ray;
+		Hit hit;
+		Material mat;
+		RayDifferential diff; // at the start of the last segment
+		bool alive;
+	};
+	struct QueuedRay
+	{
+		uint64_t key;
+		int path;
+		int light; // numLights for the environment
+		int ray;   // of the path's shadow rays
+		glm::vec3 origin;
+		glm::vec3 dir;
+		float tmax;
+		bool operator<(const QueuedRay &other) const { return key < other.key; }
+	};
+	// Reused from wavefront to wavefront
+	static thread_local vector<Path> paths;
+	static thread_local vector<QueuedRay> queue;
+	static thread_local vector<unsigned char> visible;
+	static thread_local vector<int> firstRay;
+
+	const int cols = x1 - x0;
+	const int n = cols * (y1 - y0);
+	const int numLights = F::lights > 0 ? F::lights : (int)lights.size();
+	auto tileIndex = [&](int p) { return (p / cols) * stride + p % cols; };
+	paths.resize(n);
+	lastOccluder.assign(lights.size() + 1, nullptr);
+
+	// Primary rays are coherent already and go in pixel order
+	const glm::vec3 &camPos = camera.getPosition();
+	const PrimaryRaster *raster = rasterFor(camera);
+	static thread_local vector<Hit> primaryHits;
+#ifdef RT_STATS
+	for(int p = 0; p < n; p++) {
+		tileStats[tileIndex(p)] = PixelStats();
+	}
+#endif
+	if(raster) {
+		primaryHits.resize(stride * (y1 - y0));
+		raster->hitTile(x0, y0, x1, y1, primaryHits.data(), tileStats, stride);
+	}
+	for(int p = 0; p < n; p++) {
+		Path &path = paths[p];
+		stats::PixelScope scope(tileStats[tileIndex(p)]);
+		glm::vec3 ray = camera.genRay(x0 + p % cols, y0 + p / cols);
+		stats::countRay(RAY_PRIMARY);
+		if(raster) {
+			path.hit = primaryHits[tileIndex(p)];
+			path.alive = path.hit.valid;
+			if(path.alive) {
+				path.mat = path.hit.shape->getColor();
+			}
+		} else {
+			counts.primary++;
+			path.hit = Hit();
+			path.alive = scene.hit(camPos, ray, path.hit, path.mat);
+		}
+		path.origin = Vec3(camPos);
+		path.ray = Vec3(ray);
+		path.diff = RayDifferential();
+		if(F::textures) {
+			camera.genRayDifferential(x0 + p % cols, y0 + p / cols, path.diff.dddx, path.diff.dddy);
+		}
+	}
+
+	// All reflection rays of one bounce are queued, sorted and traced
+	// together
+	for(int d = depth; F::reflections && d > 0; d--) {
+		queue.clear();
+		for(int p = 0; p < n; p++) {
+			const Path &path = paths[p];
+			if(path.alive && path.mat.isReflective) {
+				Vec3 reflectDir = glm::reflect(path.ray, Vec3(path.hit.n));
+				glm::vec3 origin(Vec3(path.hit.x) + Real(0.001) * reflectDir);
+				glm::vec3 dir(reflectDir);
+				queue.push_back({rayKey(origin, dir, sceneBounds), p, 0, 0, origin, dir, FLT_MAX});
+			}
+		}
+		if(queue.empty()) {
+			break;
+		}
+		sort(queue.begin(), queue.end());
+		for(const QueuedRay &q : queue) {
+			Path &path = paths[q.path];
+			stats::PixelScope scope(tileStats[tileIndex(q.path)]);
+			counts.reflection++;
+			stats::countRay(RAY_REFLECTION);
+			Hit reflectHit;
+			Material reflectMat;
+			if(scene.hit(q.origin, q.dir, reflectHit, reflectMat)) {
+				if(F::textures) {
+					transferDifferential(path.diff, glm::vec3(path.ray), path.hit);
+					reflectDifferential(path.diff, path.hit);
+				}
+				path.ray = glm::reflect(path.ray, Vec3(path.hit.n));
+				path.origin = Vec3(path.hit.x);
+				path.hit = reflectHit;
+				path.mat = reflectMat;
+			} else {
+				// Keeps the direction for the environment lookup
+				path.ray = glm::reflect(path.ray, Vec3(path.hit.n));
+				path.alive = false;
+			}
+		}
+	}
+
+	// Shadow rays toward every sample of every light and every environment
+	// sample, sorted the same way. The rays of light i start at
+	// firstRay[i] and the environment's at firstRay[numLights].
+	const EnvironmentLight *environment = scene.getEnvironment();
+	const int numSamples = environment ? environment->getSamples() : 0;
+	firstRay.resize(numLights + 1);
+	int numRays = 0;
+	for(int i = 0; i < numLights; i++) {
+		firstRay[i] = numRays;
+		numRays += lights[i].samples;
+	}
+	firstRay[numLights] = numRays;
+	numRays += numSamples;
+	auto seedOf = [&](int p) { return pixelSeed(x0 + p % cols, y0 + p / cols); };
+	visible.assign(n * numRays, 1);
+	if(F::shadows) {
+		queue.clear();
+		for(int p = 0; p < n; p++) {
+			const Path &path = paths[p];
+			if(!path.alive || path.mat.isReflective) {
+				continue;
+			}
+			const Vec3 x(path.hit.x);
+			const Vec3 normal(path.hit.n);
+			glm::vec3 origin(x + Real(0.001) * normal);
+			for(int i = 0; i < numLights; i++) {
+				for(int k = 0; k < lights[i].samples; k++) {
+					const Vec3 lightPos(lightPoint(i, seedOf(p), k, glm::vec3(x)));
+					glm::vec3 dir(glm::normalize(lightPos - x));
+					float tmax = (float)glm::length(lightPos - x);
+					queue.push_back({rayKey(origin, dir, sceneBounds), p, i, firstRay[i] + k, origin, dir, tmax});
+				}
+			}
+			for(int k = 0; k < numSamples; k++) {
+				glm::vec3 dir, weight;
+				if(environmentSample(seedOf(p), k, glm::vec3(normal), dir, weight)) {
+					queue.push_back({rayKey(origin, dir, sceneBounds), p, numLights, firstRay[numLights] + k, origin, dir, FLT_MAX});
+				}
+			}
+		}
+		sort(queue.begin(), queue.end());
+		for(const QueuedRay &q : queue) {
+			stats::PixelScope scope(tileStats[tileIndex(q.path)]);
+			counts.shadow++;
+			stats::countRay(RAY_SHADOW);
+			if(shadowed(q.light, q.origin, q.dir, q.tmax)) {
+				visible[q.path * numRays + q.ray] = 0;
+			}
+		}
+	}
+
+	for(int p = 0; p < n; p++) {
+		const Path &path = paths[p];
+		float *pixel = &rgb[tileIndex(p) * 3];
+		// Paths that left the scene see the environment, paths still on a
+		// mirror ran out of bounces
+		if(!path.alive && environment) {
+			glm::vec3 color = environment->eval(glm::vec3(path.ray));
+			pixel[0] = color.r;
+			pixel[1] = color.g;
+			pixel[2] = color.b;
+			continue;
+		}
+		if(!path.alive || path.mat.isReflective) {
+			pixel[0] = pixel[1] = pixel[2] = 0.0f;
+			continue;
+		}
+		stats::PixelScope scope(tileStats[tileIndex(p)]);
+		stats::countShade();
+		const Vec3 x(path.hit.x);
+		const Vec3 normal(path.hit.n);
+		Vec3 color = Vec3(path.mat.amb);
+		Material surface = path.mat;
+		if(F::textures && path.mat.texture >= 0) {
+			RayDifferential atHit = path.diff;
+			transferDifferential(atHit, glm::vec3(path.ray), path.hit);
+			surface.diff *= textureColor(path.mat.texture, path.hit, atHit);
+		}
+		for(int i = 0; i < numLights; i++) {
+			const Real intensity = Real(lights[i].intensity / lights[i].samples);
+			for(int k = 0; k < lights[i].samples; k++) {
+				if(visible[p * numRays + firstRay[i] + k]) {
+					const Vec3 lightPos(lightPoint(i, seedOf(p), k, glm::vec3(x)));
+					color += blinnPhong(surface, Vec3(glm::normalize(lightPos - x)), path.origin, x, normal) * intensity;
+				}
+			}
+		}
+		for(int k = 0; k < numSamples; k++) {
+			glm::vec3 dir, weight;
+			if(visible[p * numRays + firstRay[numLights] + k] && environmentSample(seedOf(p), k, glm::vec3(normal), dir, weight)) {
+				color += blinnPhong(surface, Vec3(dir), path.origin, x, normal) * Vec3(weight);
+			}
+		}
+		if(caustics) {
+			color += Vec3(surface.diff * causticIrradiance(glm::vec3(x), glm::vec3(normal), counts));
+		}
+		pixel[0] = (float)color.r;
+		pixel[1] = (float)color.g;
+		pixel[2] = (float)color.b;
+	}
+}
+
+template<typename Real, typename F>
+Renderer::TileKernel Renderer::kernelFor() const
+{
+	if(sortRays) {
+		return &Renderer::renderTileSorted<Real, F>;
+	}
+	return &Renderer::renderTile<Real, F>;
+}
+
+template<typename Real, bool SHADOWS, bool REFLECTIONS, bool TEXTURES>
+Renderer::TileKernel Renderer::selectKernel() const
+{
+	switch(lights.size()) {
+	case 1: return kernelFor<Real, Features<SHADOWS, REFLECTIONS, 1, TEXTURES> >();
+	case 2: return kernelFor<Real, Features<SHADOWS, REFLECTIONS, 2, TEXTURES> >();
+	case 3: return kernelFor<Real, Features<SHADOWS, REFLECTIONS, 3, TEXTURES> >();
+	case 4: return kernelFor<Real, Features<SHADOWS, REFLECTIONS, 4, TEXTURES> >();
+	default: return kernelFor<Real, Features<SHADOWS, REFLECTIONS, 0, TEXTURES> >();
+	}
+}
+
+template<typename Real>
+Renderer::TileKernel Renderer::selectKernel(bool reflections, bool textures) const
+{
+	if(shadows) {
+		if(reflections) {
+			return textures ? selectKernel<Real, true, true, true>() : selectKernel<Real, true, true, false>();
+		}
+		return textures ? selectKernel<Real, true, false, true>() : selectKernel<Real, true, false, false>();
+	}
+	if(reflections) {
+		return textures ? selectKernel<Real, false, true, true>() : selectKernel<Real, false, true, false>();
+	}
+	return textures ? selectKernel<Real, false, false, true>() : selectKernel<Real, false, false, false>();
+}
+
+Renderer::TileKernel Renderer::selectKernel()
+{
+	// Sorted secondary rays are binned over the scene bounds
+	if(!scene.getBounds(sceneBounds)) {
+		sceneBounds = AABB();
+		sceneBounds.grow(glm::vec3(-1.0f));
+		sceneBounds.grow(glm::vec3(1.0f));
+	}
+
+	// Reflections are only traced when some material is a mirror and the
+	// depth allows at least one bounce. Differentials are only carried when
+	// some material has a texture.
+	bool reflections = false;
+	bool textures = false;
+	for(Shape *shape : scene.getShapes()) {
+		Material mat = shape->getColor();
+		reflections = reflections || (depth > 0 && mat.isReflective);
+		textures = textures || (mat.texture >= 0 && mat.texture < (int)scene.getTextures().size());
+	}
+
+	if(precision == DOUBLE) {
+		return selectKernel<double>(reflections, textures);
+	}
+	return selectKernel<float>(reflections, textures);
+}
+
+void Renderer::runTiles(int numTiles, int threads, const function<void(int, RayCounts &)> &task)
+{
+	if(threads <= 0) {
+		threads = defaultThreads();
+	}
+	threads = min(threads, max(1, numTiles));
+
+	// Workers take the next task from a shared counter and keep their own
+	// ray counts, merged once at the end
+	rayCounts = RayCounts();
+	atomic<int> nextTile(0);
+	mutex countsMutex;
+	auto worker = [&]() {
+		RayCounts counts;
+		for(int tile = nextTile++; tile < numTiles && !(stop && *stop); tile = nextTile++) {
+			task(tile, counts);
+		}
+		lock_guard<mutex> lock(countsMutex);
+		rayCounts += counts;
+	};
+
+	vector<thread> workers;
+	for(int i = 1; i < threads; i++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for(thread &t : workers) {
+		t.join();
+	}
+}
+
+void Renderer::buildRasters(const vector<const Camera*> &cameras)
+{
+	rasters.clear();
+	if(rasterPrimary) {
+		for(const Camera *camera : cameras) {
+			rasters.emplace_back(new PrimaryRaster(scene, *camera, TILE_SIZE));
+		}
+	}
+}
+
+const PrimaryRaster *Renderer::rasterFor(const Camera &camera) const
+{
+	for(const auto &raster : rasters) {
+		if(&raster->getCamera() == &camera) {
+			return raster.get();
+		}
+	}
+	return nullptr;
+}
+
+void Renderer::render(const Camera &camera, Image &image, int threads)
+{
+	int width = camera.getWidth();
+	int height = camera.getHeight();
+	int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	resetPixelStats(0, width, height);
+	buildRasters(vector<const Camera*>(1, &camera));
+	TileKernel kernel = selectKernel();
+	const int stride = tilesPerTask() * TILE_SIZE;
+	int tasksX = (width + stride - 1) / stride;
+	runTiles(tasksX * tilesY, threads, [&](int task, RayCounts &counts) {
+		vector<float> rgb(stride * TILE_SIZE * 3);
+		vector<PixelStats> tileStats(stride * TILE_SIZE);
+		int x0 = (task % tasksX) * stride;
+		int y0 = (task / tasksX) * TILE_SIZE;
+		int x1 = min(x0 + stride, width);
+		int y1 = min(y0 + TILE_SIZE, height);
+		(this->*kernel)(camera, x0, y0, x1, y1, stride, rgb.data(), tileStats.data(), counts);
+		for(int y = y0; y < y1; y++) {
+			for(int x = x0; x < x1; x++) {
+				const float *pixel = &rgb[((y - y0) * stride + (x - x0)) * 3];
+				image.setPixel(x, y, toByte(pixel[0]), toByte(pixel[1]), toByte(pixel[2]));
+			}
+		}
+		storePixelStats(0, x0, y0, x1, y1, stride, tileStats.data());
+	});
+}
+
+void Renderer::resetPixelStats(int view, int width, int height)
+{
+#ifdef RT_STATS
+	if(view == 0) {
+		pixelStats.clear();
+		pixelStatsWidth.clear();
+	}
+	pixelStats.emplace_back(width * height, PixelStats());
+	pixelStatsWidth.push_back(width);
+#endif
+}
+
+void Renderer::storePixelStats(int view, int x0, int y0, int x1, int y1, int stride, const PixelStats *tileStats)
+{
+#ifdef RT_STATS
+	int width = pixelStatsWidth[view];
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x1; x++) {
+			pixelStats[view][y * width + x] = tileStats[(y - y0) * stride + (x - x0)];
+		}
+	}
+#endif
+}
+
+bool Renderer::render(const Camera &camera, ImageWriter &writer, int threads, Checkpoint *checkpoint)
+{
+	vector<View> views(1);
+	views[0].camera = &camera;
+	views[0].writer = &writer;
+	views[0].checkpoint = checkpoint;
+	return render(views, threads);
+}
+
+bool Renderer::render(const vector<View> &views, int threads)
+{
+	for(const View &view : views) {
+		if(view.writer->getBandHeight() != TILE_SIZE) {
+			cerr << "Image bands must be " << TILE_SIZE << " rows high" << endl;
+			return false;
+		}
+	}
+	if(threads <= 0) {
+		threads = defaultThreads();
+	}
+	// A thread only starts a band of a view once all but the last maxBands
+	// bands of that view are written, which bounds the memory held by
+	// unfinished bands
+	int maxBands = 2 * threads;
+
+	struct Band
+	{
+		vector<float> rgb;
+		int tilesLeft = 0;
+	};
+	struct ViewState
+	{
+		int tilesX = 0;
+		vector<unique_ptr<Band> > bands;
+	};
+	vector<ViewState> state(views.size());
+
+	// The views' tiles share one queue. Taking band 0 of every view, then
+	// band 1 and so on keeps every thread busy until the last view is done
+	// while each view still fills its file front to back. Each entry is up
+	// to tilesPerTask() tiles of a band.
+	struct TileRef
+	{
+		int view;
+		int tile;  // the first
+		int count;
+	};
+	vector<TileRef> order;
+	const int group = tilesPerTask();
+	int maxBandCount = 0;
+	for(size_t v = 0; v < views.size(); v++) {
+		state[v].tilesX = (views[v].camera->getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+		state[v].bands.resize(views[v].writer->getBandCount());
+		maxBandCount = max(maxBandCount, views[v].writer->getBandCount());
+	}
+	for(int b = 0; b < maxBandCount; b++) {
+		for(size_t v = 0; v < views.size(); v++) {
+			if(b < (int)state[v].bands.size()) {
+				for(int tx = 0; tx < state[v].tilesX; tx += group) {
+					order.push_back({(int)v, b * state[v].tilesX + tx, min(group, state[v].tilesX - tx)});
+				}
+			}
+		}
+	}
+	mutex bandsMutex;
+
+	for(size_t v = 0; v < views.size(); v++) {
+		resetPixelStats((int)v, views[v].camera->getWidth(), views[v].camera->getHeight());
+	}
+	vector<const Camera*> cameras;
+	for(const View &view : views) {
+		cameras.push_back(view.camera);
+	}
+	buildRasters(cameras);
+	TileKernel kernel = selectKernel();
+	runTiles((int)order.size(), threads, [&](int i, RayCounts &counts) {
+		const View &view = views[order[i].view];
+		ViewState &vs = state[order[i].view];
+		ImageWriter &writer = *view.writer;
+		int tile = order[i].tile;
+		int count = order[i].count;
+		int width = view.camera->getWidth();
+		int height = view.camera->getHeight();
+		int b = tile / vs.tilesX;
+		writer.waitForBands(b - maxBands + 1);
+		Band *band;
+		{
+			lock_guard<mutex> lock(bandsMutex);
+			if(!vs.bands[b]) {
+				vs.bands[b].reset(new Band());
+				vs.bands[b]->rgb.resize(width * writer.getBandRows(b) * 3);
+				vs.bands[b]->tilesLeft = vs.tilesX;
+			}
+			band = vs.bands[b].get();
+		}
+
+		// Band rows are in file order, which runs from the top of the image
+		// down unless the format stores the bottom row first
+		int rows = writer.getBandRows(b);
+		int first = b * TILE_SIZE;
+		int y0 = writer.bottomUp() ? first : height - first - rows;
+		int x0 = (tile % vs.tilesX) * TILE_SIZE;
+		int x1 = min(x0 + count * TILE_SIZE, width);
+		const int stride = count * TILE_SIZE;
+		vector<float> rgb(stride * TILE_SIZE * 3);
+		vector<PixelStats> tileStats(stride * TILE_SIZE);
+		// The checkpoint stores each tile on its own, TILE_SIZE pixels per row
+		float tileRgb[TILE_SIZE * TILE_SIZE * 3];
+		auto copyTile = [&](int k, float *to, int toStride, const float *from, int fromStride) {
+			int cols = min(x1, x0 + (k + 1) * TILE_SIZE) - (x0 + k * TILE_SIZE);
+			for(int r = 0; r < rows; r++) {
+				memcpy(&to[r * toStride * 3], &from[r * fromStride * 3], cols * 3 * sizeof(float));
+			}
+		};
+		bool done = view.checkpoint != nullptr;
+		for(int k = 0; k < count; k++) {
+			done = done && view.checkpoint->isDone(tile + k);
+		}
+		if(done) {
+			for(int k = 0; k < count; k++) {
+				view.checkpoint->getTile(tile + k, tileRgb);
+				copyTile(k, &rgb[k * TILE_SIZE * 3], stride, tileRgb, TILE_SIZE);
+			}
+		} else {
+			(this->*kernel)(*view.camera, x0, y0, x1, y0 + rows, stride, rgb.data(), tileStats.data(), counts);
+			storePixelStats(order[i].view, x0, y0, x1, y0 + rows, stride, tileStats.data());
+			for(int k = 0; view.checkpoint && k < count; k++) {
+				if(!view.checkpoint->isDone(tile + k)) {
+					copyTile(k, tileRgb, TILE_SIZE, &rgb[k * TILE_SIZE * 3], stride);
+					view.checkpoint->record(tile + k, tileRgb);
+				}
+			}
+		}
+		for(int r = 0; r < rows; r++) {
+			int y = writer.bottomUp() ? r : rows - 1 - r;
+			memcpy(&band->rgb[(r * width + x0) * 3], &rgb[y * stride * 3], (x1 - x0) * 3 * sizeof(float));
+		}
+
+		bool finished;
+		{
+			lock_guard<mutex> lock(bandsMutex);
+			band->tilesLeft -= count;
+			finished = band->tilesLeft == 0;
+		}
+		if(finished) {
+			writer.writeBand(b, band->rgb.data());
+			lock_guard<mutex> lock(bandsMutex);
+			vs.bands[b].reset();
+		}
+	});
+	if(stop && *stop) {
+		return false;
+	}
+	bool ok = true;
+	for(const View &view : views) {
+		ok = view.writer->close() && ok;
+	}
+	return ok;
+}
@@ -0,0 +1,206 @@
+#pragma once
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "Camera.h"
+#include "Checkpoint.h"
+#include "Image.h"
+#include "ImageWriter.h"
+#include "PhotonMap.h"
+#include "PrimaryRaster.h"
+#include "Stats.h"
+
+// Number of rays of each kind traced during a render
+struct RayCounts
+{
+	uint64_t primary = 0;
+	uint64_t shadow = 0;
+	uint64_t reflection = 0;
+	// Caustic photon lookups and the nanoseconds spent in them, summed
+	// over the threads
+	uint64_t gathers = 0;
+	uint64_t gatherNanos = 0;
+
+	uint64_t total() const { return primary + shadow + reflection; }
+	RayCounts &operator+=(const RayCounts &other);
+};
+
+// Offsets of a ray's origin and direction to the rays through the next
+// pixel in x and y, used to size the texture footprint at a hit
+struct RayDifferential
+{
+	glm::vec3 dpdx = glm::vec3(0.0f);
+	glm::vec3 dpdy = glm::vec3(0.0f);
+	glm::vec3 dddx = glm::vec3(0.0f);
+	glm::vec3 dddy = glm::vec3(0.0f);
+};
+
+// Shading features fixed at compile time. LIGHTS is the exact light count
+// for 1 to MAX_UNROLLED_LIGHTS lights and 0 for any other count. TEXTURES
+// carries ray differentials along the paths for filtered texture lookups.
+template<bool SHADOWS, bool REFLECTIONS, int LIGHTS, bool TEXTURES>
+struct Features
+{
+	static const bool shadows = SHADOWS;
+	static const bool reflections = REFLECTIONS;
+	static const int lights = LIGHTS;
+	static const bool textures = TEXTURES;
+};
+
+// Whitted-style renderer: Blinn-Phong shading with optional shadows,
+// mirror reflections and diffuse textures, lit by point lights, rectangle
+// and sphere area lights with soft shadows, and an optional environment
+// light that also fills the background. Caustics come from an optional
+// photon map.
+//
+// The pixel kernel is a template on the Features and on the Real type used
+// for shading. render() picks the instantiation matching the scene once, so
+// the per-pixel code has no branches for features the scene doesn't use.
+// Intersection tests keep the precision of each Shape.
+class Renderer
+{
+public:
+	enum Precision { FLOAT, DOUBLE };
+
+	Renderer(Scene &scene, const std::vector<Light> &lights, bool shadows, int depth);
+	virtual ~Renderer();
+
+	// Type used for shading math, FLOAT by default
+	void setPrecision(Precision precision) { this->precision = precision; }
+	Precision getPrecision() const { return precision; }
+
+	// Traces SORT_TILES tiles of a band at a time as one wavefront: the
+	// reflection rays of one bounce and then all shadow rays are queued,
+	// sorted by direction octant, origin cell and direction (see rayKey) and
+	// traced in that order, so that neighbouring rays walk the same BVH
+	// nodes. Off by default.
+	void setSortRays(bool sortRays) { this->sortRays = sortRays; }
+	bool getSortRays() const { return sortRays; }
+
+	// Adds the caustics of a traced photon map to diffuse surfaces. Null
+	// (the default) leaves them out.
+	void setCaustics(const PhotonMap *caustics) { this->caustics = caustics; }
+
+	// Finds the surfaces the camera sees by rasterizing the scene into
+	// each view before the render (see PrimaryRaster) instead of tracing
+	// primary rays through the BVH. Only shadow and reflection rays are
+	// traced, so no primary rays are counted. The image is the same either
+	// way. Off by default.
+	void setRasterPrimary(bool rasterPrimary) { this->rasterPrimary = rasterPrimary; }
+	bool getRasterPrimary() const { return rasterPrimary; }
+
+	// Renders the camera's view into the image. The image is split into
+	// TILE_SIZE x TILE_SIZE tiles that the worker threads take in turn.
+	// threads <= 0 uses every hardware thread.
+	void render(const Camera &camera, Image &image, int threads);
+	// Renders straight into a writer opened with TILE_SIZE high bands
+	// instead of into a whole frame. Tiles are taken in file order and each
+	// band is encoded by the thread that finishes it, with at most a few
+	// bands per thread in memory.
+	//
+	// With a checkpoint, tiles it already holds are copied instead of
+	// rendered and every new tile is recorded in it. Returns false if
+	// writing failed or the render was stopped.
+	bool render(const Camera &camera, ImageWriter &writer, int threads, Checkpoint *checkpoint = nullptr);
+
+	// One camera of a batch render and where its image goes
+	struct View
+	{
+		const Camera *camera = nullptr;
+		ImageWriter *writer = nullptr;
+		Checkpoint *checkpoint = nullptr;
+	};
+	// Renders several views of the scene in one pass. The tiles of all
+	// views go through the same worker threads, interleaved band by band,
+	// so there is no idle time between views.
+	bool render(const std::vector<View> &views, int threads);
+
+	// Once *stop becomes true the workers finish their current tile and
+	// render() returns early. Safe to set from a signal handler.
+	void setStopFlag(const std::atomic<bool> *stop) { this->stop = stop; }
+
+	// Rays traced by the last render
+	const RayCounts &getRayCounts() const { return rayCounts; }
+	// Per-pixel counters of a view of the last render, empty unless built
+	// with RT_STATS
+	const std::vector<PixelStats> &getPixelStats(int view = 0) const;
+
+	// Worker count used for threads <= 0
+	static int defaultThreads();
+
+	static const int TILE_SIZE = 16;
+	static const int MAX_UNROLLED_LIGHTS = 4;
+	// Tiles in a wavefront of sorted rays, up to 4096 paths
+	static const int SORT_TILES = 16;
+
+private:
+	// Renders pixels [x0, x1) x [y0, y1) into rgb, stride pixels per row.
+	// tileStats gets the pixel counters when built with RT_STATS.
+	typedef void (Renderer::*TileKernel)(const Camera &camera, int x0, int y0, int x1, int y1, int stride, float *rgb, PixelStats *tileStats, RayCounts &counts);
+
+	// Filtered color of a texture at a hit. diff has been moved to the hit.
+	glm::vec3 textureColor(int texture, const Hit &hit, const RayDifferential &diff) const;
+	// Sample k of the environment light for a pixel: the direction and the
+	// radiance to weight the surface's response to it by. False if the
+	// sample is below the surface with normal n.
+	bool environmentSample(uint32_t seed, int k, const glm::vec3 &n, glm::vec3 &dir, glm::vec3 &weight) const;
+	// Sample k of light i for a pixel, seen from x. Point lights have one
+	// sample, their position.
+	glm::vec3 lightPoint(int i, uint32_t seed, int k, const glm::vec3 &x) const;
+	// Shadow ray test that first tries the shape that last blocked a ray
+	// toward light slot on this thread (numLights for the environment)
+	bool shadowed(int slot, const glm::vec3 &origin, const glm::vec3 &dir, float tmax) const;
+	// Irradiance from the caustic photons at a diffuse hit, timed in counts
+	glm::vec3 causticIrradiance(const glm::vec3 &x, const glm::vec3 &n, RayCounts &counts) const;
+	// seed varies the area light and environment samples from pixel to pixel
+	template<typename Real, typename F>
+	glm::vec<3, Real> shade(const Material &mat, const glm::vec<3, Real> &origin, const glm::vec<3, Real> &ray, const Hit &hit, const RayDifferential &diff, uint32_t seed, int recursionDepth, RayCounts &counts);
+	template<typename Real, typename F>
+	void renderTile(const Camera &camera, int x0, int y0, int x1, int y1, int stride, float *rgb, PixelStats *tileStats, RayCounts &counts);
+	template<typename Real, typename F>
+	void renderTileSorted(const Camera &camera, int x0, int y0, int x1, int y1, int stride, float *rgb, PixelStats *tileStats, RayCounts &counts);
+	template<typename Real, typename F>
+	TileKernel kernelFor() const;
+	template<typename Real, bool SHADOWS, bool REFLECTIONS, bool TEXTURES>
+	TileKernel selectKernel() const;
+	template<typename Real>
+	TileKernel selectKernel(bool reflections, bool textures) const;
+	TileKernel selectKernel();
+	// Rasterizes the scene into the views if rasterPrimary is set
+	void buildRasters(const std::vector<const Camera*> &cameras);
+	// Raster of the camera, null if its primary rays are traced
+	const PrimaryRaster *rasterFor(const Camera &camera) const;
+	// Tiles of a band one kernel call renders: SORT_TILES with sorted rays
+	int tilesPerTask() const { return sortRays ? SORT_TILES : 1; }
+	// Runs task(i, counts) for every i < numTasks on the given number of
+	// threads
+	void runTiles(int numTasks, int threads, const std::function<void(int, RayCounts &)> &task);
+	void resetPixelStats(int view, int width, int height);
+	void storePixelStats(int view, int x0, int y0, int x1, int y1, int stride, const PixelStats *tileStats);
+
+	Scene &scene;
+	const std::vector<Light> &lights;
+	bool shadows;
+	int depth;
+	Precision precision;
+	bool sortRays;
+	const PhotonMap *caustics;
+	bool rasterPrimary;
+	std::vector<std::unique_ptr<PrimaryRaster> > rasters;
+	AABB sceneBounds;
+	const std::atomic<bool> *stop;
+	RayCounts rayCounts;
+	std::vector<std::vector<PixelStats> > pixelStats;
+	std::vector<int> pixelStatsWidth;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cmath>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// Helpers shared by everything that samples lights, photons and the
+// hemisphere: the renderer, the photon map, the environment light and the
+// bake tool.
+
+const float PI = 3.14159265358979f;
+
+// Mixes the bits of h so that nearby inputs give unrelated outputs
+inline uint32_t hashBits(uint32_t h)
+{
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// Van der Corput sequence in base 2
+inline float radicalInverse(uint32_t k)
+{
+	k = (k << 16) | (k >> 16);
+	k = ((k & 0x00ff00ffu) << 8) | ((k & 0xff00ff00u) >> 8);
+	k = ((k & 0x0f0f0f0fu) << 4) | ((k & 0xf0f0f0f0u) >> 4);
+	k = ((k & 0x33333333u) << 2) | ((k & 0xccccccccu) >> 2);
+	k = ((k & 0x55555555u) << 1) | ((k & 0xaaaaaaaau) >> 1);
+	return k * 2.3283064e-10f;
+}
+
+// Any unit vectors t and b with t, b, w orthonormal
+inline void basis(const glm::vec3 &w, glm::vec3 &t, glm::vec3 &b)
+{
+	glm::vec3 a = fabs(w.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	t = glm::normalize(glm::cross(a, w));
+	b = glm::cross(w, t);
+}
+
+// Maps the unit square onto the unit disk, keeping strata compact
+// (Shirley and Chiu's concentric mapping)
+inline glm::vec2 concentricDisk(const glm::vec2 &u)
+{
+	glm::vec2 p = 2.0f * u - 1.0f;
+	if(p.x == 0.0f && p.y == 0.0f) {
+		return p;
+	}
+	if(fabs(p.x) > fabs(p.y)) {
+		float phi = PI / 4.0f * (p.y / p.x);
+		return p.x * glm::vec2(cos(phi), sin(phi));
+	}
+	float phi = PI / 2.0f - PI / 4.0f * (p.x / p.y);
+	return p.y * glm::vec2(cos(phi), sin(phi));
+}
+
+#endif
@@ -0,0 +1,521 @@
+#include "SceneFile.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+
+#include "MatrixStack.h"
+#include "Sphere.h"
+#include "Ellipsoid.h"
+#include "Plane.h"
+
+using namespace std;
+
+static const char BINARY_MAGIC[4] = {'R', 'T', 'S', 'B'};
+static const uint32_t BINARY_VERSION = 5;
+
+// Record sizes are stored in the header so that a file written by a build
+// with a different struct layout is rejected instead of misread.
+static const uint32_t RECORD_SIZES[] = {
+	sizeof(CameraDesc),
+	sizeof(Light),
+	sizeof(EnvironmentDesc),
+	sizeof(CausticsDesc),
+	sizeof(Material),
+	sizeof(SphereDesc),
+	sizeof(EllipsoidDesc),
+	sizeof(PlaneDesc),
+	sizeof(MeshDesc),
+};
+static const int NUM_RECORD_SIZES = sizeof(RECORD_SIZES) / sizeof(RECORD_SIZES[0]);
+
+SceneFile::SceneFile() :
+	shadows(true),
+	depth(4)
+{
+}
+
+SceneFile::~SceneFile()
+{
+}
+
+string SceneFile::contentKey() const
+{
+	ifstream in(sourceFile, ios::binary);
+	string key((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	for(const string &path : assetFiles) {
+		ifstream asset(path, ios::binary | ios::ate);
+		key += "|" + path + "|" + to_string(asset ? (long long)asset.tellg() : -1LL);
+	}
+	return key;
+}
+
+string SceneFile::builtinPath(int scene, const string &resources)
+{
+	// Scenes 4 and 5 are the same
+	if(scene == 5) {
+		scene = 4;
+	}
+	return resources + "/scene" + to_string(scene) + ".txt";
+}
+
+bool SceneFile::load(const string &filename)
+{
+	char magic[4] = {0, 0, 0, 0};
+	ifstream in(filename, ios::binary);
+	if(!in) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+	in.read(magic, 4);
+	in.close();
+	if(memcmp(magic, BINARY_MAGIC, 4) == 0) {
+		return loadBinary(filename);
+	}
+	return loadText(filename);
+}
+
+bool SceneFile::loadText(const string &filename)
+{
+	ifstream in(filename);
+	if(!in) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+	sourceFile = filename;
+
+	// Mesh paths are relative to the directory of the scene file
+	string dir;
+	size_t slash = filename.find_last_of("/\\");
+	if(slash != string::npos) {
+		dir = filename.substr(0, slash + 1);
+	}
+
+	map<string, int> materialIds;
+	map<string, int> geometryIds;
+	map<string, int> textureIds;
+	MatrixStack M;
+
+	string line;
+	int lineNumber = 0;
+	while(getline(in, line)) {
+		lineNumber++;
+		size_t hash = line.find('#');
+		if(hash != string::npos) {
+			line = line.substr(0, hash);
+		}
+		istringstream ss(line);
+		string cmd;
+		if(!(ss >> cmd)) {
+			continue;
+		}
+
+		// Looks up the material named by the next token
+		bool reported = false;
+		auto readMaterial = [&](int &id) {
+			string name;
+			ss >> name;
+			auto it = materialIds.find(name);
+			if(it == materialIds.end()) {
+				cerr << filename << ":" << lineNumber << ": unknown material '" << name << "'" << endl;
+				reported = true;
+				return false;
+			}
+			id = it->second;
+			return true;
+		};
+
+		bool ok = true;
+		if(cmd == "camera") {
+			CameraDesc &c = camera;
+			ok = bool(ss >> c.position.x >> c.position.y >> c.position.z
+			             >> c.front.x >> c.front.y >> c.front.z
+			             >> c.up.x >> c.up.y >> c.up.z >> c.fov);
+		} else if(cmd == "shadows") {
+			string value;
+			ok = bool(ss >> value) && (value == "on" || value == "off");
+			shadows = (value == "on");
+		} else if(cmd == "depth") {
+			ok = bool(ss >> depth);
+		} else if(cmd == "light") {
+			Light light;
+			ok = bool(ss >> light.position.x >> light.position.y >> light.position.z >> light.intensity);
+			lights.push_back(light);
+		} else if(cmd == "arealight") {
+			Light light;
+			light.type = Light::RECTANGLE;
+			ok = bool(ss >> light.position.x >> light.position.y >> light.position.z
+			             >> light.edge1.x >> light.edge1.y >> light.edge1.z
+			             >> light.edge2.x >> light.edge2.y >> light.edge2.z >> light.intensity);
+			light.samples = 16;
+			ss >> light.samples;
+			ok = ok && light.samples > 0;
+			lights.push_back(light);
+		} else if(cmd == "spherelight") {
+			Light light;
+			light.type = Light::SPHERE;
+			ok = bool(ss >> light.position.x >> light.position.y >> light.position.z >> light.radius >> light.intensity);
+			light.samples = 16;
+			ss >> light.samples;
+			ok = ok && light.samples > 0;
+			lights.push_back(light);
+		} else if(cmd == "environment") {
+			string imageName;
+			EnvironmentDesc &e = environmentDesc;
+			ok = bool(ss >> imageName >> e.intensity);
+			e.samples = 16;
+			if(ok && ss >> e.samples) {
+				ss >> e.rotation;
+			}
+			ok = ok && e.samples > 0;
+			if(ok) {
+				environmentFile = (imageName[0] == '/') ? imageName : dir + imageName;
+				assetFiles.push_back(environmentFile);
+				environment = make_shared<EnvironmentLight>();
+				if(!environment->load(environmentFile, e.intensity, e.rotation)) {
+					cerr << filename << ":" << lineNumber << ": couldn't load environment " << environmentFile << endl;
+					return false;
+				}
+				environment->setSamples(e.samples);
+			}
+		} else if(cmd == "caustics") {
+			CausticsDesc &c = caustics;
+			ok = bool(ss >> c.photons);
+			if(ok && ss >> c.gather) {
+				ss >> c.radius;
+			}
+			ok = ok && c.photons >= 0 && c.gather > 0 && c.radius > 0.0f;
+		} else if(cmd == "material") {
+			string name, token;
+			Material mat;
+			mat.diff = mat.spec = mat.amb = glm::vec3(0.0f);
+			mat.exp = 0.0f;
+			ss >> name;
+			if(ss >> token && token == "reflective") {
+				mat.isReflective = true;
+			} else {
+				ss.clear();
+				ss.str(line);
+				ss >> cmd >> name;
+				ok = bool(ss >> mat.diff.r >> mat.diff.g >> mat.diff.b
+				             >> mat.spec.r >> mat.spec.g >> mat.spec.b
+				             >> mat.amb.r >> mat.amb.g >> mat.amb.b >> mat.exp);
+				if(ss >> token) {
+					ok = ok && token == "reflective";
+					mat.isReflective = true;
+				}
+			}
+			materialIds[name] = (int)materials.size();
+			materials.push_back(mat);
+		} else if(cmd == "texture") {
+			int material;
+			string imageName;
+			ok = readMaterial(material) && bool(ss >> imageName);
+			if(ok) {
+				string path = (imageName[0] == '/') ? imageName : dir + imageName;
+				auto it = textureIds.find(path);
+				if(it == textureIds.end()) {
+					auto texture = Texture::load(path);
+					if(!texture) {
+						cerr << filename << ":" << lineNumber << ": couldn't load texture " << path << endl;
+						return false;
+					}
+					it = textureIds.insert(make_pair(path, (int)textures.size())).first;
+					textureFiles.push_back(path);
+					assetFiles.push_back(path);
+					textures.push_back(texture);
+				}
+				materials[material].texture = it->second;
+			}
+		} else if(cmd == "sphere") {
+			SphereDesc s;
+			ok = readMaterial(s.material) && bool(ss >> s.center.x >> s.center.y >> s.center.z >> s.radius);
+			spheres.push_back(s);
+		} else if(cmd == "plane") {
+			PlaneDesc p;
+			ok = readMaterial(p.material) && bool(ss >> p.position.x >> p.position.y >> p.position.z
+			                                        >> p.normal.x >> p.normal.y >> p.normal.z);
+			planes.push_back(p);
+		} else if(cmd == "ellipsoid") {
+			EllipsoidDesc e;
+			ok = readMaterial(e.material);
+			e.modelMatrix = M.topMatrix();
+			ellipsoids.push_back(e);
+		} else if(cmd == "mesh") {
+			MeshDesc m;
+			string objName;
+			ok = readMaterial(m.material) && bool(ss >> objName);
+			if(ok) {
+				string path = (objName[0] == '/') ? objName : dir + objName;
+				auto it = geometryIds.find(path);
+				if(it == geometryIds.end()) {
+					auto geometry = make_shared<MeshGeometry>();
+					if(geometry->loadObj(path) == 0) {
+						cerr << filename << ":" << lineNumber << ": couldn't load mesh " << path << endl;
+						return false;
+					}
+					it = geometryIds.insert(make_pair(path, (int)geometries.size())).first;
+					geometries.push_back(geometry);
+					assetFiles.push_back(path);
+				}
+				m.geometry = it->second;
+				m.modelMatrix = M.topMatrix();
+				meshes.push_back(m);
+			}
+		} else if(cmd == "push") {
+			M.pushMatrix();
+		} else if(cmd == "pop") {
+			M.popMatrix();
+		} else if(cmd == "identity") {
+			M.loadIdentity();
+		} else if(cmd == "translate") {
+			glm::vec3 t;
+			ok = bool(ss >> t.x >> t.y >> t.z);
+			M.translate(t);
+		} else if(cmd == "scale") {
+			glm::vec3 s;
+			ok = bool(ss >> s.x >> s.y >> s.z);
+			M.scale(s);
+		} else if(cmd == "rotate") {
+			float degrees;
+			glm::vec3 axis;
+			ok = bool(ss >> degrees >> axis.x >> axis.y >> axis.z);
+			M.rotate(glm::radians(degrees), axis);
+		} else {
+			cerr << filename << ":" << lineNumber << ": unknown command '" << cmd << "'" << endl;
+			return false;
+		}
+
+		if(!ok) {
+			if(!reported) {
+				cerr << filename << ":" << lineNumber << ": malformed '" << cmd << "'" << endl;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+static void writeArray(FILE *fp, const vector<T> &v)
+{
+	uint32_t n = (uint32_t)v.size();
+	fwrite(&n, sizeof(n), 1, fp);
+	if(n > 0) {
+		fwrite(v.data(), sizeof(T), n, fp);
+	}
+}
+
+// fileSize bounds the count, so a corrupt one fails instead of allocating
+// gigabytes
+template <typename T>
+static bool readArray(FILE *fp, long fileSize, vector<T> &v)
+{
+	uint32_t n;
+	if(fread(&n, sizeof(n), 1, fp) != 1) {
+		return false;
+	}
+	if((uint64_t)n * sizeof(T) > (uint64_t)(fileSize - ftell(fp))) {
+		return false;
+	}
+	v.resize(n);
+	return n == 0 || fread(v.data(), sizeof(T), n, fp) == n;
+}
+
+bool SceneFile::writeBinary(const string &filename) const
+{
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+
+	int32_t settings[2] = {shadows ? 1 : 0, depth};
+	fwrite(BINARY_MAGIC, 1, 4, fp);
+	fwrite(&BINARY_VERSION, sizeof(BINARY_VERSION), 1, fp);
+	fwrite(RECORD_SIZES, sizeof(RECORD_SIZES), 1, fp);
+	fwrite(&camera, sizeof(camera), 1, fp);
+	fwrite(settings, sizeof(settings), 1, fp);
+	writeArray(fp, lights);
+	fwrite(&environmentDesc, sizeof(environmentDesc), 1, fp);
+	writeArray(fp, vector<char>(environmentFile.begin(), environmentFile.end()));
+	fwrite(&caustics, sizeof(caustics), 1, fp);
+	writeArray(fp, materials);
+	writeArray(fp, spheres);
+	writeArray(fp, ellipsoids);
+	writeArray(fp, planes);
+	writeArray(fp, meshes);
+
+	uint32_t numGeometries = (uint32_t)geometries.size();
+	fwrite(&numGeometries, sizeof(numGeometries), 1, fp);
+	for(const auto &geometry : geometries) {
+		writeArray(fp, geometry->posBuf);
+		writeArray(fp, geometry->norBuf);
+		writeArray(fp, geometry->texBuf);
+	}
+
+	uint32_t numTextures = (uint32_t)textureFiles.size();
+	fwrite(&numTextures, sizeof(numTextures), 1, fp);
+	for(const string &path : textureFiles) {
+		writeArray(fp, vector<char>(path.begin(), path.end()));
+	}
+
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if(!ok) {
+		cerr << "Couldn't write to " << filename << endl;
+	}
+	return ok;
+}
+
+bool SceneFile::loadBinary(const string &filename)
+{
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long fileSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	char magic[4];
+	uint32_t version;
+	uint32_t recordSizes[NUM_RECORD_SIZES];
+	int32_t settings[2];
+	vector<char> environmentPath;
+	bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, BINARY_MAGIC, 4) == 0 &&
+	          fread(&version, sizeof(version), 1, fp) == 1 && version == BINARY_VERSION &&
+	          fread(recordSizes, sizeof(recordSizes), 1, fp) == 1 &&
+	          memcmp(recordSizes, RECORD_SIZES, sizeof(RECORD_SIZES)) == 0;
+	if(!ok) {
+		cerr << filename << " is not a compatible binary scene" << endl;
+		fclose(fp);
+		return false;
+	}
+
+	ok = fread(&camera, sizeof(camera), 1, fp) == 1 &&
+	     fread(settings, sizeof(settings), 1, fp) == 1 &&
+	     readArray(fp, fileSize, lights) &&
+	     fread(&environmentDesc, sizeof(environmentDesc), 1, fp) == 1 &&
+	     readArray(fp, fileSize, environmentPath) &&
+	     fread(&caustics, sizeof(caustics), 1, fp) == 1 &&
+	     readArray(fp, fileSize, materials) &&
+	     readArray(fp, fileSize, spheres) &&
+	     readArray(fp, fileSize, ellipsoids) &&
+	     readArray(fp, fileSize, planes) &&
+	     readArray(fp, fileSize, meshes);
+	shadows = settings[0] != 0;
+	depth = settings[1];
+
+	uint32_t numGeometries = 0;
+	ok = ok && fread(&numGeometries, sizeof(numGeometries), 1, fp) == 1;
+	for(uint32_t i = 0; ok && i < numGeometries; i++) {
+		auto geometry = make_shared<MeshGeometry>();
+		ok = readArray(fp, fileSize, geometry->posBuf) &&
+		     readArray(fp, fileSize, geometry->norBuf) &&
+		     readArray(fp, fileSize, geometry->texBuf);
+		geometry->computeBounds();
+		geometries.push_back(geometry);
+	}
+
+	uint32_t numTextures = 0;
+	ok = ok && fread(&numTextures, sizeof(numTextures), 1, fp) == 1;
+	for(uint32_t i = 0; ok && i < numTextures; i++) {
+		vector<char> path;
+		ok = readArray(fp, fileSize, path);
+		textureFiles.push_back(string(path.begin(), path.end()));
+	}
+	fclose(fp);
+
+	if(!ok) {
+		cerr << filename << " is truncated" << endl;
+		return false;
+	}
+
+	// build() and the renderer use the indices as they are
+	auto inRange = [](int i, size_t size) { return i >= 0 && (size_t)i < size; };
+	// shading divides by the sample counts, as checked by loadText
+	for(const Light &l : lights) {
+		ok = ok && l.samples > 0;
+	}
+	ok = ok && (environmentPath.empty() || environmentDesc.samples > 0);
+	for(const Material &m : materials) {
+		ok = ok && (m.texture == -1 || inRange(m.texture, textureFiles.size()));
+	}
+	for(const SphereDesc &s : spheres) {
+		ok = ok && inRange(s.material, materials.size());
+	}
+	for(const EllipsoidDesc &e : ellipsoids) {
+		ok = ok && inRange(e.material, materials.size());
+	}
+	for(const PlaneDesc &p : planes) {
+		ok = ok && inRange(p.material, materials.size());
+	}
+	for(const MeshDesc &m : meshes) {
+		ok = ok && inRange(m.material, materials.size()) && inRange(m.geometry, geometries.size());
+	}
+	for(const auto &geometry : geometries) {
+		ok = ok && geometry->posBuf.size() % 9 == 0 && geometry->norBuf.size() == geometry->posBuf.size();
+		// the BVH build can't split a NaN bound
+		for(float x : geometry->posBuf) {
+			ok = ok && isfinite(x);
+		}
+	}
+	if(!ok) {
+		cerr << filename << " is not a compatible binary scene" << endl;
+		return false;
+	}
+	sourceFile = filename;
+	assetFiles = textureFiles;
+	environmentFile.assign(environmentPath.begin(), environmentPath.end());
+	if(!environmentFile.empty()) {
+		assetFiles.push_back(environmentFile);
+		environment = make_shared<EnvironmentLight>();
+		if(!environment->load(environmentFile, environmentDesc.intensity, environmentDesc.rotation)) {
+			cerr << filename << ": couldn't load environment " << environmentFile << endl;
+			return false;
+		}
+		environment->setSamples(environmentDesc.samples);
+	}
+	for(const string &path : textureFiles) {
+		auto texture = Texture::load(path);
+		if(!texture) {
+			cerr << filename << ": couldn't load texture " << path << endl;
+			return false;
+		}
+		textures.push_back(texture);
+	}
+	return true;
+}
+
+void SceneFile::build(Scene &scene)
+{
+	for(const auto &texture : textures) {
+		scene.addTexture(texture.get());
+	}
+	scene.setEnvironment(environment.get());
+	for(const SphereDesc &s : spheres) {
+		shapes.push_back(make_unique<Sphere>(s.center, s.radius, materials[s.material]));
+		scene.addShape(shapes.back().get());
+	}
+	for(const EllipsoidDesc &e : ellipsoids) {
+		shapes.push_back(make_unique<Ellipsoid>(e.modelMatrix, materials[e.material]));
+		scene.addShape(shapes.back().get());
+	}
+	for(const PlaneDesc &p : planes) {
+		shapes.push_back(make_unique<Plane>(p.position, p.normal, materials[p.material]));
+		scene.addShape(shapes.back().get());
+	}
+	for(const MeshDesc &m : meshes) {
+		shapes.push_back(make_unique<Mesh>(geometries[m.geometry], m.modelMatrix, materials[m.material]));
+		scene.addShape(shapes.back().get());
+	}
+}
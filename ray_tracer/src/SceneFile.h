@@ -0,0 +1,153 @@
+#pragma once
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "EnvironmentLight.h"
+#include "Mesh.h"
+#include "Texture.h"
+
+// Scene description loaded from a text file (.txt) or from its compiled
+// binary form (.rtb). The text format is line based, '#' starts a comment:
+//
+//   camera <px py pz> <fx fy fz> <ux uy uz> <fov>
+//   shadows <on|off>
+//   depth <reflection recursion depth>
+//   light <x y z> <intensity>
+//   arealight <cx cy cz> <edge1 xyz> <edge2 xyz> <intensity> [samples]
+//                                     (rectangle centered on c, default 16
+//                                      shadow rays per shaded point)
+//   spherelight <cx cy cz> <radius> <intensity> [samples]
+//   environment <file> <intensity> [samples] [rotation]
+//                                     (equirectangular .hdr or .pfm light,
+//                                      samples per shaded point, default 16,
+//                                      rotation about y in degrees)
+//   caustics <photons> [gather] [radius]
+//                                     (photon map of light reflected by
+//                                      mirrors onto diffuse surfaces, each
+//                                      estimate from the nearest gather
+//                                      photons within radius)
+//   material <name> <diff rgb> <spec rgb> <amb rgb> <exp> [reflective]
+//   material <name> reflective
+//   texture <material> <file>         (diffuse color map, .png .jpg .ppm
+//                                      .qoi .pfm or tiled .rtt, path
+//                                      relative to the scene)
+//   sphere <material> <cx cy cz> <radius>
+//   plane <material> <px py pz> <nx ny nz>
+//   ellipsoid <material>              (unit sphere under the current transform)
+//   mesh <material> <file.obj>        (path relative to the scene file)
+//   push | pop | identity
+//   translate <x y z> | scale <x y z> | rotate <degrees> <ax ay az>
+//
+// The transform commands work like MatrixStack and apply to the ellipsoids
+// and meshes that follow them. Meshes that name the same OBJ file share one
+// copy of the geometry.
+//
+// The binary form stores the same records as raw arrays (including the
+// mesh triangles), so loading it is a handful of reads with no parsing.
+// Textures are stored by path and loaded from their own files.
+
+struct CameraDesc
+{
+	glm::vec3 position = glm::vec3(0.0f, 0.0f, 5.0f);
+	glm::vec3 front = glm::vec3(0.0f, 0.0f, -1.0f);
+	glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f);
+	float fov = 45.0f;
+};
+
+struct EnvironmentDesc
+{
+	float intensity = 1.0f;
+	float rotation = 0.0f;
+	int samples = 0; // 0 without an environment
+};
+
+struct CausticsDesc
+{
+	int photons = 0; // 0 without caustics
+	int gather = 50;
+	float radius = 0.1f;
+};
+
+struct SphereDesc
+{
+	glm::vec3 center;
+	float radius;
+	int material;
+};
+
+struct EllipsoidDesc
+{
+	glm::mat4 modelMatrix;
+	int material;
+};
+
+struct PlaneDesc
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	int material;
+};
+
+struct MeshDesc
+{
+	glm::mat4 modelMatrix;
+	int geometry;
+	int material;
+};
+
+class SceneFile
+{
+public:
+	SceneFile();
+	virtual ~SceneFile();
+
+	// Loads either form, picking the binary loader when the file starts
+	// with the binary magic.
+	bool load(const std::string &filename);
+	bool loadText(const std::string &filename);
+	bool loadBinary(const std::string &filename);
+	bool writeBinary(const std::string &filename) const;
+
+	// Path of built-in scene 1-8. The numbered scenes live in resources/.
+	static std::string builtinPath(int scene, const std::string &resources = "../resources");
+
+	// The bytes of the file the scene was loaded from, then the path and
+	// size of every mesh, texture and environment image it read. Any edit
+	// to the scene or swap of an asset changes it.
+	std::string contentKey() const;
+
+	// Creates the shapes and adds them to the scene. The shapes are owned
+	// by this object, so it has to outlive the scene.
+	void build(Scene &scene);
+
+	CameraDesc camera;
+	bool shadows;
+	int depth;
+	std::vector<Light> lights;
+	EnvironmentDesc environmentDesc;
+	std::string environmentFile;
+	std::shared_ptr<EnvironmentLight> environment;
+	CausticsDesc caustics;
+	std::vector<Material> materials;
+	std::vector<SphereDesc> spheres;
+	std::vector<EllipsoidDesc> ellipsoids;
+	std::vector<PlaneDesc> planes;
+	std::vector<MeshDesc> meshes;
+	std::vector< std::shared_ptr<MeshGeometry> > geometries;
+	std::vector<std::string> textureFiles;
+	std::vector< std::shared_ptr<Texture> > textures;
+
+private:
+	std::string sourceFile;
+	std::vector<std::string> assetFiles; // meshes, textures and environment
+	std::vector< std::unique_ptr<Shape> > shapes;
+};
+
+#endif
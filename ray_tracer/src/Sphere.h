@@ -71,6 +71,17 @@ public:
 
     Material getColor() override { return color; }
 
+    bool getBounds(AABB& box) override {
+        box.min = position - glm::vec3(radius);
+        box.max = position + glm::vec3(radius);
+        return true;
+    }
+
+    bool getUV(const Hit& hit, glm::vec2& uv, glm::vec3& dpdu, glm::vec3& dpdv) override {
+        sphericalUV(glm::normalize(hit.x - position), radius, uv, dpdu, dpdv);
+        return true;
+    }
+
 private:
     glm::vec3 position;
     float radius;
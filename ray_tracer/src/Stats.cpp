@@ -0,0 +1,101 @@
+#include "Stats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+#include "Image.h"
+
+using namespace std;
+
+// Black, blue, cyan, green, yellow, red, white
+static const float RAMP[7][3] = {
+	{0.0f, 0.0f, 0.0f},
+	{0.0f, 0.0f, 1.0f},
+	{0.0f, 1.0f, 1.0f},
+	{0.0f, 1.0f, 0.0f},
+	{1.0f, 1.0f, 0.0f},
+	{1.0f, 0.0f, 0.0f},
+	{1.0f, 1.0f, 1.0f},
+};
+
+static void falseColor(float v, unsigned char rgb[3])
+{
+	v = min(max(v, 0.0f), 1.0f) * 6.0f;
+	int i = min((int)v, 5);
+	float f = v - i;
+	for(int c = 0; c < 3; c++) {
+		rgb[c] = (unsigned char)(255.0f * (RAMP[i][c] * (1.0f - f) + RAMP[i + 1][c] * f));
+	}
+}
+
+static void writeHeatmap(const vector<uint32_t> &values, int width, int height, const string &filename)
+{
+	// Scale to the 99th percentile so a few expensive pixels don't wash out
+	// the rest of the image
+	vector<uint32_t> sorted(values);
+	size_t k = sorted.size() * 99 / 100;
+	nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+	float scale = sorted[k] > 0 ? 1.0f / sorted[k] : 0.0f;
+
+	Image image(width, height);
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			unsigned char rgb[3];
+			falseColor(values[y * width + x] * scale, rgb);
+			image.setPixel(x, y, rgb[0], rgb[1], rgb[2]);
+		}
+	}
+	image.writeToFile(filename);
+}
+
+void stats::report(const vector<PixelStats> &pixels, int width, int height, const string &imageFilename)
+{
+	if(pixels.empty() || (int)pixels.size() != width * height) {
+		return;
+	}
+
+	struct Counter { const char *name; const char *suffix; uint32_t (*get)(const PixelStats &); };
+	const Counter counters[] = {
+		{"primary rays", nullptr, [](const PixelStats &p) { return p.rays[RAY_PRIMARY]; }},
+		{"shadow rays", nullptr, [](const PixelStats &p) { return p.rays[RAY_SHADOW]; }},
+		{"reflection rays", nullptr, [](const PixelStats &p) { return p.rays[RAY_REFLECTION]; }},
+		{"all rays", "_rays", [](const PixelStats &p) { return p.rays[RAY_PRIMARY] + p.rays[RAY_SHADOW] + p.rays[RAY_REFLECTION]; }},
+		{"primitive tests", "_tests", [](const PixelStats &p) { return p.primitiveTests; }},
+		{"node visits", "_nodes", [](const PixelStats &p) { return p.nodeVisits; }},
+		{"shading evaluations", "_shades", [](const PixelStats &p) { return p.shades; }},
+	};
+
+	string base = imageFilename;
+	size_t dot = base.find_last_of('.');
+	size_t slash = base.find_last_of("/\\");
+	if(dot != string::npos && (slash == string::npos || slash < dot)) {
+		base = base.substr(0, dot);
+	}
+
+	printf("%-20s %14s %12s %10s\n", "counter", "total", "per pixel", "max");
+	vector<uint32_t> values(pixels.size());
+	for(const Counter &c : counters) {
+		uint64_t total = 0;
+		uint32_t maximum = 0;
+		for(size_t i = 0; i < pixels.size(); i++) {
+			values[i] = c.get(pixels[i]);
+			total += values[i];
+			maximum = max(maximum, values[i]);
+		}
+		printf("%-20s %14llu %12.2f %10u\n", c.name, (unsigned long long)total, (double)total / pixels.size(), maximum);
+		if(c.suffix) {
+			writeHeatmap(values, width, height, base + c.suffix + ".png");
+		}
+	}
+
+	uint64_t totalRays = 0, totalTests = 0, totalNodes = 0;
+	for(const PixelStats &p : pixels) {
+		totalRays += p.rays[RAY_PRIMARY] + p.rays[RAY_SHADOW] + p.rays[RAY_REFLECTION];
+		totalTests += p.primitiveTests;
+		totalNodes += p.nodeVisits;
+	}
+	if(totalRays > 0) {
+		printf("per ray: %.2f primitive tests, %.2f node visits\n", (double)totalTests / totalRays, (double)totalNodes / totalRays);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Per-pixel cost counters. They are compiled in only when RT_STATS is
+// defined (cmake -DSTATS=ON); otherwise every function below is an empty
+// inline and the hot loops are unchanged.
+//
+// Each thread accumulates into its own thread-local PixelStats. The
+// renderer points it at a pixel's entry with a PixelScope while it works
+// on that pixel.
+
+enum RayType { RAY_PRIMARY = 0, RAY_SHADOW, RAY_REFLECTION, NUM_RAY_TYPES };
+
+struct PixelStats
+{
+	uint32_t rays[NUM_RAY_TYPES];
+	uint32_t primitiveTests; // shape and triangle intersection tests
+	uint32_t nodeVisits;     // BVH nodes visited, scene and mesh
+	uint32_t shades;         // shading evaluations
+};
+
+namespace stats
+{
+#ifdef RT_STATS
+	inline thread_local PixelStats pixel = {};
+
+	inline void countRay(RayType type) { pixel.rays[type]++; }
+	inline void countPrimitiveTest() { pixel.primitiveTests++; }
+	inline void countNodeVisit() { pixel.nodeVisits++; }
+	inline void countShade() { pixel.shades++; }
+
+	// Sends the counters to another pixel while in scope, for code that
+	// traces the rays of many pixels in turn
+	struct PixelScope
+	{
+		PixelStats &target;
+		PixelStats saved;
+		PixelScope(PixelStats &target) : target(target), saved(pixel) { pixel = target; }
+		~PixelScope() { target = pixel; pixel = saved; }
+	};
+#else
+	inline void countRay(RayType) {}
+	inline void countPrimitiveTest() {}
+	inline void countNodeVisit() {}
+	inline void countShade() {}
+
+	struct PixelScope
+	{
+		PixelScope(PixelStats &) {}
+	};
+#endif
+
+	// Prints totals, means and maxima and writes one false-color heatmap
+	// per counter next to the image: <name>_rays.png, <name>_tests.png,
+	// <name>_nodes.png and <name>_shades.png.
+	void report(const std::vector<PixelStats> &pixels, int width, int height, const std::string &imageFilename);
+}
+
+#endif
@@ -0,0 +1,263 @@
+#include "Texture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "ImageReader.h"
+
+using namespace std;
+
+static const char TEXTURE_MAGIC[4] = {'R', 'T', 'T', 'X'};
+static const uint32_t TEXTURE_VERSION = 1;
+
+// magic, version, width, height, tile size
+static const long HEADER_SIZE = 4 + 4 * sizeof(int32_t);
+
+// Bits of a coordinate inside a tile spread out to every other bit. The
+// Morton index of texel (x, y) is MORTON[x] | MORTON[y] << 1.
+static const uint16_t MORTON[Texture::TILE_SIZE] = {
+	0x000, 0x001, 0x004, 0x005, 0x010, 0x011, 0x014, 0x015,
+	0x040, 0x041, 0x044, 0x045, 0x050, 0x051, 0x054, 0x055,
+	0x100, 0x101, 0x104, 0x105, 0x110, 0x111, 0x114, 0x115,
+	0x140, 0x141, 0x144, 0x145, 0x150, 0x151, 0x154, 0x155,
+};
+
+Texture::Texture() :
+	width(0),
+	height(0),
+	tileCount(0),
+	fp(nullptr),
+	cache(nullptr),
+	id(0)
+{
+	static atomic<uint64_t> nextId(0);
+	id = nextId++;
+}
+
+Texture::~Texture()
+{
+	if(fp) {
+		fclose(fp);
+	}
+}
+
+void Texture::initLevels(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	levels.clear();
+	tileCount = 0;
+	for(;;) {
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		level.firstTile = tileCount;
+		tileCount += level.tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE);
+		levels.push_back(level);
+		if(width == 1 && height == 1) {
+			break;
+		}
+		width = max(1, width / 2);
+		height = max(1, height / 2);
+	}
+}
+
+void Texture::buildTiles(int width, int height, const vector<float> &rgb)
+{
+	initLevels(width, height);
+	tiles.assign((size_t)tileCount * TILE_BYTES, 0);
+
+	vector<float> cur = rgb;
+	for(size_t l = 0; l < levels.size(); l++) {
+		const Level &level = levels[l];
+		int w = level.width;
+		int h = level.height;
+
+		// Texels past the right and bottom edges repeat the last column and
+		// row. Lookups wrap before they get there, but the padding keeps
+		// the tile contents deterministic.
+		int tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+		for(int ty = 0; ty < tilesY; ty++) {
+			for(int tx = 0; tx < level.tilesX; tx++) {
+				unsigned char *tile = &tiles[(size_t)(level.firstTile + ty * level.tilesX + tx) * TILE_BYTES];
+				for(int iy = 0; iy < TILE_SIZE; iy++) {
+					int y = min(ty * TILE_SIZE + iy, h - 1);
+					for(int ix = 0; ix < TILE_SIZE; ix++) {
+						int x = min(tx * TILE_SIZE + ix, w - 1);
+						unsigned char *texel = &tile[(MORTON[ix] | MORTON[iy] << 1) * 3];
+						for(int c = 0; c < 3; c++) {
+							float v = min(max(cur[((size_t)y * w + x) * 3 + c], 0.0f), 1.0f);
+							texel[c] = (unsigned char)(v * 255.0f + 0.5f);
+						}
+					}
+				}
+			}
+		}
+
+		if(l + 1 == levels.size()) {
+			break;
+		}
+		// 2 x 2 box filter. An odd last row or column is folded into the
+		// one before it.
+		const Level &next = levels[l + 1];
+		vector<float> down((size_t)next.width * next.height * 3);
+		for(int y = 0; y < next.height; y++) {
+			for(int x = 0; x < next.width; x++) {
+				for(int c = 0; c < 3; c++) {
+					float sum = 0.0f;
+					for(int dy = 0; dy < 2; dy++) {
+						for(int dx = 0; dx < 2; dx++) {
+							int sx = min(2 * x + dx, w - 1);
+							int sy = min(2 * y + dy, h - 1);
+							sum += cur[((size_t)sy * w + sx) * 3 + c];
+						}
+					}
+					down[((size_t)y * next.width + x) * 3 + c] = sum * 0.25f;
+				}
+			}
+		}
+		cur.swap(down);
+	}
+}
+
+shared_ptr<Texture> Texture::load(const string &filename, TileCache &cache)
+{
+	shared_ptr<Texture> texture(new Texture());
+	size_t dot = filename.find_last_of('.');
+	string ext = dot == string::npos ? "" : filename.substr(dot + 1);
+	transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+	if(ext != "rtt") {
+		int w, h;
+		vector<float> rgb;
+		if(!readImage(filename, w, h, rgb)) {
+			return nullptr;
+		}
+		texture->buildTiles(w, h, rgb);
+		return texture;
+	}
+
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		return nullptr;
+	}
+	texture->fp = fp;
+	texture->cache = &cache;
+
+	char magic[4];
+	uint32_t version;
+	int32_t header[3];
+	bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, TEXTURE_MAGIC, 4) == 0 &&
+	          fread(&version, sizeof(version), 1, fp) == 1 && version == TEXTURE_VERSION &&
+	          fread(header, sizeof(header), 1, fp) == 1 &&
+	          header[0] > 0 && header[1] > 0 && header[2] == TILE_SIZE;
+	if(ok) {
+		texture->initLevels(header[0], header[1]);
+		ok = fseek(fp, 0, SEEK_END) == 0 && ftell(fp) >= HEADER_SIZE + (long)texture->tileCount * TILE_BYTES;
+	}
+	if(!ok) {
+		cerr << filename << " is not a compatible tiled texture" << endl;
+		return nullptr;
+	}
+	return texture;
+}
+
+bool Texture::convert(const string &image, const string &filename)
+{
+	int w, h;
+	vector<float> rgb;
+	if(!readImage(image, w, h, rgb)) {
+		return false;
+	}
+	Texture texture;
+	texture.buildTiles(w, h, rgb);
+
+	FILE *fp = fopen(filename.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+	int32_t header[3] = {w, h, TILE_SIZE};
+	fwrite(TEXTURE_MAGIC, 1, 4, fp);
+	fwrite(&TEXTURE_VERSION, sizeof(TEXTURE_VERSION), 1, fp);
+	fwrite(header, sizeof(header), 1, fp);
+	fwrite(texture.tiles.data(), 1, texture.tiles.size(), fp);
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if(!ok) {
+		cerr << "Couldn't write to " << filename << endl;
+	}
+	return ok;
+}
+
+bool Texture::readTile(int tile, vector<unsigned char> &data) const
+{
+	data.resize(TILE_BYTES);
+	lock_guard<mutex> lock(fileMutex);
+	return fseek(fp, HEADER_SIZE + (long)tile * TILE_BYTES, SEEK_SET) == 0 &&
+	       fread(data.data(), 1, TILE_BYTES, fp) == (size_t)TILE_BYTES;
+}
+
+glm::vec3 Texture::bilinear(int l, const glm::vec2 &uv) const
+{
+	const Level &level = levels[l];
+	float u = uv.x - floor(uv.x);
+	float v = uv.y - floor(uv.y);
+	// Row 0 of the image is its top
+	float fx = u * level.width - 0.5f;
+	float fy = (1.0f - v) * level.height - 0.5f;
+	int x0 = (int)floor(fx);
+	int y0 = (int)floor(fy);
+	float ax = fx - x0;
+	float ay = fy - y0;
+
+	// The four texels usually share a tile, so the last one is kept
+	int lastTile = -1;
+	const unsigned char *data = nullptr;
+	TileCache::Tile hold;
+	auto texel = [&](int x, int y) {
+		x = x < 0 ? x + level.width : x >= level.width ? x - level.width : x;
+		y = y < 0 ? y + level.height : y >= level.height ? y - level.height : y;
+		int tile = level.firstTile + (y / TILE_SIZE) * level.tilesX + x / TILE_SIZE;
+		if(tile != lastTile) {
+			lastTile = tile;
+			if(!fp) {
+				data = &tiles[(size_t)tile * TILE_BYTES];
+			} else {
+				hold = cache->get(id << 32 | (uint64_t)tile, [&](vector<unsigned char> &out) { return readTile(tile, out); });
+				data = hold ? hold->data() : nullptr;
+			}
+		}
+		if(!data) {
+			return glm::vec3(0.0f);
+		}
+		const unsigned char *t = &data[(MORTON[x % TILE_SIZE] | MORTON[y % TILE_SIZE] << 1) * 3];
+		return glm::vec3(t[0], t[1], t[2]) * (1.0f / 255.0f);
+	};
+
+	glm::vec3 top = glm::mix(texel(x0, y0), texel(x0 + 1, y0), ax);
+	glm::vec3 bottom = glm::mix(texel(x0, y0 + 1), texel(x0 + 1, y0 + 1), ax);
+	return glm::mix(top, bottom, ay);
+}
+
+glm::vec3 Texture::sample(const glm::vec2 &uv, const glm::vec2 &duvdx, const glm::vec2 &duvdy) const
+{
+	// Footprint of the pixel in level 0 texels
+	glm::vec2 size((float)width, (float)height);
+	float footprint = max(glm::length(duvdx * size), glm::length(duvdy * size));
+	float lod = footprint > 1.0f ? log2(footprint) : 0.0f;
+	lod = min(lod, (float)(levels.size() - 1));
+
+	int l = (int)lod;
+	glm::vec3 color = bilinear(l, uv);
+	float f = lod - l;
+	if(f > 0.0f && l + 1 < (int)levels.size()) {
+		color = glm::mix(color, bilinear(l + 1, uv), f);
+	}
+	return color;
+}
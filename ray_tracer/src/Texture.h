@@ -0,0 +1,85 @@
+#pragma once
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "TileCache.h"
+
+// Mip-mapped RGB texture stored in square tiles of TILE_SIZE x TILE_SIZE
+// texels. Inside a tile the texels are in Morton (Z) order, so the 2 x 2
+// texels of a bilinear lookup are almost always in the same few cache lines.
+//
+// A texture loaded from an image (see readImage) keeps every tile in
+// memory. A tiled texture file (.rtt, written by convert()) only reads its
+// header up front; tiles are read through a TileCache when a lookup first
+// touches them, so the memory they use is bounded by the cache: at most
+// the larger of its capacity and 16 tiles (see TileCache), plus the tiles
+// the render threads hold at the moment.
+//
+// Texture coordinates follow OpenGL: (0, 0) is the bottom left corner of
+// the image and the texture repeats outside [0, 1].
+class Texture
+{
+public:
+	static const int TILE_SIZE = 32;
+	static const int TILE_BYTES = TILE_SIZE * TILE_SIZE * 3;
+
+	virtual ~Texture();
+
+	// Loads an image or opens a tiled texture file, picking by extension.
+	// Returns null on failure.
+	static std::shared_ptr<Texture> load(const std::string &filename, TileCache &cache = TileCache::shared());
+	// Writes an image as a tiled texture file with all its mip levels
+	static bool convert(const std::string &image, const std::string &filename);
+
+	// Trilinear filtered color at uv. duvdx and duvdy are the change of uv
+	// from one pixel to the next in x and y; the larger of the two
+	// footprints picks the mip level.
+	glm::vec3 sample(const glm::vec2 &uv, const glm::vec2 &duvdx, const glm::vec2 &duvdy) const;
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getLevels() const { return (int)levels.size(); }
+	bool isResident() const { return !fp; }
+
+private:
+	struct Level
+	{
+		int width;
+		int height;
+		int tilesX;
+		int firstTile; // index of the level's first tile in the file
+	};
+
+	Texture();
+
+	void initLevels(int width, int height);
+	// Builds the mip chain of rgb and stores it as resident tiles
+	void buildTiles(int width, int height, const std::vector<float> &rgb);
+	bool readTile(int tile, std::vector<unsigned char> &data) const;
+	glm::vec3 bilinear(int level, const glm::vec2 &uv) const;
+
+	int width;
+	int height;
+	std::vector<Level> levels;
+	int tileCount;
+
+	// Resident tiles
+	std::vector<unsigned char> tiles;
+
+	// File backed tiles
+	FILE *fp;
+	mutable std::mutex fileMutex;
+	TileCache *cache;
+	uint64_t id; // high bits of this texture's cache keys
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "TileCache.h"
+
+using namespace std;
+
+TileCache::TileCache(size_t capacity) :
+	capacity(capacity),
+	hits(0),
+	misses(0)
+{
+}
+
+TileCache::~TileCache()
+{
+}
+
+TileCache &TileCache::shared()
+{
+	static TileCache cache(256u << 20);
+	return cache;
+}
+
+void TileCache::setCapacity(size_t bytes)
+{
+	capacity = bytes;
+	for(Shard &shard : shards) {
+		lock_guard<mutex> lock(shard.mutex);
+		evict(shard, capacity / SHARDS);
+	}
+}
+
+size_t TileCache::getSize() const
+{
+	size_t size = 0;
+	for(const Shard &shard : shards) {
+		size += shard.size;
+	}
+	return size;
+}
+
+void TileCache::evict(Shard &shard, size_t limit)
+{
+	// Always keep the newest tile, even if it alone is over the limit
+	while(shard.size > limit && shard.lru.size() > 1) {
+		shard.size -= shard.lru.back().second->size();
+		shard.index.erase(shard.lru.back().first);
+		shard.lru.pop_back();
+	}
+}
+
+TileCache::Tile TileCache::get(uint64_t key, const Loader &load)
+{
+	// Keys of neighbouring tiles differ in the low bits, so mix them before
+	// picking the shard
+	Shard &shard = shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+	{
+		lock_guard<mutex> lock(shard.mutex);
+		auto it = shard.index.find(key);
+		if(it != shard.index.end()) {
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			hits++;
+			return it->second->second;
+		}
+	}
+
+	misses++;
+	auto data = make_shared<vector<unsigned char> >();
+	if(!load(*data)) {
+		return nullptr;
+	}
+
+	lock_guard<mutex> lock(shard.mutex);
+	auto it = shard.index.find(key);
+	if(it != shard.index.end()) {
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+		return it->second->second;
+	}
+	shard.lru.emplace_front(key, data);
+	shard.index[key] = shard.lru.begin();
+	shard.size += data->size();
+	evict(shard, capacity / SHARDS);
+	return data;
+}
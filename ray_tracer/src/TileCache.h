@@ -0,0 +1,70 @@
+#pragma once
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Size-bounded cache of texture tiles shared by every texture that is read
+// from disk on demand. Tiles are kept in least recently used order and the
+// oldest are dropped once the total size passes the capacity, so a scene
+// can reference more texture data than fits in memory.
+//
+// The cache is split into shards with their own lock so that the render
+// threads rarely wait on each other. Each shard is kept to capacity / SHARDS
+// but always keeps its newest tile, so the cache holds at most the larger of
+// the capacity and SHARDS tiles. A tile that is evicted while a thread still
+// holds it stays alive until that thread lets go of it.
+class TileCache
+{
+public:
+	typedef std::shared_ptr<const std::vector<unsigned char> > Tile;
+	typedef std::function<bool(std::vector<unsigned char> &)> Loader;
+
+	explicit TileCache(size_t capacity);
+	virtual ~TileCache();
+
+	// The cache used by file backed textures, 256 MB unless changed
+	static TileCache &shared();
+
+	// Evicts tiles until the cache fits in the new capacity
+	void setCapacity(size_t bytes);
+	size_t getCapacity() const { return capacity; }
+
+	// Returns the tile with the given key, calling load to read it on a
+	// miss. The loader runs without any lock held; if two threads miss the
+	// same tile both read it and the first one in is kept. Returns null if
+	// the loader fails. Thread safe.
+	Tile get(uint64_t key, const Loader &load);
+
+	// Counters for reports. getSize is only exact while no thread is in get.
+	uint64_t getHits() const { return hits; }
+	uint64_t getMisses() const { return misses; }
+	size_t getSize() const;
+
+private:
+	static const int SHARDS = 16;
+
+	struct Shard
+	{
+		std::mutex mutex;
+		std::list<std::pair<uint64_t, Tile> > lru; // most recently used first
+		std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Tile> >::iterator> index;
+		size_t size = 0;
+	};
+
+	void evict(Shard &shard, size_t limit);
+
+	size_t capacity;
+	Shard shards[SHARDS];
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "Views.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "Sampling.h"
+
+using namespace std;
+
+bool loadViews(const string &filename, vector<ViewDesc> &views)
+{
+	ifstream in(filename);
+	if(!in.good()) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+	// Line of each name, lower case because the images of A and a are the
+	// same file on case-insensitive file systems
+	map<string, int> names;
+	string line;
+	int lineNumber = 0;
+	while(getline(in, line)) {
+		lineNumber++;
+		size_t comment = line.find('#');
+		if(comment != string::npos) {
+			line.erase(comment);
+		}
+		stringstream ss(line);
+		ViewDesc view;
+		if(!(ss >> view.name)) {
+			continue;
+		}
+		CameraDesc &c = view.camera;
+		if(!(ss >> c.position.x >> c.position.y >> c.position.z
+		        >> c.front.x >> c.front.y >> c.front.z
+		        >> c.up.x >> c.up.y >> c.up.z >> c.fov)) {
+			cerr << filename << ":" << lineNumber << ": expected <name> <position> <front> <up> <fov>" << endl;
+			return false;
+		}
+		bool fragment = all_of(view.name.begin(), view.name.end(), [](char ch) {
+			return isalnum((unsigned char)ch) || ch == '-' || ch == '_' || ch == '.';
+		});
+		if(!fragment) {
+			cerr << filename << ":" << lineNumber << ": view name " << view.name << " can only have letters, digits, '-', '_' and '.'" << endl;
+			return false;
+		}
+		string key = view.name;
+		transform(key.begin(), key.end(), key.begin(), ::tolower);
+		auto first = names.insert(make_pair(key, lineNumber));
+		if(!first.second) {
+			cerr << filename << ":" << lineNumber << ": view " << view.name << " has the same name as the one on line " << first.first->second << endl;
+			return false;
+		}
+		views.push_back(view);
+	}
+	if(views.empty()) {
+		cerr << filename << ": no views" << endl;
+		return false;
+	}
+	return true;
+}
+
+vector<ViewDesc> turntableViews(const CameraDesc &camera, int count)
+{
+	auto rotateY = [](const glm::vec3 &v, float angle) {
+		float c = cos(angle), s = sin(angle);
+		return glm::vec3(c * v.x + s * v.z, v.y, -s * v.x + c * v.z);
+	};
+	vector<ViewDesc> views;
+	for(int i = 0; i < count; i++) {
+		float angle = 2.0f * PI * i / count;
+		char name[16];
+		snprintf(name, sizeof(name), "%03d", i);
+		ViewDesc view;
+		view.name = name;
+		view.camera = camera;
+		view.camera.position = rotateY(camera.position, angle);
+		view.camera.front = rotateY(camera.front, angle);
+		view.camera.up = rotateY(camera.up, angle);
+		views.push_back(view);
+	}
+	return views;
+}
+
+vector<ViewDesc> stereoViews(const CameraDesc &camera, float separation)
+{
+	glm::vec3 right = glm::normalize(glm::cross(camera.front, camera.up));
+	vector<ViewDesc> views(2);
+	views[0].name = "left";
+	views[0].camera = camera;
+	views[0].camera.position = camera.position - 0.5f * separation * right;
+	views[1].name = "right";
+	views[1].camera = camera;
+	views[1].camera.position = camera.position + 0.5f * separation * right;
+	return views;
+}
+
+vector<ViewDesc> cubemapViews(const CameraDesc &camera)
+{
+	struct Face
+	{
+		const char *name;
+		glm::vec3 front;
+		glm::vec3 up;
+	};
+	static const Face FACES[6] = {
+		{"px", glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)},
+		{"nx", glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)},
+		{"py", glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)},
+		{"ny", glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)},
+		{"pz", glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)},
+		{"nz", glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)},
+	};
+	vector<ViewDesc> views;
+	for(const Face &face : FACES) {
+		ViewDesc view;
+		view.name = face.name;
+		view.camera.position = camera.position;
+		view.camera.front = face.front;
+		view.camera.up = face.up;
+		view.camera.fov = 90.0f;
+		views.push_back(view);
+	}
+	return views;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#ifndef VIEWS_H
+#define VIEWS_H
+
+#include <string>
+#include <vector>
+
+#include "SceneFile.h"
+
+// A camera of a batch render. The name is appended to the output filename,
+// as in out_left.png.
+struct ViewDesc
+{
+	std::string name;
+	CameraDesc camera;
+};
+
+// Reads a list of views, one per line, '#' starts a comment:
+//
+//   <name> <px py pz> <fx fy fz> <ux uy uz> <fov>
+//
+// Names are letters, digits, '-', '_' and '.', and no two may differ only
+// in case, so that every view writes its own file.
+bool loadViews(const std::string &filename, std::vector<ViewDesc> &views);
+
+// count views of the camera rotated about the world y axis in equal steps,
+// named 000, 001, ...
+std::vector<ViewDesc> turntableViews(const CameraDesc &camera, int count);
+
+// Parallel left and right eye views, separation apart
+std::vector<ViewDesc> stereoViews(const CameraDesc &camera, float separation);
+
+// The six 90 degree cube faces around the camera position, named px, nx,
+// py, ny, pz and nz, oriented like OpenGL cube map faces
+std::vector<ViewDesc> cubemapViews(const CameraDesc &camera);
+
+#endif
@@ -2,8 +2,17 @@
 #define COMMON_H
 
 #include <glm/glm.hpp>
+#include <cmath>
 #include <vector>
 
+#include "BVH.h"
+#include "Sampling.h"
+#include "Stats.h"
+
+class EnvironmentLight;
+class Shape;
+class Texture;
+
 class Hit
 {
 public:
@@ -13,6 +22,10 @@ public:
 	glm::vec3 n; // normal
 	float t; // distance
     bool valid;
+    // Set by Scene::hit, for Shape::getUV
+    Shape *shape = nullptr;
+    int primitive = 0;        // shape specific, the triangle of a mesh
+    glm::vec2 bary = glm::vec2(0.0f); // barycentrics within the primitive
 };
 
 struct Material
@@ -22,19 +35,86 @@ struct Material
     glm::vec3 amb;
     float exp;
     bool isReflective = false;
+    int texture = -1; // index into Scene::getTextures, scales diff
 };
 
 struct Light {
-    glm::vec3 position;
-    float intensity;
+    enum Type { POINT, RECTANGLE, SPHERE };
+
+    glm::vec3 position; // center of an area light
+    float intensity;    // split evenly over the samples of an area light
+    int type = POINT;
+    glm::vec3 edge1 = glm::vec3(0.0f); // sides of a rectangle
+    glm::vec3 edge2 = glm::vec3(0.0f);
+    float radius = 0.0f; // of a sphere
+    int samples = 1;     // shadow rays per shaded point
+
+    // Point of the light for the uniform numbers u, as seen from x. A
+    // sphere is sampled over the disk through its center facing x, which
+    // casts nearly the same shadows as its surface.
+    glm::vec3 samplePoint(const glm::vec3& x, const glm::vec2& u) const {
+        if (type == RECTANGLE) {
+            return position + (u.x - 0.5f) * edge1 + (u.y - 0.5f) * edge2;
+        }
+        if (type == SPHERE) {
+            glm::vec3 w = x - position;
+            float d = glm::length(w);
+            if (d <= radius) {
+                return position;
+            }
+            w /= d;
+            glm::vec3 t, b;
+            basis(w, t, b);
+            glm::vec2 p = concentricDisk(u) * radius;
+            return position + p.x * t + p.y * b;
+        }
+        return position;
+    }
 };
 
 class Shape {
 public:
+    virtual ~Shape() {}
     virtual bool intersect(glm::vec3 origin, glm::vec3 ray, Hit& hit) = 0; // Pure virtual function
     virtual Material getColor() = 0;
+    // World space bounds. Unbounded shapes (planes) return false and are
+    // kept out of the scene BVH.
+    virtual bool getBounds(AABB& box) { return false; }
+    // Builds any per-shape acceleration structure
+    virtual void buildBVH() {}
+    // Texture coordinates at a hit of this shape and the derivatives of
+    // the position with respect to them. Returns false if the shape has no
+    // parameterization.
+    virtual bool getUV(const Hit& hit, glm::vec2& uv, glm::vec3& dpdu, glm::vec3& dpdv) { return false; }
+    // World space triangles for rasterized primary visibility. Shapes
+    // without triangles are rasterized by their bounds and intersected as
+    // a whole.
+    virtual int getTriangleCount() { return 0; }
+    virtual void getTriangle(int i, glm::vec3 v[3]) {}
+    // intersect() limited to triangle i, giving the same hit
+    virtual bool intersectTriangle(glm::vec3 origin, glm::vec3 ray, int i, Hit& hit) { return false; }
+    // Just the hit's distance, hit.t, for picking the closest triangle
+    // before working out the rest
+    virtual bool intersectTriangle(glm::vec3 origin, glm::vec3 ray, int i, float& distance) { return false; }
 };
 
+// Spherical coordinates of the unit vector p as texture coordinates: u runs
+// once around the y axis and v from the south pole (0) to the north pole
+// (1). dpdu and dpdv are for a sphere of the given radius.
+inline void sphericalUV(const glm::vec3& p, float radius, glm::vec2& uv, glm::vec3& dpdu, glm::vec3& dpdv)
+{
+    float y = glm::clamp(p.y, -1.0f, 1.0f);
+    float phi = atan2(p.z, p.x);
+    float theta = acos(y);
+    uv = glm::vec2(0.5f + phi / (2.0f * PI), 1.0f - theta / PI);
+
+    float sinTheta = sqrt(p.x * p.x + p.z * p.z);
+    float cosPhi = sinTheta > 1e-6f ? p.x / sinTheta : 1.0f;
+    float sinPhi = sinTheta > 1e-6f ? p.z / sinTheta : 0.0f;
+    dpdu = 2.0f * PI * radius * glm::vec3(-p.z, 0.0f, p.x);
+    dpdv = -PI * radius * glm::vec3(y * cosPhi, -sinTheta, y * sinPhi);
+}
+
 class Scene {
 public:
 
@@ -47,12 +127,52 @@ public:
         return shapes;
     }
 
+    // Textures that materials refer to by index
+    void addTexture(const Texture* texture) {
+        textures.push_back(texture);
+    }
+
+    const std::vector<const Texture*>& getTextures() const {
+        return textures;
+    }
+
+    // Builds the BVH over the bounded shapes. Call after the last addShape.
+    void buildBVH() {
+        bounded.clear();
+        unbounded.clear();
+        std::vector<AABB> boxes;
+        for(Shape* shape : shapes){
+            shape->buildBVH();
+            AABB box;
+            if(shape->getBounds(box)){
+                bounded.push_back(shape);
+                boxes.push_back(box);
+            }else{
+                unbounded.push_back(shape);
+            }
+        }
+        bvh.build(boxes);
+        built = true;
+    }
+
+    // Bounds of the shapes in the BVH. False before buildBVH or if every
+    // shape is unbounded.
+    bool getBounds(AABB &box) const {
+        if(!built || bvh.empty()){
+            return false;
+        }
+        box = bvh.bounds();
+        return true;
+    }
+
     bool hit(const glm::vec3 &origin, const glm::vec3 &ray, Hit &closestHit, Material &closestMaterial) {
         bool atleastOneHit = false;
-        
-        for(Shape* shape : shapes){
+
+        auto test = [&](Shape* shape) {
             Hit closestShapeHit;
+            stats::countPrimitiveTest();
             bool rayHit = shape->intersect(origin, ray, closestShapeHit);
+            closestShapeHit.shape = shape;
             if(closestHit.valid == false && rayHit == true){
                 closestHit.valid = true; // this is lowkey redundant
 
@@ -66,13 +186,96 @@ public:
 
                 atleastOneHit = true;
             }
+            return rayHit;
+        };
+
+        if(!built){
+            for(Shape* shape : shapes){
+                test(shape);
+            }
+            return atleastOneHit;
+        }
+
+        for(Shape* shape : unbounded){
+            test(shape);
         }
+        float tmax = closestHit.valid ? closestHit.t : FLT_MAX;
+        bvh.traverse(origin, ray, tmax, [&](int i, float &t) {
+            if(test(bounded[i]) && closestHit.t < t){
+                t = closestHit.t;
+                return true;
+            }
+            return false;
+        });
         return atleastOneHit;
     }
 
+    // Whether anything is hit before distance tmax. Stops at the first hit
+    // found instead of looking for the closest, for shadow rays.
+    bool occluded(const glm::vec3 &origin, const glm::vec3 &ray, float tmax) {
+        Shape* occluder = nullptr;
+        return occluded(origin, ray, tmax, occluder);
+    }
+
+    // Same, but tries occluder first and leaves the shape that blocked the
+    // ray in it (null if none did). Shadow rays from neighbouring points
+    // toward the same light are mostly blocked by the same shape, which
+    // then costs one intersection test instead of a traversal.
+    bool occluded(const glm::vec3 &origin, const glm::vec3 &ray, float tmax, Shape*& occluder) {
+        auto test = [&](Shape* shape) {
+            Hit shapeHit;
+            stats::countPrimitiveTest();
+            return shape->intersect(origin, ray, shapeHit) && shapeHit.t < tmax;
+        };
+
+        if(occluder && test(occluder)){
+            return true;
+        }
+        occluder = nullptr;
+
+        if(!built){
+            for(Shape* shape : shapes){
+                if(test(shape)){
+                    occluder = shape;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        for(Shape* shape : unbounded){
+            if(test(shape)){
+                occluder = shape;
+                return true;
+            }
+        }
+        return bvh.traverse(origin, ray, tmax, [&](int i, float &t) {
+            if(test(bounded[i])){
+                occluder = bounded[i];
+                t = -1.0f;
+                return true;
+            }
+            return false;
+        });
+    }
+
+    // Light arriving from every direction, null if there is none
+    void setEnvironment(const EnvironmentLight* environment) {
+        this->environment = environment;
+    }
+
+    const EnvironmentLight* getEnvironment() const {
+        return environment;
+    }
 
 private:
     std::vector<Shape*> shapes;
+    std::vector<Shape*> bounded;   // in the BVH
+    std::vector<Shape*> unbounded; // tested against every ray
+    std::vector<const Texture*> textures;
+    const EnvironmentLight* environment = nullptr;
+    BVH bvh;
+    bool built = false;
 };
 
 #endif
\ No newline at end of file
@@ -1,539 +1,260 @@
+#include <atomic>
+#include <csignal>
+#include <cstdio>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <cmath>
+#include <vector>
 
 #include <glm/glm.hpp>
 
 #include "Image.h"
+#include "ImageWriter.h"
 #include "Camera.h"
-#include "MatrixStack.h"
 #include "common.h"
-#include "Sphere.h"
-#include "Ellipsoid.h"
-#include "Plane.h"
-#include "Mesh.h"
+#include "PhotonMap.h"
+#include "SceneFile.h"
+#include "Renderer.h"
+#include "Texture.h"
+#include "TileCache.h"
+#include "Views.h"
 
 // This allows you to skip the `std::` in front of C++ standard library
 // functions. You can also say `using std::cout` to be more selective.
 // You should never do this in a header file.
 using namespace std;
 
-int width;
-int height;
+// Set by SIGINT/SIGTERM. The render stops after the tiles in progress and
+// saves its checkpoint.
+static atomic<bool> stopRequested(false);
 
-Image* output;
-vector<vector<float>> depthBuffer;
-
-glm::vec3 blinnPhongShading(Material mat, vector<Light>& lights, Scene& scene, glm::vec3& origin, glm::vec3& ray, Hit& hit, bool shadow=false, int recursionDepth=4) {
-    if (mat.isReflective) {
-        if(recursionDepth == 0){
-            return glm::vec3(0.0f);
-        }else{
-            glm::vec3 color = glm::vec3(0.0f);
-            glm::vec3 reflectDir = glm::reflect(ray, hit.n);
-
-            Hit reflectHit;
-            Material reflectMat;
-            bool reflectRayHit = scene.hit(hit.x + 0.001f * reflectDir, reflectDir, reflectHit, reflectMat);
+static void requestStop(int)
+{
+    stopRequested = true;
+}
 
-            if (reflectRayHit) {
-                return blinnPhongShading(reflectMat, lights, scene, hit.x, reflectDir, reflectHit, shadow, recursionDepth - 1);
-            }else{
-                return color;
-            }
+int main(int argc, char **argv)
+{
+    // Options may appear anywhere, everything else is positional
+    bool resume = false;
+    double checkpointInterval = 60.0;
+    string viewsFile;
+    int turntable = 0;
+    float stereo = 0.0f;
+    bool cubemap = false;
+    bool sortRays = false;
+    bool rasterPrimary = false;
+    double textureCacheMb = 0.0;
+    int photons = -1;
+    vector<string> args;
+    for (int i = 1; i < argc; i++) {
+        string arg(argv[i]);
+        if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointInterval = stod(argv[++i]);
+        } else if (arg == "--views" && i + 1 < argc) {
+            viewsFile = argv[++i];
+        } else if (arg == "--turntable" && i + 1 < argc) {
+            turntable = stoi(argv[++i]);
+        } else if (arg == "--stereo" && i + 1 < argc) {
+            stereo = stof(argv[++i]);
+        } else if (arg == "--cubemap") {
+            cubemap = true;
+        } else if (arg == "--sort-rays") {
+            sortRays = true;
+        } else if (arg == "--raster-primary") {
+            rasterPrimary = true;
+        } else if (arg == "--texture-cache" && i + 1 < argc) {
+            textureCacheMb = stod(argv[++i]);
+        } else if (arg == "--photons" && i + 1 < argc) {
+            photons = stoi(argv[++i]);
+        } else {
+            args.push_back(arg);
         }
     }
-    
-    glm::vec3 color = mat.amb;
-
-    for (Light light : lights) {
-        Hit shadowHit;
-        Material tempMaterial;
 
-        if(shadow){
-            bool shadowRayHit = scene.hit(hit.x + 0.001f * hit.n, glm::normalize(light.position - hit.x), shadowHit, tempMaterial);
-            if(shadowRayHit && shadowHit.t < glm::length(light.position - hit.x)){
-                continue;
-            }
+    if (args.size() == 3 && args[0] == "-c") {
+        // Compile a text scene into its binary form
+        SceneFile sceneFile;
+        if (!sceneFile.loadText(args[1]) || !sceneFile.writeBinary(args[2])) {
+            return 1;
         }
-
-        // diffuse
-        glm::vec3 lightDir = glm::normalize(light.position - hit.x);
-        glm::vec3 diffuse = mat.diff * max(0.0f, glm::dot(hit.n, lightDir));
-        // specular
-        glm::vec3 viewDir = glm::normalize(origin - hit.x);
-        glm::vec3 halfDir = glm::normalize(viewDir + lightDir);
-        glm::vec3 specular = mat.spec * pow(max(0.0f, glm::dot(hit.n, halfDir)), mat.exp);
-
-        color += (diffuse + specular) * light.intensity;
+        cout << "Wrote to " << args[2] << endl;
+        return 0;
     }
 
-    return color;
-}
-
-glm::vec3 normalShader(Hit hit) {
-    // Convert the normal from [-1, 1] to [0, 1]
-    glm::vec3 color = hit.n * 0.5f + 0.5f;
-    return color;
-}
-
-void scene1(Camera& c, glm::vec3 camPos, glm::mat4& V){
-    vector<glm::vec3> rays;
-    c.genRays(rays);
-
-    vector<Light> lights;
-    Light light1;
-    light1.position = glm::vec3(-2.0f, 1.0f, 1.0f);
-    light1.intensity = 1.0f;
-    lights.push_back(light1);
-
-    // Red Sphere
-    Material red;
-    red.diff = glm::vec3(1.0f, 0.0f, 0.0f);
-    red.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    red.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    red.exp = 300.0f;
-
-    Sphere sphereR(glm::vec3(-0.5, -1.0, 1.0), 1.0f, red);
-
-    // Green Sphere
-    Material green;
-    green.diff = glm::vec3(0.0f, 1.0f, 0.0f);
-    green.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    green.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    green.exp = 300.0f;
-
-    Sphere sphereG(glm::vec3(0.5, -1.0, -1.0), 1.0f, green);
-
-    // Blue Sphere
-    Material blue;
-    blue.diff = glm::vec3(0.0f, 0.0f, 1.0f); 
-    blue.spec = glm::vec3(1.0f, 1.0f, 0.5f); 
-    blue.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    blue.exp = 100.0f;
-
-    Sphere sphereB(glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, blue); 
-
-    Scene scene;
-    scene.addShape(&sphereR);
-    scene.addShape(&sphereG);
-    scene.addShape(&sphereB);
-
-    // Draw each pixel
-    for (int i = 0; i < rays.size(); i++) {
-        Hit hit;
-        Material hitMaterial;
-        bool rayHit = scene.hit(camPos, rays[i], hit, hitMaterial);
-        if(rayHit)
-        {
-            int x = i % width;
-            int y = i / width;
-
-            if(hit.t < depthBuffer[x][y]){
-                depthBuffer[x][y] = hit.t;
-            }else{
-                continue;
-            }
-
-            glm::vec3 color = blinnPhongShading(hitMaterial, lights, scene, camPos, rays[i], hit);
-            output->setPixel(x, y, static_cast<int>(std::min(color.r * 255.0f, 255.0f)), static_cast<int>(std::min(color.g * 255.0f, 255.0f)), static_cast<int>(std::min(color.b * 255.0f, 255.0f)));
+    if (args.size() == 3 && args[0] == "-t") {
+        // Convert an image into a tiled texture file read on demand
+        if (!Texture::convert(args[1], args[2])) {
+            return 1;
         }
+        cout << "Wrote to " << args[2] << endl;
+        return 0;
     }
-}
-
-void scene2(Camera& c, glm::vec3 camPos, glm::mat4& V){
-    vector<glm::vec3> rays;
-    c.genRays(rays);
-
-    vector<Light> lights;
-    Light light1;
-    light1.position = glm::vec3(-2.0f, 1.0f, 1.0f);
-    light1.intensity = 1.0f;
-    lights.push_back(light1);
-
-    // Red Sphere
-    Material red;
-    red.diff = glm::vec3(1.0f, 0.0f, 0.0f);
-    red.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    red.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    red.exp = 100.0f;
 
-    Sphere sphereR(glm::vec3(-0.5, -1.0, 1.0), 1.0f, red);
-
-    // Green Sphere
-    Material green;
-    green.diff = glm::vec3(0.0f, 1.0f, 0.0f);
-    green.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    green.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    green.exp = 100.0f;
-
-    Sphere sphereG(glm::vec3(0.5, -1.0, -1.0), 1.0f, green);
-
-    // Blue Sphere
-    Material blue;
-    blue.diff = glm::vec3(0.0f, 0.0f, 1.0f); 
-    blue.spec = glm::vec3(1.0f, 1.0f, 0.5f); 
-    blue.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    blue.exp = 100.0f;
-
-    Sphere sphereB(glm::vec3(0.0f, 1.0f, 0.0f), 1.0f, blue); 
-
-    Scene scene;
-    scene.addShape(&sphereR);
-    scene.addShape(&sphereG);
-    scene.addShape(&sphereB);
-
-    // Draw each pixel
-    for (int i = 0; i < rays.size(); i++) {
-        Hit hit;
-        Material hitMaterial;
-        bool rayHit = scene.hit(camPos, rays[i], hit, hitMaterial);
-        if(rayHit)
-        {
-            int x = i % width;
-            int y = i / width;
-
-            if(hit.t < depthBuffer[x][y]){
-                depthBuffer[x][y] = hit.t;
-            }else{
-                continue;
-            }
-            glm::vec3 color = blinnPhongShading(hitMaterial, lights, scene, camPos, rays[i], hit, true);
-            output->setPixel(x, y, static_cast<int>(std::min(color.r * 255.0f, 255.0f)), static_cast<int>(std::min(color.g * 255.0f, 255.0f)), static_cast<int>(std::min(color.b * 255.0f, 255.0f)));
-        }
+    if (args.size() < 3 || args.size() > 5) {
+        cout << "./A6 <SCENE> <IMAGE SIZE> <IMAGE FILENAME> [THREADS] [float|double] [--checkpoint SECONDS] [--resume] [--sort-rays]" << endl;
+        cout << "     [--views FILE | --turntable N | --stereo SEPARATION | --cubemap] [--texture-cache MB]" << endl;
+        cout << "     [--photons N] [--raster-primary]" << endl;
+        cout << "./A6 -c <SCENE FILE> <BINARY SCENE FILE> " << endl;
+        cout << "./A6 -t <IMAGE> <TEXTURE FILE> " << endl;
+        return 1;
+    }
+    
+    string sceneName(args[0]);
+    int size = stoi(args[1]);
+    string outputImage(args[2]);
+    int threads = args.size() >= 4 ? stoi(args[3]) : 0;
+    string precision = args.size() == 5 ? args[4] : "float";
+    if (precision != "float" && precision != "double") {
+        cout << "Invalid precision: " << precision << endl;
+        return 1;
+    }
+    // The extension picks the image format
+    if (!ImageWriter::create(outputImage)) {
+        return 1;
     }
-}
-
-void scene3(Camera& c, glm::vec3 camPos, glm::mat4& V){
-    vector<glm::vec3> rays;
-    c.genRays(rays);
-
-    vector<Light> lights;
-
-    // Light 1
-    Light light1;
-    light1.position = glm::vec3(1.0f, 2.0f, 2.0f);
-    light1.intensity = 0.5f;
-    lights.push_back(light1);
-
-    // Light 2
-    Light light2;
-    light2.position = glm::vec3(-1.0f, 2.0f, -1.0f);
-    light2.intensity = 0.5f;
-    lights.push_back(light2);
-
-    // Green Sphere
-    Material green;
-    green.diff = glm::vec3(0.0f, 1.0f, 0.0f);
-    green.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    green.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    green.exp = 100.0f;
-
-    Sphere sphereG(glm::vec3(-0.5, 0.0, -0.5), 1.0f, green);
-
-    // Red Ellipsoid
-    Material red;
-    red.diff = glm::vec3(1.0f, 0.0f, 0.0f);
-    red.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    red.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    red.exp = 100.0f;
-
-    MatrixStack modelMatrix;
-    modelMatrix.translate(0.5f, 0.0f, 0.5f);
-    modelMatrix.scale(0.5f, 0.6f, 0.2f);
-    Ellipsoid ellipsoidR(modelMatrix.topMatrix(), red);
-
-    // Plane
-    Material white;
-    white.diff = glm::vec3(1.0f, 1.0f, 1.0f);
-    white.spec = glm::vec3(0.0f, 0.0f, 0.0f);
-    white.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    white.exp = 0.0f;
-
-    Plane plane(glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), white);
-
-    Scene scene;
-    scene.addShape(&sphereG);
-    scene.addShape(&ellipsoidR);
-    scene.addShape(&plane);
-
-
-    // Draw each pixel
-    for (int i = 0; i < rays.size(); i++) {
-        Hit hit;
-        Material hitMaterial;
-        bool rayHit = scene.hit(camPos, rays[i], hit, hitMaterial);
-        if(rayHit)
-        {
-            int x = i % width;
-            int y = i / width;
-
-            if(hit.t < depthBuffer[x][y]){
-                depthBuffer[x][y] = hit.t;
-            }else{                
-                continue;
-            }
-
 
-            glm::vec3 color = blinnPhongShading(hitMaterial, lights, scene, camPos, rays[i], hit, true);
-            // glm::vec3 color = normalShader(hit);
-            output->setPixel(x, y, static_cast<int>(std::min(color.r * 255.0f, 255.0f)), static_cast<int>(std::min(color.g * 255.0f, 255.0f)), static_cast<int>(std::min(color.b * 255.0f, 255.0f)));
+    // A number picks one of the built-in scenes, anything else is a path
+    if (sceneName.find_first_not_of("0123456789") == string::npos) {
+        int scene = stoi(sceneName);
+        if (scene < 1 || scene > 8) {
+            std::cout << "Invalid scene number: " << scene << std::endl;
+            return 1;
         }
+        sceneName = SceneFile::builtinPath(scene);
     }
-}
-
-void scene4and5(Camera& c, glm::vec3 camPos, glm::mat4& V){
-    vector<glm::vec3> rays;
-    c.genRays(rays);
-
-    vector<Light> lights;
-
-    // Light 1
-    Light light1;
-    light1.position = glm::vec3(-1.0f, 2.0f, 1.0f);
-    light1.intensity = 0.5f;
-    lights.push_back(light1);
-
-    // Light 2
-    Light light2;
-    light2.position = glm::vec3(0.5f, -0.5f, 0.0f);
-    light2.intensity = 0.5f;
-    lights.push_back(light2);
-
-    // Red Sphere
-    Material red;
-    red.diff = glm::vec3(1.0f, 0.0f, 0.0f);
-    red.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    red.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    red.exp = 100.0f;
-    Sphere sphereR(glm::vec3(0.5f, -0.7f, 0.5f), 0.3f, red);
-
-    // Blue Sphere
-    Material blue;
-    blue.diff = glm::vec3(0.0f, 0.0f, 1.0f);
-    blue.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    blue.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    blue.exp = 100.0f;
-    Sphere sphereB(glm::vec3(1.0f, -0.7f, 0.0f), 0.3f, blue);
-
-    // Floor
-    Material white;
-    white.diff = glm::vec3(1.0f, 1.0f, 1.0f);
-    white.spec = glm::vec3(0.0f, 0.0f, 0.0f);
-    white.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    white.exp = 0.0f;
-    Plane floor(glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), white);
-
-    // Back Wall
-    Plane backWall(glm::vec3(0.0f, 0.0f, -3.0f), glm::vec3(0.0f, 0.0f, 1.0f), white);
-
-    // Reflective
-    Material reflective;
-    reflective.isReflective = true;
-
-    // Reflective Sphere 1
-    Sphere sphereRef1(glm::vec3(-0.5f, 0.0f, -0.5f), 1.0f, reflective);
-
-    // Reflective Sphere 2
-    Sphere sphereRef2(glm::vec3(1.5f, 0.0f, -1.5f), 1.0f, reflective);
-
-    Scene scene;
-    scene.addShape(&sphereR);
-    scene.addShape(&sphereB);
-    scene.addShape(&floor);
-    scene.addShape(&backWall);
-    scene.addShape(&sphereRef1);
-    scene.addShape(&sphereRef2);
 
-    // Draw each pixel
-    for (int i = 0; i < rays.size(); i++) {
-        Hit hit;
-        Material hitMaterial;
-        bool rayHit = scene.hit(camPos, rays[i], hit, hitMaterial);
-        if(rayHit)
-        {
-            int x = i % width;
-            int y = i / width;
-
-            if(hit.t < depthBuffer[x][y]){
-                depthBuffer[x][y] = hit.t;
-            }else{                
-                continue;
-            }
+    if (textureCacheMb > 0.0) {
+        TileCache::shared().setCapacity((size_t)(textureCacheMb * 1024.0 * 1024.0));
+    }
 
+    SceneFile sceneFile;
+    if (!sceneFile.load(sceneName)) {
+        return 1;
+    }
+    
+    int width = size;
+    int height = size;
+    float aspect = width / height;
 
-            glm::vec3 color = blinnPhongShading(hitMaterial, lights, scene, camPos, rays[i], hit, true);
-            // glm::vec3 color = normalShader(hit);
-            output->setPixel(x, y, static_cast<int>(std::min(color.r * 255.0f, 255.0f)), static_cast<int>(std::min(color.g * 255.0f, 255.0f)), static_cast<int>(std::min(color.b * 255.0f, 255.0f)));
+    // Without a view option the scene camera is the only view, written to
+    // <IMAGE FILENAME> itself
+    vector<ViewDesc> viewDescs;
+    if (!viewsFile.empty()) {
+        if (!loadViews(viewsFile, viewDescs)) {
+            return 1;
         }
+    } else if (turntable > 0) {
+        viewDescs = turntableViews(sceneFile.camera, turntable);
+    } else if (stereo > 0.0f) {
+        viewDescs = stereoViews(sceneFile.camera, stereo);
+    } else if (cubemap) {
+        viewDescs = cubemapViews(sceneFile.camera);
+    } else {
+        viewDescs.push_back({"", sceneFile.camera});
     }
-}
-
-void scene6(Camera& c, glm::vec3 camPos, glm::mat4& V){
-    vector<glm::vec3> rays;
-    c.genRays(rays);
-
-    vector<Light> lights;
-
-    // Light 1
-    Light light1;
-    light1.position = glm::vec3(-1.0f, 1.0f, 1.0f);
-    light1.intensity = 1.0f;
-    lights.push_back(light1);
-
-    // Blue Sphere
-    Material blue;
-    blue.diff = glm::vec3(0.0f, 0.0f, 1.0f);
-    blue.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    blue.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    blue.exp = 100.0f;
-
-    Mesh bunny("../resources/bunny.obj", glm::mat4(1.0f), blue);
 
     Scene scene;
-    scene.addShape(&bunny);
-
-    // Draw each pixel
-    for (int i = 0; i < rays.size(); i++) {
-        Hit hit;
-        Material hitMaterial;
-        bool rayHit = scene.hit(camPos, rays[i], hit, hitMaterial);
-        if(rayHit)
-        {
-            int x = i % width;
-            int y = i / width;
+    sceneFile.build(scene);
+    scene.buildBVH();
 
-            if(hit.t < depthBuffer[x][y]){
-                depthBuffer[x][y] = hit.t;
-            }else{                
-                continue;
-            }
+    Renderer renderer(scene, sceneFile.lights, sceneFile.shadows, sceneFile.depth);
+    renderer.setPrecision(precision == "double" ? Renderer::DOUBLE : Renderer::FLOAT);
+    renderer.setSortRays(sortRays);
+    renderer.setRasterPrimary(rasterPrimary);
 
-            glm::vec3 color = blinnPhongShading(hitMaterial, lights, scene, camPos, rays[i], hit, true);
-            // glm::vec3 color = normalShader(hit);
-            output->setPixel(x, y, static_cast<int>(std::min(color.r * 255.0f, 255.0f)), static_cast<int>(std::min(color.g * 255.0f, 255.0f)), static_cast<int>(std::min(color.b * 255.0f, 255.0f)));
-        }
+    // --photons overrides the scene's caustics, 0 turns them off
+    if (photons >= 0) {
+        sceneFile.caustics.photons = photons;
+    }
+    PhotonMap photonMap;
+    if (sceneFile.caustics.photons > 0) {
+        photonMap.setGather(sceneFile.caustics.gather, sceneFile.caustics.radius);
+        photonMap.trace(scene, sceneFile.lights, sceneFile.caustics.photons, sceneFile.depth, threads);
+        renderer.setCaustics(&photonMap);
     }
-}
-
-void scene7(Camera& c, glm::vec3 camPos, glm::mat4& V){
-    vector<glm::vec3> rays;
-    c.genRays(rays);
-
-    vector<Light> lights;
-
-    // Light 1
-    Light light1;
-    light1.position = glm::vec3(1.0f, 1.0f, 2.0f);
-    light1.intensity = 1.0f;
-    lights.push_back(light1);
-
-    // Blue Sphere
-    Material blue;
-    blue.diff = glm::vec3(0.0f, 0.0f, 1.0f);
-    blue.spec = glm::vec3(1.0f, 1.0f, 0.5f);
-    blue.amb = glm::vec3(0.1f, 0.1f, 0.1f);
-    blue.exp = 100.0f;
-
-    MatrixStack modelMatrix;
-    modelMatrix.translate(0.3f, -1.5f, 0.0f);
-    modelMatrix.rotate(20*M_PI/180, glm::vec3(1.0f, 0.0f, 0.0f));
-    modelMatrix.scale(1.5f, 1.5f, 1.5f);
-
-    Mesh bunny("../resources/bunny.obj", modelMatrix.topMatrix(), blue);
-
-    Scene scene;
-    scene.addShape(&bunny);
-
-    // Draw each pixel
-    for (int i = 0; i < rays.size(); i++) {
-        Hit hit;
-        Material hitMaterial;
-        bool rayHit = scene.hit(camPos, rays[i], hit, hitMaterial);
-        if(rayHit)
-        {
-            int x = i % width;
-            int y = i / width;
 
-            if(hit.t < depthBuffer[x][y]){
-                depthBuffer[x][y] = hit.t;
-            }else{                
-                continue;
+    // Finished tiles of each view are saved to <view image>.ckpt every
+    // checkpointInterval seconds and when the render is stopped
+    size_t dot = outputImage.find_last_of('.');
+    vector<string> filenames;
+    vector<unique_ptr<Camera> > cameras;
+    vector<unique_ptr<ImageWriter> > writers;
+    vector<unique_ptr<Checkpoint> > checkpoints;
+    vector<Renderer::View> views;
+    // A checkpoint is only reused for the same scene contents, not just the
+    // same scene path
+    string sceneKey = to_string(Checkpoint::makeKey(sceneFile.contentKey()));
+    for (const ViewDesc &desc : viewDescs) {
+        string filename = "./" + outputImage;
+        if (!desc.name.empty()) {
+            filename = "./" + outputImage.substr(0, dot) + "_" + desc.name + outputImage.substr(dot);
+        }
+        const CameraDesc &cam = desc.camera;
+        cameras.emplace_back(new Camera(width, height, cam.fov, aspect, cam.position, cam.front, cam.up));
+        writers.push_back(ImageWriter::create(filename));
+
+        char camString[256];
+        snprintf(camString, sizeof(camString), "%g %g %g %g %g %g %g %g %g %g",
+                 cam.position.x, cam.position.y, cam.position.z, cam.front.x, cam.front.y, cam.front.z,
+                 cam.up.x, cam.up.y, cam.up.z, cam.fov);
+        string settings = sceneName + "|" + sceneKey + "|" + to_string(size) + "|" + precision + "|" + camString + "|" + (writers.back()->bottomUp() ? "up" : "down");
+        if (sceneFile.caustics.photons > 0) {
+            settings += "|" + to_string(sceneFile.caustics.photons);
+        }
+        checkpoints.emplace_back(new Checkpoint(filename + ".ckpt", width, height, Renderer::TILE_SIZE, Checkpoint::makeKey(settings), checkpointInterval));
+        if (resume) {
+            if (checkpoints.back()->load()) {
+                cout << "Resuming " << filename << " with " << checkpoints.back()->getDoneCount() << " of " << checkpoints.back()->getTileCount() << " tiles done" << endl;
+            } else {
+                cout << "No checkpoint for " << filename << ", starting over" << endl;
             }
+        }
 
-            glm::vec3 color = blinnPhongShading(hitMaterial, lights, scene, camPos, rays[i], hit, true);
-            // glm::vec3 color = normalShader(hit);
-            output->setPixel(x, y, static_cast<int>(std::min(color.r * 255.0f, 255.0f)), static_cast<int>(std::min(color.g * 255.0f, 255.0f)), static_cast<int>(std::min(color.b * 255.0f, 255.0f)));
+        // The image is encoded band by band while it renders
+        if (!writers.back()->open(filename, width, height, Renderer::TILE_SIZE)) {
+            return 1;
         }
+        filenames.push_back(filename);
+        views.push_back({cameras.back().get(), writers.back().get(), checkpoints.back().get()});
     }
-}
 
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    renderer.setStopFlag(&stopRequested);
 
-int main(int argc, char **argv)
-{
-    if (argc != 4) {
-        cout << "./A6 <SCENE> <IMAGE SIZE> <IMAGE FILENAME> " << endl;
+    if (!renderer.render(views, threads)) {
+        for (auto &checkpoint : checkpoints) {
+            checkpoint->flush();
+        }
+        if (stopRequested) {
+            cout << "Stopped, continue with --resume" << endl;
+            return 3;
+        }
         return 1;
     }
-    
-    int scene = stoi(argv[1]);
-    int size = stoi(argv[2]);
-    string outputImage(argv[3]);
-    
-    width = size;
-    height = size;
-    float aspect = width / height;
-    for(int i = 0; i < width; i++){
-        depthBuffer.push_back(vector<float>());
-        for(int j = 0; j < height; j++){
-            depthBuffer[i].push_back(numeric_limits<float>::max());
-        }
+    for (auto &checkpoint : checkpoints) {
+        checkpoint->remove();
     }
-
-    output = new Image(width, height);
-
-    Camera camera(width, height, 45.0f, aspect, glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    if(scene == 8){
-        camera = Camera(width, height, 60.0f, aspect, glm::vec3(-3.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    if (sceneFile.caustics.photons > 0) {
+        const RayCounts &counts = renderer.getRayCounts();
+        cout << "Caustics: " << photonMap.size() << " of " << photonMap.getEmitted() << " photons stored ("
+             << photonMap.getMemory() / 1048576.0 << " MB), emission " << photonMap.getEmitSeconds() * 1000.0
+             << " ms, kd-tree build " << photonMap.getBuildSeconds() * 1000.0 << " ms, "
+             << counts.gathers << " gathers " << counts.gatherNanos / 1e6 << " ms over all threads" << endl;
     }
-
-    vector<glm::vec3> rays;
-    camera.genRays(rays);
-
-	auto MV = make_shared<MatrixStack>();
-	MV->loadIdentity();
-	camera.applyViewMatrix(MV);
-	glm::mat4 V = MV->topMatrix();
-    glm::mat4 C = inverse(V);
-	glm::vec3 camPos = glm::vec3(C[3][0], C[3][1], C[3][2]);
-
-    switch (scene) {
-        case 1:
-            scene1(camera, camPos, V);
-            break;
-        case 2:
-        case 8:
-            scene2(camera, camPos, V);
-            break;
-        case 3:
-            scene3(camera, camPos, V);
-            break;
-        case 4:
-        case 5:
-            scene4and5(camera, camPos, V);
-            break;
-        case 6:
-            scene6(camera, camPos, V);
-            break;
-        case 7:
-            scene7(camera, camPos, V);
-            break;
-        default:
-            std::cout << "Invalid scene number: " << scene << std::endl;
-            break;
+    const TileCache &cache = TileCache::shared();
+    if (cache.getMisses() > 0) {
+        cout << "Texture cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses, "
+             << cache.getSize() / 1048576.0 << " of " << cache.getCapacity() / 1048576.0 << " MB" << endl;
     }
-
-    output->writeToFile("./" + outputImage);
+#ifdef RT_STATS
+    for (size_t i = 0; i < views.size(); i++) {
+        stats::report(renderer.getPixelStats((int)i), width, height, filenames[i]);
+    }
+#endif
     return 0;
 }
-
@@ -0,0 +1,337 @@
+// Offline lighting for the GL viewers, traced with the ray tracer's Scene
+// and Mesh code on every hardware thread.
+//
+//   rtbake ao <OBJ FILE> <OUT.aov>
+//     Ambient occlusion of every vertex of the mesh, in the order the
+//     viewers' Shape::loadMesh puts them in posBuf (one entry per face
+//     corner). 1 is fully open, 0 fully occluded.
+//
+//   rtbake probes <SCENE FILE> <OUT.shp> <NX> <NY> <NZ>
+//     An NX x NY x NZ grid of irradiance probes over the bounds of the
+//     scene's bounded shapes, each the first 9 spherical harmonics (bands
+//     0-2) of the irradiance arriving at the probe: light of the scene's
+//     lights reflected once by diffuse surfaces, and the environment. The
+//     direct light of point lights is left to the viewers' shaders.
+//
+// Both files are little-endian:
+//
+//   .aov  char[4] "AOVB", uint32 version (1), uint32 vertex count,
+//         float ao[vertex count]
+//   .shp  char[4] "SHPR", uint32 version (1), int32 nx, ny, nz,
+//         float min[3], max[3] (probe (0,0,0) sits at min, (nx-1, ny-1,
+//         nz-1) at max), then nx * ny * nz probes with x varying fastest,
+//         each float rgb[9][3] in the order Y00, Y1-1, Y10, Y11, Y2-2,
+//         Y2-1, Y20, Y21, Y22. The coefficients already include the cosine
+//         convolution, so a shader gets the irradiance for normal n as
+//         sum(rgb[i] * Y_i(n)) and the diffuse color as albedo / pi times
+//         that.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EnvironmentLight.h"
+#include "Mesh.h"
+#include "Renderer.h"
+#include "Sampling.h"
+#include "SceneFile.h"
+
+using namespace std;
+
+// Sample k of n: Hammersley points shifted by an offset derived from seed
+static void hammersley(uint32_t seed, int k, int n, float &u, float &v)
+{
+	u = (k + 0.5f) / n + (hashBits(seed) >> 8) * 5.9604645e-8f;
+	v = radicalInverse(k) + (hashBits(seed ^ 0x5bd1e995u) >> 8) * 5.9604645e-8f;
+	u = min(u - floor(u), 0.99999994f);
+	v = min(v - floor(v), 0.99999994f);
+}
+
+// Runs task(i) for i in [0, n) on every hardware thread
+static void parallelFor(int n, const function<void(int)> &task)
+{
+	atomic<int> next(0);
+	auto worker = [&]() {
+		for(int i = next++; i < n; i = next++) {
+			task(i);
+		}
+	};
+	vector<thread> workers;
+	for(int t = 1; t < Renderer::defaultThreads(); t++) {
+		workers.emplace_back(worker);
+	}
+	worker();
+	for(thread &t : workers) {
+		t.join();
+	}
+}
+
+static double now()
+{
+	using namespace chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool bakeAO(const string &objFile, const string &outFile, int rays, float distance)
+{
+	auto geometry = make_shared<MeshGeometry>();
+	if(geometry->loadObj(objFile) == 0) {
+		cerr << "Couldn't load " << objFile << endl;
+		return false;
+	}
+	Material material;
+	material.diff = material.spec = material.amb = glm::vec3(0.0f);
+	material.exp = 0.0f;
+	Mesh mesh(geometry, glm::mat4(1.0f), material);
+	Scene scene;
+	scene.addShape(&mesh);
+	scene.buildBVH();
+
+	// The occlusion distance is relative to the mesh so that the viewers'
+	// fitToUnitBox doesn't change the result
+	glm::vec3 extent(geometry->xmax - geometry->xmin, geometry->ymax - geometry->ymin, geometry->zmax - geometry->zmin);
+	float reach = distance * glm::length(extent);
+	float offset = 1e-4f * glm::length(extent);
+
+	const vector<float> &pos = geometry->posBuf;
+	const vector<float> &nor = geometry->norBuf;
+	const int numVertices = (int)pos.size() / 3;
+	vector<float> ao(numVertices);
+	double start = now();
+	parallelFor(numVertices, [&](int v) {
+		glm::vec3 p(pos[3 * v], pos[3 * v + 1], pos[3 * v + 2]);
+		glm::vec3 n;
+		if(nor.size() == pos.size()) {
+			n = glm::vec3(nor[3 * v], nor[3 * v + 1], nor[3 * v + 2]);
+		} else {
+			int t = v / 3 * 9;
+			glm::vec3 a(pos[t], pos[t + 1], pos[t + 2]);
+			glm::vec3 b(pos[t + 3], pos[t + 4], pos[t + 5]);
+			glm::vec3 c(pos[t + 6], pos[t + 7], pos[t + 8]);
+			n = glm::cross(b - a, c - a);
+		}
+		if(glm::dot(n, n) == 0.0f) {
+			ao[v] = 1.0f;
+			return;
+		}
+		n = glm::normalize(n);
+		glm::vec3 t, b;
+		basis(n, t, b);
+
+		// Seeded by the position, so the copies of a vertex in different
+		// faces agree
+		uint32_t seed = 0;
+		for(int i = 0; i < 3; i++) {
+			uint32_t bits;
+			memcpy(&bits, &p[i], 4);
+			seed = hashBits(seed ^ bits);
+		}
+
+		// Cosine weighted directions, so the open fraction is the
+		// cosine weighted visibility
+		int open = 0;
+		for(int k = 0; k < rays; k++) {
+			float u, w;
+			hammersley(seed, k, rays, u, w);
+			float r = sqrt(u);
+			float phi = 2.0f * PI * w;
+			glm::vec3 dir = t * (r * cos(phi)) + b * (r * sin(phi)) + n * sqrt(max(0.0f, 1.0f - u));
+			if(!scene.occluded(p + offset * n, dir, reach)) {
+				open++;
+			}
+		}
+		ao[v] = (float)open / rays;
+	});
+	cout << "Traced " << (uint64_t)numVertices * rays << " rays for " << numVertices << " vertices in " << now() - start << " s" << endl;
+
+	FILE *fp = fopen(outFile.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't open " << outFile << endl;
+		return false;
+	}
+	const uint32_t header[2] = {1, (uint32_t)numVertices};
+	fwrite("AOVB", 1, 4, fp);
+	fwrite(header, sizeof(header), 1, fp);
+	fwrite(ao.data(), sizeof(float), ao.size(), fp);
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if(!ok) {
+		cerr << "Couldn't write to " << outFile << endl;
+		return false;
+	}
+	cout << "Wrote to " << outFile << endl;
+	return true;
+}
+
+// Real spherical harmonics of bands 0-2 at the unit vector d
+static void shBasis(const glm::vec3 &d, float y[9])
+{
+	y[0] = 0.282095f;
+	y[1] = 0.488603f * d.y;
+	y[2] = 0.488603f * d.z;
+	y[3] = 0.488603f * d.x;
+	y[4] = 1.092548f * d.x * d.y;
+	y[5] = 1.092548f * d.y * d.z;
+	y[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+	y[7] = 1.092548f * d.x * d.z;
+	y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+// Radiance leaving the surface hit by a probe ray: the diffuse part of the
+// renderer's shading, which doesn't depend on where it is seen from. Area
+// lights count as point lights at their centers.
+static glm::vec3 surfaceRadiance(Scene &scene, const vector<Light> &lights, bool shadows, const glm::vec3 &dir, Hit &hit, const Material &mat)
+{
+	if(mat.isReflective) {
+		return glm::vec3(0.0f);
+	}
+	glm::vec3 n = glm::dot(hit.n, dir) > 0.0f ? -hit.n : hit.n;
+	glm::vec3 x = hit.x + 0.001f * n;
+	glm::vec3 color = mat.amb;
+	for(const Light &light : lights) {
+		glm::vec3 toLight = light.position - hit.x;
+		float length = glm::length(toLight);
+		toLight /= length;
+		float cosine = glm::dot(n, toLight);
+		if(cosine <= 0.0f || (shadows && scene.occluded(x, toLight, length))) {
+			continue;
+		}
+		color += mat.diff * cosine * light.intensity;
+	}
+	return color;
+}
+
+static bool bakeProbes(const string &sceneFileName, const string &outFile, int nx, int ny, int nz, int rays)
+{
+	SceneFile sceneFile;
+	if(!sceneFile.load(sceneFileName)) {
+		return false;
+	}
+	Scene scene;
+	sceneFile.build(scene);
+	scene.buildBVH();
+	AABB bounds;
+	if(!scene.getBounds(bounds)) {
+		cerr << sceneFileName << " has no bounded shapes to place probes around" << endl;
+		return false;
+	}
+	const EnvironmentLight *environment = scene.getEnvironment();
+
+	// Cosine lobe convolution per band (Ramamoorthi and Hanrahan)
+	const float bandScale[3] = {PI, 2.0f * PI / 3.0f, PI / 4.0f};
+	const int band[9] = {0, 1, 1, 1, 2, 2, 2, 2, 2};
+	const int numProbes = nx * ny * nz;
+	vector<float> coefficients((size_t)numProbes * 27);
+	double start = now();
+	parallelFor(numProbes, [&](int i) {
+		glm::ivec3 cell(i % nx, (i / nx) % ny, i / (nx * ny));
+		glm::vec3 f(nx > 1 ? (float)cell.x / (nx - 1) : 0.5f,
+		            ny > 1 ? (float)cell.y / (ny - 1) : 0.5f,
+		            nz > 1 ? (float)cell.z / (nz - 1) : 0.5f);
+		glm::vec3 p = bounds.min + f * (bounds.max - bounds.min);
+
+		glm::vec3 sh[9];
+		for(int k = 0; k < rays; k++) {
+			// Uniform directions over the sphere
+			float u, v;
+			hammersley(hashBits(i), k, rays, u, v);
+			float z = 1.0f - 2.0f * u;
+			float r = sqrt(max(0.0f, 1.0f - z * z));
+			float phi = 2.0f * PI * v;
+			glm::vec3 dir(r * cos(phi), r * sin(phi), z);
+
+			glm::vec3 radiance(0.0f);
+			Hit hit;
+			Material mat;
+			if(scene.hit(p, dir, hit, mat)) {
+				radiance = surfaceRadiance(scene, sceneFile.lights, sceneFile.shadows, dir, hit, mat);
+			} else if(environment) {
+				radiance = environment->eval(dir);
+			}
+			float y[9];
+			shBasis(dir, y);
+			for(int j = 0; j < 9; j++) {
+				sh[j] += radiance * y[j];
+			}
+		}
+		float *out = &coefficients[(size_t)i * 27];
+		for(int j = 0; j < 9; j++) {
+			glm::vec3 c = sh[j] * (4.0f * PI / rays) * bandScale[band[j]];
+			out[3 * j] = c.r;
+			out[3 * j + 1] = c.g;
+			out[3 * j + 2] = c.b;
+		}
+	});
+	cout << "Traced " << (uint64_t)numProbes * rays << " rays for " << numProbes << " probes in " << now() - start << " s" << endl;
+
+	FILE *fp = fopen(outFile.c_str(), "wb");
+	if(!fp) {
+		cerr << "Couldn't open " << outFile << endl;
+		return false;
+	}
+	const uint32_t version = 1;
+	const int32_t dims[3] = {nx, ny, nz};
+	fwrite("SHPR", 1, 4, fp);
+	fwrite(&version, sizeof(version), 1, fp);
+	fwrite(dims, sizeof(dims), 1, fp);
+	fwrite(&bounds.min[0], sizeof(float), 3, fp);
+	fwrite(&bounds.max[0], sizeof(float), 3, fp);
+	fwrite(coefficients.data(), sizeof(float), coefficients.size(), fp);
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if(!ok) {
+		cerr << "Couldn't write to " << outFile << endl;
+		return false;
+	}
+	cout << "Wrote to " << outFile << endl;
+	return true;
+}
+
+static void usage()
+{
+	cout << "Usage: rtbake ao <OBJ FILE> <OUT.aov> [options]" << endl;
+	cout << "       rtbake probes <SCENE FILE> <OUT.shp> <NX> <NY> <NZ> [options]" << endl;
+	cout << "  --rays N            rays per vertex or probe (default 256)" << endl;
+	cout << "  --distance F        AO reach as a fraction of the mesh diagonal (default 0.25)" << endl;
+}
+
+int main(int argc, char **argv)
+{
+	int rays = 256;
+	float distance = 0.25f;
+	vector<string> args;
+	for(int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if(arg == "--rays" && i + 1 < argc) {
+			rays = max(1, stoi(argv[++i]));
+		} else if(arg == "--distance" && i + 1 < argc) {
+			distance = stof(argv[++i]);
+		} else {
+			args.push_back(arg);
+		}
+	}
+
+	if(args.size() == 3 && args[0] == "ao") {
+		return bakeAO(args[1], args[2], rays, distance) ? 0 : 1;
+	}
+	if(args.size() == 6 && args[0] == "probes") {
+		int nx = stoi(args[3]), ny = stoi(args[4]), nz = stoi(args[5]);
+		if(nx < 1 || ny < 1 || nz < 1) {
+			usage();
+			return 1;
+		}
+		return bakeProbes(args[1], args[2], nx, ny, nz, rays) ? 0 : 1;
+	}
+	usage();
+	return 1;
+}
@@ -0,0 +1,401 @@
+// Ray tracer benchmark. Renders the built-in scenes at several image sizes
+// and thread counts, with float or double shading, and reports the rays
+// per second, the number of rays of each kind, the scene and BVH build
+// times and the peak resident set size. Results are written as JSON and can be compared
+// against a stored baseline.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Camera.h"
+#include "Image.h"
+#include "Renderer.h"
+#include "SceneFile.h"
+
+using namespace std;
+
+struct Run
+{
+	int scene = 0;
+	int size = 0;
+	int threads = 0;
+	int precisionBits = 32;
+	int sortedRays = 0;
+	double loadMs = 0.0;
+	double bvhMs = 0.0;
+	double renderMs = 0.0;
+	RayCounts rays;
+	double peakRssKb = 0.0;
+
+	// The kinds are traced interleaved in one render, so only the total
+	// has a time of its own
+	double mrays() const { return renderMs > 0.0 ? rays.total() / (renderMs * 1000.0) : 0.0; }
+};
+
+static double now()
+{
+	using namespace chrono;
+	return duration<double, milli>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Resets the peak RSS where the OS allows it (Linux), so that each scene
+// reports its own peak instead of the largest so far
+static void resetPeakRss()
+{
+#if defined(__linux__)
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if(fp) {
+		fputs("5", fp);
+		fclose(fp);
+	}
+#endif
+}
+
+static double peakRssKb()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+	if(K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+		return pmc.PeakWorkingSetSize / 1024.0;
+	}
+	return 0.0;
+#else
+#if defined(__linux__)
+	ifstream status("/proc/self/status");
+	string line;
+	while(getline(status, line)) {
+		if(line.compare(0, 6, "VmHWM:") == 0) {
+			return atof(line.c_str() + 6);
+		}
+	}
+#endif
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024.0;
+#else
+	return (double)usage.ru_maxrss;
+#endif
+#endif
+}
+
+static vector<int> parseList(const string &s)
+{
+	vector<int> values;
+	stringstream ss(s);
+	string item;
+	while(getline(ss, item, ',')) {
+		values.push_back(stoi(item));
+	}
+	return values;
+}
+
+static void writeJson(const string &filename, const vector<Run> &runs)
+{
+	FILE *fp = fopen(filename.c_str(), "w");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		return;
+	}
+	fprintf(fp, "{\n  \"version\": 1,\n  \"hardware_threads\": %d,\n  \"runs\": [\n", Renderer::defaultThreads());
+	for(size_t i = 0; i < runs.size(); i++) {
+		const Run &r = runs[i];
+		fprintf(fp, "    {\"scene\": %d, \"size\": %d, \"threads\": %d, \"precision_bits\": %d, \"sorted_rays\": %d, "
+		            "\"load_ms\": %.3f, \"bvh_ms\": %.3f, \"render_ms\": %.3f, "
+		            "\"primary_rays\": %llu, \"shadow_rays\": %llu, \"reflection_rays\": %llu, "
+		            "\"mrays_per_s\": %.4f, \"peak_rss_kb\": %.0f}%s\n",
+		        r.scene, r.size, r.threads, r.precisionBits, r.sortedRays, r.loadMs, r.bvhMs, r.renderMs,
+		        (unsigned long long)r.rays.primary, (unsigned long long)r.rays.shadow, (unsigned long long)r.rays.reflection,
+		        r.mrays(), r.peakRssKb, i + 1 < runs.size() ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	fclose(fp);
+	cout << "Wrote to " << filename << endl;
+}
+
+// Just enough JSON to read back the files written above: the runs are
+// flat objects of numbers.
+static bool readJson(const string &filename, vector< map<string, double> > &runs)
+{
+	ifstream in(filename);
+	if(!in) {
+		cerr << "Couldn't open " << filename << endl;
+		return false;
+	}
+	stringstream buffer;
+	buffer << in.rdbuf();
+	string text = buffer.str();
+
+	size_t pos = text.find("\"runs\"");
+	if(pos == string::npos) {
+		cerr << filename << " has no runs" << endl;
+		return false;
+	}
+	pos = text.find('[', pos);
+	while(pos != string::npos) {
+		size_t open = text.find('{', pos);
+		size_t end = text.find(']', pos);
+		if(open == string::npos || open > end) {
+			break;
+		}
+		size_t close = text.find('}', open);
+		string object = text.substr(open + 1, close - open - 1);
+		map<string, double> run;
+		size_t k = 0;
+		while((k = object.find('"', k)) != string::npos) {
+			size_t kend = object.find('"', k + 1);
+			string key = object.substr(k + 1, kend - k - 1);
+			size_t colon = object.find(':', kend);
+			run[key] = atof(object.c_str() + colon + 1);
+			k = object.find(',', colon);
+			if(k == string::npos) {
+				break;
+			}
+		}
+		runs.push_back(run);
+		pos = close;
+	}
+	return true;
+}
+
+// Returns the number of regressions. A metric regresses when it is worse
+// than the baseline by more than the tolerance (a fraction). Times below a
+// millisecond are too noisy to compare. More rays of a kind for the same
+// image is more work, so the counts regress when they grow.
+static int compare(const vector< map<string, double> > &baseline, const vector< map<string, double> > &current, double tolerance)
+{
+	struct Metric { const char *name; bool higherIsBetter; };
+	const Metric metrics[] = {
+		{"mrays_per_s", true},
+		{"render_ms", false},
+		{"primary_rays", false},
+		{"shadow_rays", false},
+		{"reflection_rays", false},
+		{"load_ms", false},
+		{"bvh_ms", false},
+		{"peak_rss_kb", false},
+	};
+
+	int regressions = 0;
+	int matched = 0;
+	// Results written before precision_bits existed are float runs
+	auto bits = [](const map<string, double> &run) {
+		return run.count("precision_bits") ? run.at("precision_bits") : 32.0;
+	};
+	auto sorted = [](const map<string, double> &run) {
+		return run.count("sorted_rays") ? run.at("sorted_rays") : 0.0;
+	};
+	for(const auto &cur : current) {
+		const map<string, double> *base = nullptr;
+		for(const auto &b : baseline) {
+			if(b.at("scene") == cur.at("scene") && b.at("size") == cur.at("size") && b.at("threads") == cur.at("threads") && bits(b) == bits(cur) && sorted(b) == sorted(cur)) {
+				base = &b;
+				break;
+			}
+		}
+		if(!base) {
+			continue;
+		}
+		matched++;
+		for(const Metric &m : metrics) {
+			if(!base->count(m.name) || !cur.count(m.name)) {
+				continue;
+			}
+			double b = base->at(m.name);
+			double c = cur.at(m.name);
+			bool timing = strstr(m.name, "_ms") != nullptr;
+			if(b <= 0.0 || (timing && b < 1.0 && c < 1.0)) {
+				continue;
+			}
+			double change = (c - b) / b;
+			bool worse = m.higherIsBetter ? change < -tolerance : change > tolerance;
+			if(worse) {
+				printf("REGRESSION scene %g size %g threads %g bits %g sorted %g: %s %.4g -> %.4g (%+.1f%%)\n",
+				       cur.at("scene"), cur.at("size"), cur.at("threads"), bits(cur), sorted(cur), m.name, b, c, change * 100.0);
+				regressions++;
+			}
+		}
+	}
+	printf("Compared %d runs against the baseline, %d regressions (tolerance %.0f%%)\n", matched, regressions, tolerance * 100.0);
+	return regressions;
+}
+
+static void usage()
+{
+	cout << "Usage: rtbench [options]" << endl;
+	cout << "  --scenes 1,2,3      built-in scenes to render (default 1,2,3,4,6,7,8)" << endl;
+	cout << "  --sizes 128,256     image sizes (default 128,256,512)" << endl;
+	cout << "  --threads 1,4       thread counts (default 1 and powers of two up to all hardware threads)" << endl;
+	cout << "  --precision LIST    shading precisions, float and/or double (default float)" << endl;
+	cout << "  --sort-rays 0,1     render without and/or with secondary ray sorting (default 0)" << endl;
+	cout << "  --repeat N          renders per configuration, the fastest is kept (default 3)" << endl;
+	cout << "  --resources DIR     directory with the scene files (default ../resources)" << endl;
+	cout << "  --out FILE          JSON results (default rtbench.json)" << endl;
+	cout << "  --compare FILE      compare against a baseline, exit code 2 on regressions" << endl;
+	cout << "  --input FILE        compare this result file instead of running the benchmark" << endl;
+	cout << "  --tolerance F       allowed slowdown as a fraction (default 0.1)" << endl;
+}
+
+int main(int argc, char **argv)
+{
+	vector<int> scenes = {1, 2, 3, 4, 6, 7, 8};
+	vector<int> sizes = {128, 256, 512};
+	vector<int> threadCounts;
+	vector<Renderer::Precision> precisions = {Renderer::FLOAT};
+	vector<int> sortModes = {0};
+	int repeat = 3;
+	string resources = "../resources";
+	string out = "rtbench.json";
+	string baselineFile;
+	string inputFile;
+	double tolerance = 0.1;
+
+	for(int i = 1; i < argc; i++) {
+		string arg(argv[i]);
+		if(arg == "--help" || arg == "-h" || i + 1 >= argc) {
+			usage();
+			return arg == "--help" || arg == "-h" ? 0 : 1;
+		}
+		string value(argv[++i]);
+		if(arg == "--scenes") {
+			scenes = parseList(value);
+		} else if(arg == "--sizes") {
+			sizes = parseList(value);
+		} else if(arg == "--threads") {
+			threadCounts = parseList(value);
+		} else if(arg == "--precision") {
+			precisions.clear();
+			stringstream ss(value);
+			string item;
+			while(getline(ss, item, ',')) {
+				if(item == "float") {
+					precisions.push_back(Renderer::FLOAT);
+				} else if(item == "double") {
+					precisions.push_back(Renderer::DOUBLE);
+				} else {
+					usage();
+					return 1;
+				}
+			}
+		} else if(arg == "--sort-rays") {
+			sortModes = parseList(value);
+		} else if(arg == "--repeat") {
+			repeat = max(1, stoi(value));
+		} else if(arg == "--resources") {
+			resources = value;
+		} else if(arg == "--out") {
+			out = value;
+		} else if(arg == "--compare") {
+			baselineFile = value;
+		} else if(arg == "--input") {
+			inputFile = value;
+		} else if(arg == "--tolerance") {
+			tolerance = stod(value);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if(!inputFile.empty()) {
+		vector< map<string, double> > baseline, current;
+		if(baselineFile.empty() || !readJson(baselineFile, baseline) || !readJson(inputFile, current)) {
+			usage();
+			return 1;
+		}
+		return compare(baseline, current, tolerance) > 0 ? 2 : 0;
+	}
+
+	if(threadCounts.empty()) {
+		int hardware = Renderer::defaultThreads();
+		for(int t = 1; t < hardware; t *= 2) {
+			threadCounts.push_back(t);
+		}
+		threadCounts.push_back(hardware);
+	}
+
+	vector<Run> runs;
+	printf("%5s %5s %7s %4s %4s %9s %9s %10s %9s %11s %11s %11s %9s\n",
+	       "scene", "size", "threads", "bits", "sort", "load ms", "bvh ms", "render ms", "Mrays/s", "primary", "shadow", "reflect", "RSS MB");
+	for(int sceneNumber : scenes) {
+		resetPeakRss();
+
+		double t0 = now();
+		SceneFile sceneFile;
+		if(!sceneFile.load(SceneFile::builtinPath(sceneNumber, resources))) {
+			return 1;
+		}
+		Scene scene;
+		sceneFile.build(scene);
+		double t1 = now();
+		scene.buildBVH();
+		double t2 = now();
+
+		Renderer renderer(scene, sceneFile.lights, sceneFile.shadows, sceneFile.depth);
+		for(int size : sizes) {
+			const CameraDesc &cam = sceneFile.camera;
+			Camera camera(size, size, cam.fov, 1.0f, cam.position, cam.front, cam.up);
+			for(int threads : threadCounts) {
+				for(Renderer::Precision precision : precisions) {
+					for(int sortMode : sortModes) {
+						Image image(size, size);
+						Run run;
+						run.scene = sceneNumber;
+						run.size = size;
+						run.threads = threads;
+						run.precisionBits = precision == Renderer::DOUBLE ? 64 : 32;
+						run.sortedRays = sortMode != 0;
+						run.loadMs = t1 - t0;
+						run.bvhMs = t2 - t1;
+						run.renderMs = HUGE_VAL;
+						renderer.setPrecision(precision);
+						renderer.setSortRays(sortMode != 0);
+						for(int r = 0; r < repeat; r++) {
+							double start = now();
+							renderer.render(camera, image, threads);
+							run.renderMs = min(run.renderMs, now() - start);
+						}
+						run.rays = renderer.getRayCounts();
+						run.peakRssKb = peakRssKb();
+						runs.push_back(run);
+
+						printf("%5d %5d %7d %4d %4d %9.2f %9.2f %10.2f %9.3f %11llu %11llu %11llu %9.1f\n",
+						       run.scene, run.size, run.threads, run.precisionBits, run.sortedRays, run.loadMs, run.bvhMs, run.renderMs,
+						       run.mrays(), (unsigned long long)run.rays.primary, (unsigned long long)run.rays.shadow,
+						       (unsigned long long)run.rays.reflection, run.peakRssKb / 1024.0);
+						fflush(stdout);
+					}
+				}
+			}
+		}
+	}
+
+	writeJson(out, runs);
+
+	if(!baselineFile.empty()) {
+		vector< map<string, double> > baseline, current;
+		if(!readJson(baselineFile, baseline) || !readJson(out, current)) {
+			return 1;
+		}
+		return compare(baseline, current, tolerance) > 0 ? 2 : 0;
+	}
+	return 0;
+}
@@ -0,0 +1,210 @@
+// Procedural benchmark scene generator. Writes a text scene file (see
+// src/SceneFile.h) that A6 can render directly or compile with `A6 -c`.
+// The random numbers only depend on the seed, so the same arguments give
+// the same scene from the same build. Builds with another compiler or C
+// library can differ in the last printed digits, since the positions go
+// through libm (sin, cos, cbrt) and printf's rounding.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// PCG32. Used instead of <random> because the standard distributions are
+// not guaranteed to produce the same numbers on different libraries.
+class Rng
+{
+public:
+	Rng(uint64_t seed) : state(0), inc((seed << 1u) | 1u)
+	{
+		next();
+		state += seed;
+		next();
+	}
+
+	uint32_t next()
+	{
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = (uint32_t)(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+	}
+
+	// Uniform in [0, 1)
+	double uniform() { return next() * (1.0 / 4294967296.0); }
+	double uniform(double a, double b) { return a + (b - a) * uniform(); }
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+static const int NUM_MATERIALS = 16;
+
+// Random diffuse palette m0..m15 and a mirror material
+static void writeMaterials(FILE *fp, Rng &rng)
+{
+	fprintf(fp, "#        name   diffuse  specular   ambient      exp\n");
+	for(int i = 0; i < NUM_MATERIALS; i++) {
+		fprintf(fp, "material m%-3d  %.3f %.3f %.3f  1 1 0.5  0.1 0.1 0.1  %d\n",
+		        i, rng.uniform(0.1, 1.0), rng.uniform(0.1, 1.0), rng.uniform(0.1, 1.0), 20 + (int)(rng.uniform() * 280));
+	}
+	fprintf(fp, "material mirror reflective\n\n");
+}
+
+// Sphere flake: every sphere carries nine children of a third of its radius
+static void flakeChildren(FILE *fp, double x, double y, double z, double r,
+                          double dx, double dy, double dz, int depth, long long &count)
+{
+	if(depth == 0) {
+		return;
+	}
+	// Build a basis around the direction to the parent
+	double ax = fabs(dx) < 0.9 ? 1.0 : 0.0, ay = fabs(dx) < 0.9 ? 0.0 : 1.0, az = 0.0;
+	double ux = dy * az - dz * ay, uy = dz * ax - dx * az, uz = dx * ay - dy * ax;
+	double ul = sqrt(ux * ux + uy * uy + uz * uz);
+	ux /= ul; uy /= ul; uz /= ul;
+	double vx = dy * uz - dz * uy, vy = dz * ux - dx * uz, vz = dx * uy - dy * ux;
+
+	double cr = r / 3.0;
+	for(int i = 0; i < 9; i++) {
+		// Six around the equator, three tilted towards the pole
+		double phi = (i < 6) ? i * M_PI / 3.0 : (i - 6) * 2.0 * M_PI / 3.0 + M_PI / 6.0;
+		double theta = (i < 6) ? M_PI / 2.0 : M_PI / 5.0;
+		double cx = sin(theta) * cos(phi), cy = sin(theta) * sin(phi), cz = cos(theta);
+		double ndx = cx * ux + cy * vx + cz * dx;
+		double ndy = cx * uy + cy * vy + cz * dy;
+		double ndz = cx * uz + cy * vz + cz * dz;
+		double px = x + ndx * (r + cr), py = y + ndy * (r + cr), pz = z + ndz * (r + cr);
+		fprintf(fp, "sphere m%d  %.6g %.6g %.6g  %.6g\n", depth % NUM_MATERIALS, px, py, pz, cr);
+		count++;
+		flakeChildren(fp, px, py, pz, cr, ndx, ndy, ndz, depth - 1, count);
+	}
+}
+
+static long long writeFlake(FILE *fp, int depth)
+{
+	fprintf(fp, "camera 2.1 1.7 1.3  -2.1 -1.7 -1.3  0 1 0  45\n");
+	fprintf(fp, "shadows on\n\n");
+	fprintf(fp, "light  4 6 3  0.6\n");
+	fprintf(fp, "light -3 4 5  0.4\n\n");
+	fprintf(fp, "material white  1 1 1  0 0 0  0.1 0.1 0.1  0\n");
+	fprintf(fp, "plane white  0 -0.5 0  0 1 0\n\n");
+	fprintf(fp, "sphere mirror  0 0 0  0.5\n");
+	long long count = 1;
+	flakeChildren(fp, 0.0, 0.0, 0.0, 0.5, 0.0, 1.0, 0.0, depth, count);
+	return count;
+}
+
+// Random spheres (or ellipsoids) in a cube that grows with the count so the
+// density, and therefore the image, stays about the same at every scale
+static long long writeField(FILE *fp, Rng &rng, long long count, bool ellipsoids)
+{
+	double side = cbrt((double)count);
+	double radius = 0.35;
+	fprintf(fp, "camera %.6g %.6g %.6g  -1 -0.6 -1  0 1 0  50\n", side * 1.6, side * 1.1, side * 1.6);
+	fprintf(fp, "shadows on\n\n");
+	fprintf(fp, "light %.6g %.6g %.6g  0.6\n", side * 2.0, side * 3.0, side * 0.5);
+	fprintf(fp, "light %.6g %.6g %.6g  0.4\n\n", -side, side * 2.0, side * 2.0);
+	for(long long i = 0; i < count; i++) {
+		double x = rng.uniform(-side / 2, side / 2);
+		double y = rng.uniform(-side / 2, side / 2);
+		double z = rng.uniform(-side / 2, side / 2);
+		int mat = (int)(rng.uniform() * NUM_MATERIALS);
+		if(!ellipsoids) {
+			fprintf(fp, "sphere m%d  %.6g %.6g %.6g  %.4g\n", mat, x, y, z, radius * rng.uniform(0.3, 1.0));
+		} else {
+			fprintf(fp, "push\ntranslate %.6g %.6g %.6g\nrotate %.4g  %.4g %.4g %.4g\nscale %.4g %.4g %.4g\nellipsoid m%d\npop\n",
+			        x, y, z, rng.uniform(0.0, 360.0), rng.uniform(-1.0, 1.0), rng.uniform(-1.0, 1.0), rng.uniform(0.1, 1.0),
+			        radius * rng.uniform(0.2, 1.0), radius * rng.uniform(0.2, 1.0), radius * rng.uniform(0.2, 1.0), mat);
+		}
+	}
+	return count;
+}
+
+// n x n grid of bunny instances on a floor, one in four a mirror. The grid
+// spacing fits the bunny, which is about 1.5 units wide with its feet at
+// y = 0.33.
+static long long writeBunnies(FILE *fp, Rng &rng, long long n, const string &obj)
+{
+	double spacing = 2.0;
+	double half = (n - 1) * spacing / 2.0;
+	double side = n * spacing;
+	fprintf(fp, "camera 0 %.6g %.6g  0 -0.6 -1  0 1 0  50\n", 1.0 + side * 0.6, half + 1.0 + side * 0.9);
+	fprintf(fp, "shadows on\n\n");
+	fprintf(fp, "light %.6g %.6g %.6g  0.6\n", -half, 4.0 + side, half);
+	fprintf(fp, "light %.6g %.6g %.6g  0.4\n\n", half, 2.0 + side, -half);
+	fprintf(fp, "material white  1 1 1  0 0 0  0.1 0.1 0.1  0\n");
+	fprintf(fp, "plane white  0 0 0  0 1 0\n\n");
+	for(long long i = 0; i < n; i++) {
+		for(long long j = 0; j < n; j++) {
+			bool mirror = rng.uniform() < 0.25;
+			int mat = (int)(rng.uniform() * NUM_MATERIALS);
+			fprintf(fp, "push\ntranslate %.6g -0.33 %.6g\nrotate %.4g  0 1 0\nmesh ", j * spacing - half, i * spacing - half, rng.uniform(0.0, 360.0));
+			if(mirror) {
+				fprintf(fp, "mirror %s\npop\n", obj.c_str());
+			} else {
+				fprintf(fp, "m%d %s\npop\n", mat, obj.c_str());
+			}
+		}
+	}
+	return n * n;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc < 5 || argc > 6) {
+		cout << "Usage: rtgen <TYPE> <SIZE> <SEED> <SCENE FILE> [MESH]" << endl;
+		cout << "  flake      SIZE = recursion depth (5 gives 66430 spheres)" << endl;
+		cout << "  spheres    SIZE = number of spheres" << endl;
+		cout << "  ellipsoids SIZE = number of ellipsoids" << endl;
+		cout << "  bunnies    SIZE = grid side, MESH defaults to bunny.obj" << endl;
+		cout << "Mesh paths are relative to the scene file." << endl;
+		return 1;
+	}
+
+	string type(argv[1]);
+	long long size = stoll(argv[2]);
+	uint64_t seed = stoull(argv[3]);
+	string filename(argv[4]);
+	string obj = argc == 6 ? argv[5] : "bunny.obj";
+
+	if(type != "flake" && type != "spheres" && type != "ellipsoids" && type != "bunnies") {
+		cerr << "Unknown scene type " << type << endl;
+		return 1;
+	}
+
+	FILE *fp = fopen(filename.c_str(), "w");
+	if(!fp) {
+		cerr << "Couldn't open " << filename << endl;
+		return 1;
+	}
+
+	Rng rng(seed);
+	fprintf(fp, "# Generated by: rtgen %s %lld %llu\n\n", type.c_str(), size, (unsigned long long)seed);
+	writeMaterials(fp, rng);
+
+	long long count = 0;
+	if(type == "flake") {
+		count = writeFlake(fp, (int)size);
+	} else if(type == "spheres") {
+		count = writeField(fp, rng, size, false);
+	} else if(type == "ellipsoids") {
+		count = writeField(fp, rng, size, true);
+	} else {
+		count = writeBunnies(fp, rng, size, obj);
+	}
+
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if(!ok) {
+		cerr << "Couldn't write to " << filename << endl;
+		return 1;
+	}
+	cout << "Wrote " << count << " primitives to " << filename << endl;
+	return 0;
+}